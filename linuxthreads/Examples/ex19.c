@@ -0,0 +1,124 @@
+/* Stress test for PTHREAD_MUTEX_QUEUED_NP mutexes: many threads hammer a
+   queued mutex and check that it provides mutual exclusion.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NTHREADS 16
+#define ITERATIONS 20000
+
+static pthread_mutex_t lock = PTHREAD_QUEUED_MUTEX_INITIALIZER_NP;
+static pthread_mutex_t lock2;
+static volatile int inside;
+static long counter;
+
+static void *
+worker (void *arg)
+{
+  pthread_mutex_t *m = arg;
+  int i;
+
+  for (i = 0; i < ITERATIONS; ++i)
+    {
+      if (pthread_mutex_lock (m) != 0)
+	{
+	  puts ("mutex_lock failed");
+	  exit (1);
+	}
+      if (inside++ != 0)
+	{
+	  puts ("two threads inside the critical section");
+	  exit (1);
+	}
+      ++counter;
+      --inside;
+      if (pthread_mutex_unlock (m) != 0)
+	{
+	  puts ("mutex_unlock failed");
+	  exit (1);
+	}
+    }
+
+  return NULL;
+}
+
+static int
+run (pthread_mutex_t *m)
+{
+  pthread_t th[NTHREADS];
+  int i;
+
+  counter = 0;
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_create (&th[i], NULL, worker, m) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_join (th[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+  if (counter != (long) NTHREADS * ITERATIONS)
+    {
+      printf ("counter is %ld, expected %ld\n", counter,
+	      (long) NTHREADS * ITERATIONS);
+      return 1;
+    }
+  return 0;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  pthread_mutexattr_t a;
+  int kind;
+
+  if (run (&lock))
+    return 1;
+
+  if (pthread_mutexattr_init (&a) != 0
+      || pthread_mutexattr_settype (&a, PTHREAD_MUTEX_QUEUED_NP) != 0
+      || pthread_mutexattr_gettype (&a, &kind) != 0
+      || kind != PTHREAD_MUTEX_QUEUED_NP
+      || pthread_mutex_init (&lock2, &a) != 0)
+    {
+      puts ("cannot initialize queued mutex");
+      return 1;
+    }
+  if (run (&lock2))
+    return 1;
+
+  if (pthread_mutex_trylock (&lock2) != 0)
+    {
+      puts ("trylock on free mutex failed");
+      return 1;
+    }
+  if (pthread_mutex_trylock (&lock2) != EBUSY)
+    {
+      puts ("trylock on locked mutex did not return EBUSY");
+      return 1;
+    }
+  if (pthread_mutex_destroy (&lock2) != EBUSY)
+    {
+      puts ("destroy of locked mutex did not return EBUSY");
+      return 1;
+    }
+  pthread_mutex_unlock (&lock2);
+  if (pthread_mutex_destroy (&lock2) != 0)
+    {
+      puts ("destroy failed");
+      return 1;
+    }
+
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
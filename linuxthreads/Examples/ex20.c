@@ -0,0 +1,135 @@
+/* Test for the spin count attribute of PTHREAD_MUTEX_ADAPTIVE_NP mutexes:
+   check that it is kept apart from the kind, and that mutexes with no
+   spinning, the default spinning and a large spin count all provide
+   mutual exclusion.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NTHREADS 8
+#define ITERATIONS 20000
+
+static pthread_mutex_t lock;
+static volatile int inside;
+static long counter;
+
+static void *
+worker (void *arg)
+{
+  int i;
+
+  for (i = 0; i < ITERATIONS; ++i)
+    {
+      if (pthread_mutex_lock (&lock) != 0)
+	{
+	  puts ("mutex_lock failed");
+	  exit (1);
+	}
+      if (inside++ != 0)
+	{
+	  puts ("two threads inside the critical section");
+	  exit (1);
+	}
+      ++counter;
+      --inside;
+      if (pthread_mutex_unlock (&lock) != 0)
+	{
+	  puts ("mutex_unlock failed");
+	  exit (1);
+	}
+    }
+
+  return NULL;
+}
+
+static int
+run (int spin)
+{
+  pthread_mutexattr_t a;
+  pthread_t th[NTHREADS];
+  int i, kind, val;
+
+  if (pthread_mutexattr_init (&a) != 0
+      || pthread_mutexattr_setspin_np (&a, spin) != 0
+      || pthread_mutexattr_settype (&a, PTHREAD_MUTEX_ADAPTIVE_NP) != 0)
+    {
+      puts ("cannot set up mutex attribute");
+      return 1;
+    }
+  if (pthread_mutexattr_gettype (&a, &kind) != 0
+      || kind != PTHREAD_MUTEX_ADAPTIVE_NP)
+    {
+      puts ("settype did not keep the kind");
+      return 1;
+    }
+  if (pthread_mutexattr_getspin_np (&a, &val) != 0 || val != spin)
+    {
+      printf ("getspin returned %d, expected %d\n", val, spin);
+      return 1;
+    }
+  if (pthread_mutex_init (&lock, &a) != 0)
+    {
+      puts ("mutex_init failed");
+      return 1;
+    }
+
+  counter = 0;
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_create (&th[i], NULL, worker, NULL) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_join (th[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+  if (counter != (long) NTHREADS * ITERATIONS)
+    {
+      printf ("counter is %ld, expected %ld\n", counter,
+	      (long) NTHREADS * ITERATIONS);
+      return 1;
+    }
+  if (pthread_mutex_destroy (&lock) != 0)
+    {
+      puts ("destroy failed");
+      return 1;
+    }
+  return 0;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  pthread_mutexattr_t a;
+  unsigned long acquired, suspended;
+
+  pthread_mutexattr_init (&a);
+  if (pthread_mutexattr_setspin_np (&a, -2) != EINVAL)
+    {
+      puts ("setspin accepted a negative count");
+      return 1;
+    }
+
+  if (run (0) || run (-1) || run (100000))
+    return 1;
+
+  if (pthread_mutex_getspinstats_np (&acquired, &suspended) != 0)
+    {
+      puts ("getspinstats failed");
+      return 1;
+    }
+  printf ("%lu contended locks acquired by spinning, %lu suspended\n",
+	  acquired, suspended);
+
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
@@ -0,0 +1,119 @@
+/* Test for the fair spinlocks selected with the PTHREAD_SPIN_TICKET_NP
+   and PTHREAD_SPIN_QUEUED_NP flags of pthread_spin_init: many threads
+   increment a counter under the lock, and trylock must fail while the
+   lock is taken.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NTHREADS 6
+#define ITERATIONS 2000
+
+static pthread_spinlock_t lock;
+static volatile int inside;
+static long counter;
+
+static void *
+worker (void *arg)
+{
+  int i;
+
+  for (i = 0; i < ITERATIONS; ++i)
+    {
+      if (pthread_spin_lock (&lock) != 0)
+	{
+	  puts ("spin_lock failed");
+	  exit (1);
+	}
+      if (inside++ != 0)
+	{
+	  puts ("two threads inside the critical section");
+	  exit (1);
+	}
+      /* Get preempted with the lock held now and then.  */
+      if (i % 64 == 0)
+	sched_yield ();
+      ++counter;
+      --inside;
+      if (pthread_spin_unlock (&lock) != 0)
+	{
+	  puts ("spin_unlock failed");
+	  exit (1);
+	}
+    }
+
+  return NULL;
+}
+
+static int
+run (int flags)
+{
+  pthread_t th[NTHREADS];
+  int i;
+
+  if (pthread_spin_init (&lock, flags) != 0)
+    {
+      printf ("spin_init with flags %#x failed\n", flags);
+      return 1;
+    }
+
+  if (pthread_spin_trylock (&lock) != 0)
+    {
+      puts ("trylock on free spinlock failed");
+      return 1;
+    }
+  if (pthread_spin_trylock (&lock) != EBUSY)
+    {
+      puts ("trylock on taken spinlock did not return EBUSY");
+      return 1;
+    }
+  pthread_spin_unlock (&lock);
+
+  counter = 0;
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_create (&th[i], NULL, worker, NULL) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_join (th[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+  if (counter != (long) NTHREADS * ITERATIONS)
+    {
+      printf ("counter is %ld, expected %ld\n", counter,
+	      (long) NTHREADS * ITERATIONS);
+      return 1;
+    }
+
+  if (pthread_spin_trylock (&lock) != 0)
+    {
+      puts ("spinlock not free at the end");
+      return 1;
+    }
+  pthread_spin_unlock (&lock);
+  return pthread_spin_destroy (&lock) != 0;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  if (run (PTHREAD_PROCESS_PRIVATE)
+      || run (PTHREAD_SPIN_TICKET_NP)
+      || run (PTHREAD_SPIN_QUEUED_NP)
+      || run (PTHREAD_PROCESS_SHARED | PTHREAD_SPIN_QUEUED_NP))
+    return 1;
+
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
@@ -0,0 +1,179 @@
+/* Test for pthread_mutex_timedlock and the contended paths of all mutex
+   kinds: a thread holding the mutex makes timed locks of another thread
+   time out, and threads blocked on the mutex get it when it is
+   unlocked.  Adaptive and recursive mutexes only time out when they are
+   futex words, so only the other kinds are checked for that.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define NTHREADS 4
+
+static const struct
+{
+  int kind;
+  int times_out;
+} kinds[] =
+{
+  { PTHREAD_MUTEX_TIMED_NP, 1 },
+  { PTHREAD_MUTEX_ADAPTIVE_NP, 0 },
+  { PTHREAD_MUTEX_RECURSIVE_NP, 0 },
+  { PTHREAD_MUTEX_ERRORCHECK_NP, 1 }
+};
+
+static pthread_mutex_t lock;
+static int counter;
+
+static void
+deadline (struct timespec *ts, long msec)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  ts->tv_sec = tv.tv_sec + msec / 1000;
+  ts->tv_nsec = tv.tv_usec * 1000 + (msec % 1000) * 1000000;
+  if (ts->tv_nsec >= 1000000000)
+    {
+      ts->tv_nsec -= 1000000000;
+      ++ts->tv_sec;
+    }
+}
+
+static void *
+timed_waiter (void *arg)
+{
+  struct timespec ts;
+
+  deadline (&ts, 100);
+  return (void *) (long) pthread_mutex_timedlock (&lock, &ts);
+}
+
+static void *
+waiter (void *arg)
+{
+  if (pthread_mutex_lock (&lock) != 0)
+    {
+      puts ("mutex_lock failed");
+      exit (1);
+    }
+  ++counter;
+  if (pthread_mutex_unlock (&lock) != 0)
+    {
+      puts ("mutex_unlock failed");
+      exit (1);
+    }
+  return NULL;
+}
+
+static int
+run (int kind, int times_out)
+{
+  pthread_mutexattr_t a;
+  pthread_t th[NTHREADS];
+  void *res;
+  int i;
+
+  if (pthread_mutexattr_init (&a) != 0
+      || pthread_mutexattr_settype (&a, kind) != 0
+      || pthread_mutex_init (&lock, &a) != 0)
+    {
+      printf ("cannot initialize mutex of kind %d\n", kind);
+      return 1;
+    }
+
+  if (pthread_mutex_lock (&lock) != 0)
+    {
+      puts ("mutex_lock failed");
+      return 1;
+    }
+
+  if (times_out)
+    {
+      if (pthread_create (&th[0], NULL, timed_waiter, NULL) != 0
+	  || pthread_join (th[0], &res) != 0)
+	{
+	  puts ("cannot run timed waiter");
+	  return 1;
+	}
+      if ((long) res != ETIMEDOUT)
+	{
+	  printf ("kind %d: timedlock returned %ld, expected ETIMEDOUT\n",
+		  kind, (long) res);
+	  return 1;
+	}
+    }
+
+  counter = 0;
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_create (&th[i], NULL, waiter, NULL) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  /* Give the waiters time to block.  */
+  usleep (100000);
+  if (counter != 0)
+    {
+      printf ("kind %d: a waiter got a locked mutex\n", kind);
+      return 1;
+    }
+  if (pthread_mutex_unlock (&lock) != 0)
+    {
+      puts ("mutex_unlock failed");
+      return 1;
+    }
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_join (th[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+  if (counter != NTHREADS)
+    {
+      printf ("kind %d: counter is %d, expected %d\n", kind, counter,
+	      NTHREADS);
+      return 1;
+    }
+
+  if (pthread_create (&th[0], NULL, timed_waiter, NULL) != 0
+      || pthread_join (th[0], &res) != 0)
+    {
+      puts ("cannot run timed waiter");
+      return 1;
+    }
+  if ((long) res != 0)
+    {
+      printf ("kind %d: timedlock on free mutex returned %ld\n",
+	      kind, (long) res);
+      return 1;
+    }
+  /* The timed waiter exited with the mutex locked.  */
+  if (pthread_mutex_destroy (&lock) != EBUSY)
+    {
+      printf ("kind %d: destroy of locked mutex did not return EBUSY\n",
+	      kind);
+      return 1;
+    }
+  return 0;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 20
+static int
+do_test (void)
+{
+  int i;
+
+  for (i = 0; i < sizeof (kinds) / sizeof (kinds[0]); ++i)
+    if (run (kinds[i].kind, kinds[i].times_out))
+      return 1;
+
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
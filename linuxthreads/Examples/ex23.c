@@ -0,0 +1,197 @@
+/* Test for process-shared mutexes, condition variables, barriers and
+   rwlocks: several processes share them through an anonymous shared
+   mapping.  Each round of the barrier, every process hands a token to
+   the next one through the condition variable, and updates two counters
+   under the rwlock, which readers check to be equal.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define NPROCS 4
+#define ROUNDS 200
+
+static struct shared
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_barrier_t barrier;
+  pthread_rwlock_t rwlock;
+  int turn;
+  int tokens;
+  long a, b;
+} *sh;
+
+static int
+child (int n)
+{
+  int round, err;
+
+  for (round = 0; round < ROUNDS; ++round)
+    {
+      err = pthread_barrier_wait (&sh->barrier);
+      if (err != 0 && err != PTHREAD_BARRIER_SERIAL_THREAD)
+	{
+	  printf ("process %d: barrier_wait failed\n", n);
+	  return 1;
+	}
+
+      /* Wait for our turn, then pass the token on.  */
+      if (pthread_mutex_lock (&sh->lock) != 0)
+	{
+	  printf ("process %d: mutex_lock failed\n", n);
+	  return 1;
+	}
+      while (sh->turn != n)
+	if (pthread_cond_wait (&sh->cond, &sh->lock) != 0)
+	  {
+	    printf ("process %d: cond_wait failed\n", n);
+	    return 1;
+	  }
+      ++sh->tokens;
+      sh->turn = (n + 1) % NPROCS;
+      pthread_cond_broadcast (&sh->cond);
+      if (pthread_mutex_lock (&sh->lock) != EDEADLK)
+	{
+	  printf ("process %d: relocking the mutex did not fail\n", n);
+	  return 1;
+	}
+      if (pthread_mutex_unlock (&sh->lock) != 0)
+	{
+	  printf ("process %d: mutex_unlock failed\n", n);
+	  return 1;
+	}
+
+      if (round % NPROCS == n)
+	{
+	  if (pthread_rwlock_wrlock (&sh->rwlock) != 0)
+	    {
+	      printf ("process %d: rwlock_wrlock failed\n", n);
+	      return 1;
+	    }
+	  ++sh->a;
+	  usleep (100);
+	  ++sh->b;
+	}
+      else
+	{
+	  if (pthread_rwlock_rdlock (&sh->rwlock) != 0)
+	    {
+	      printf ("process %d: rwlock_rdlock failed\n", n);
+	      return 1;
+	    }
+	  if (sh->a != sh->b)
+	    {
+	      printf ("process %d: reader saw a writer at work\n", n);
+	      return 1;
+	    }
+	}
+      if (pthread_rwlock_unlock (&sh->rwlock) != 0)
+	{
+	  printf ("process %d: rwlock_unlock failed\n", n);
+	  return 1;
+	}
+    }
+  return 0;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  pthread_mutexattr_t ma;
+  pthread_condattr_t ca;
+  pthread_barrierattr_t ba;
+  pthread_rwlockattr_t ra;
+  pid_t pids[NPROCS];
+  int i, status, result = 0;
+
+  sh = mmap (NULL, sizeof *sh, PROT_READ | PROT_WRITE,
+	     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (sh == MAP_FAILED)
+    {
+      puts ("mmap failed");
+      return 1;
+    }
+
+  if (pthread_mutexattr_init (&ma) != 0
+      || pthread_mutexattr_settype (&ma, PTHREAD_MUTEX_ERRORCHECK_NP) != 0)
+    {
+      puts ("cannot set up mutex attribute");
+      return 1;
+    }
+  if (pthread_mutexattr_setpshared (&ma, PTHREAD_PROCESS_SHARED) == ENOSYS)
+    {
+      puts ("process-shared objects not supported");
+      return 0;
+    }
+  pthread_condattr_init (&ca);
+  pthread_barrierattr_init (&ba);
+  pthread_rwlockattr_init (&ra);
+  if (pthread_condattr_setpshared (&ca, PTHREAD_PROCESS_SHARED) != 0
+      || pthread_barrierattr_setpshared (&ba, PTHREAD_PROCESS_SHARED) != 0
+      || pthread_rwlockattr_setpshared (&ra, PTHREAD_PROCESS_SHARED) != 0)
+    {
+      puts ("setpshared failed");
+      return 1;
+    }
+  if (pthread_mutexattr_getpshared (&ma, &i) != 0
+      || i != PTHREAD_PROCESS_SHARED
+      || pthread_condattr_getpshared (&ca, &i) != 0
+      || i != PTHREAD_PROCESS_SHARED)
+    {
+      puts ("getpshared did not return PTHREAD_PROCESS_SHARED");
+      return 1;
+    }
+  if (pthread_mutex_init (&sh->lock, &ma) != 0
+      || pthread_cond_init (&sh->cond, &ca) != 0
+      || pthread_barrier_init (&sh->barrier, &ba, NPROCS) != 0
+      || pthread_rwlock_init (&sh->rwlock, &ra) != 0)
+    {
+      puts ("cannot initialize shared objects");
+      return 1;
+    }
+
+  for (i = 0; i < NPROCS; ++i)
+    {
+      pids[i] = fork ();
+      if (pids[i] == 0)
+	_exit (child (i));
+      if (pids[i] < 0)
+	{
+	  puts ("fork failed");
+	  return 1;
+	}
+    }
+
+  for (i = 0; i < NPROCS; ++i)
+    if (waitpid (pids[i], &status, 0) != pids[i]
+	|| !WIFEXITED (status) || WEXITSTATUS (status) != 0)
+      result = 1;
+
+  if (sh->tokens != NPROCS * ROUNDS || sh->a != ROUNDS || sh->b != ROUNDS)
+    {
+      printf ("tokens %d, counters %ld and %ld, expected %d, %d and %d\n",
+	      sh->tokens, sh->a, sh->b, NPROCS * ROUNDS, ROUNDS, ROUNDS);
+      result = 1;
+    }
+  if (pthread_mutex_destroy (&sh->lock) != 0
+      || pthread_cond_destroy (&sh->cond) != 0
+      || pthread_barrier_destroy (&sh->barrier) != 0
+      || pthread_rwlock_destroy (&sh->rwlock) != 0)
+    {
+      puts ("destroy failed");
+      result = 1;
+    }
+
+  if (result == 0)
+    puts ("All OK");
+  return result;
+}
+
+#include "../../test-skeleton.c"
@@ -0,0 +1,109 @@
+/* Test for pthread_cond_broadcast waking up many threads waiting with a
+   held mutex, which it moves over to the mutex instead of waking them all
+   up.  Each round, the main thread broadcasts while holding the mutex;
+   all the waiters must then get the mutex in turn, and own it.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NTHREADS 64
+#define ROUNDS 100
+
+static pthread_mutex_t lock;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static int round_nr;
+static int arrived;
+
+static void *
+waiter (void *arg)
+{
+  int my_round = 0;
+
+  if (pthread_mutex_lock (&lock) != 0)
+    {
+      puts ("mutex_lock failed");
+      exit (1);
+    }
+  while (my_round < ROUNDS)
+    {
+      while (round_nr == my_round)
+	if (pthread_cond_wait (&cond, &lock) != 0)
+	  {
+	    puts ("cond_wait failed");
+	    exit (1);
+	  }
+      my_round = round_nr;
+      /* The mutex is an error-checking one: it knows we own it.  */
+      if (pthread_mutex_lock (&lock) != EDEADLK)
+	{
+	  puts ("relocking the mutex did not fail");
+	  exit (1);
+	}
+      if (++arrived == NTHREADS)
+	pthread_cond_signal (&done_cond);
+    }
+  if (pthread_mutex_unlock (&lock) != 0)
+    {
+      puts ("mutex_unlock failed");
+      exit (1);
+    }
+  return NULL;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  pthread_mutexattr_t ma;
+  pthread_t th[NTHREADS];
+  int i;
+
+  if (pthread_mutexattr_init (&ma) != 0
+      || pthread_mutexattr_settype (&ma, PTHREAD_MUTEX_ERRORCHECK_NP) != 0
+      || pthread_mutex_init (&lock, &ma) != 0)
+    {
+      puts ("cannot set up the mutex");
+      return 1;
+    }
+
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_create (&th[i], NULL, waiter, NULL) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+
+  pthread_mutex_lock (&lock);
+  arrived = NTHREADS;
+  for (i = 0; i < ROUNDS; ++i)
+    {
+      while (arrived != NTHREADS)
+	pthread_cond_wait (&done_cond, &lock);
+      arrived = 0;
+      ++round_nr;
+      pthread_cond_broadcast (&cond);
+    }
+  pthread_mutex_unlock (&lock);
+
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_join (th[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+
+  if (arrived != NTHREADS)
+    {
+      printf ("%d threads saw the last round, expected %d\n",
+	      arrived, NTHREADS);
+      return 1;
+    }
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
@@ -0,0 +1,123 @@
+/* Test for condition variables timing out on CLOCK_MONOTONIC, set up with
+   pthread_condattr_setclock: a timed wait on a deadline one monotonic
+   tenth of a second ahead must time out, not earlier, while a deadline on
+   CLOCK_REALTIME would be far in the past.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+timed_wait (pthread_cond_t *cond)
+{
+  struct timespec start, deadline, now;
+  int err;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  deadline = start;
+  deadline.tv_nsec += 100000000;
+  if (deadline.tv_nsec >= 1000000000)
+    {
+      deadline.tv_nsec -= 1000000000;
+      ++deadline.tv_sec;
+    }
+
+  pthread_mutex_lock (&lock);
+  do
+    err = pthread_cond_timedwait (cond, &lock, &deadline);
+  while (err == 0);
+  pthread_mutex_unlock (&lock);
+  if (err != ETIMEDOUT)
+    {
+      printf ("cond_timedwait returned %d\n", err);
+      return 1;
+    }
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  if (now.tv_sec < deadline.tv_sec
+      || (now.tv_sec == deadline.tv_sec && now.tv_nsec < deadline.tv_nsec))
+    {
+      puts ("cond_timedwait timed out early");
+      return 1;
+    }
+  if (now.tv_sec > start.tv_sec + 5)
+    {
+      puts ("cond_timedwait timed out late");
+      return 1;
+    }
+  return 0;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 20
+static int
+do_test (void)
+{
+  pthread_condattr_t ca;
+  pthread_cond_t cond;
+  clockid_t clock;
+
+  if (pthread_condattr_init (&ca) != 0)
+    {
+      puts ("condattr_init failed");
+      return 1;
+    }
+  if (pthread_condattr_getclock (&ca, &clock) != 0
+      || clock != CLOCK_REALTIME)
+    {
+      puts ("the default clock is not CLOCK_REALTIME");
+      return 1;
+    }
+  if (pthread_condattr_setclock (&ca, CLOCK_PROCESS_CPUTIME_ID) != EINVAL)
+    {
+      puts ("setclock accepted a CPU clock");
+      return 1;
+    }
+  if (pthread_condattr_setclock (&ca, CLOCK_MONOTONIC) != 0)
+    {
+      puts ("CLOCK_MONOTONIC not supported");
+      return 0;
+    }
+  if (pthread_condattr_getclock (&ca, &clock) != 0
+      || clock != CLOCK_MONOTONIC)
+    {
+      puts ("getclock did not return CLOCK_MONOTONIC");
+      return 1;
+    }
+
+  if (pthread_cond_init (&cond, &ca) != 0)
+    {
+      puts ("cond_init failed");
+      return 1;
+    }
+  if (timed_wait (&cond))
+    return 1;
+  pthread_cond_destroy (&cond);
+
+  /* The clock and the process-shared flag are independent.  */
+  if (pthread_condattr_setpshared (&ca, PTHREAD_PROCESS_SHARED) == 0)
+    {
+      if (pthread_condattr_getclock (&ca, &clock) != 0
+	  || clock != CLOCK_MONOTONIC)
+	{
+	  puts ("setpshared changed the clock");
+	  return 1;
+	}
+      if (pthread_cond_init (&cond, &ca) != 0)
+	{
+	  puts ("cond_init of a process-shared condvar failed");
+	  return 1;
+	}
+      if (timed_wait (&cond))
+	return 1;
+      pthread_cond_destroy (&cond);
+    }
+
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
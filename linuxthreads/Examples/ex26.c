@@ -0,0 +1,111 @@
+/* Test for pthread_cond_signal called with the mutex held, which defers
+   the wakeup until the mutex is released when LINUXTHREADS_COND_DEFER is
+   set.  Two threads hand a token back and forth, signalling while they
+   hold the mutex, with mutexes of each kind, the recursive one locked
+   twice; the waiter must come back whichever way the signaller releases
+   the mutex.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define ROUNDS 1000
+
+static pthread_mutex_t lock;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int turn;
+static int recursive;
+
+static void
+pass_token (int me)
+{
+  struct timespec ts;
+
+  pthread_mutex_lock (&lock);
+  while (turn != me)
+    if (me == 0)
+      pthread_cond_wait (&cond, &lock);
+    else
+      {
+	clock_gettime (CLOCK_REALTIME, &ts);
+	ts.tv_sec += 10;
+	if (pthread_cond_timedwait (&cond, &lock, &ts) == ETIMEDOUT)
+	  {
+	    puts ("cond_timedwait timed out");
+	    exit (1);
+	  }
+      }
+  if (recursive)
+    pthread_mutex_lock (&lock);
+  turn = 1 - me;
+  pthread_cond_signal (&cond);
+  if (recursive)
+    /* Only the second unlock releases the mutex.  */
+    pthread_mutex_unlock (&lock);
+  pthread_mutex_unlock (&lock);
+}
+
+static void *
+partner (void *arg)
+{
+  int i;
+
+  for (i = 0; i < ROUNDS; ++i)
+    pass_token (1);
+  return NULL;
+}
+
+static int
+run (int kind)
+{
+  pthread_mutexattr_t ma;
+  pthread_t th;
+  int i;
+
+  if (pthread_mutexattr_init (&ma) != 0
+      || pthread_mutexattr_settype (&ma, kind) != 0
+      || pthread_mutex_init (&lock, &ma) != 0)
+    {
+      puts ("cannot set up the mutex");
+      return 1;
+    }
+  recursive = kind == PTHREAD_MUTEX_RECURSIVE_NP;
+  turn = 0;
+
+  if (pthread_create (&th, NULL, partner, NULL) != 0)
+    {
+      puts ("create failed");
+      return 1;
+    }
+  for (i = 0; i < ROUNDS; ++i)
+    pass_token (0);
+  if (pthread_join (th, NULL) != 0)
+    {
+      puts ("join failed");
+      return 1;
+    }
+  if (pthread_mutex_destroy (&lock) != 0)
+    {
+      puts ("mutex_destroy failed");
+      return 1;
+    }
+  return 0;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  if (run (PTHREAD_MUTEX_TIMED_NP)
+      || run (PTHREAD_MUTEX_RECURSIVE_NP)
+      || run (PTHREAD_MUTEX_ADAPTIVE_NP)
+      || run (PTHREAD_MUTEX_ERRORCHECK_NP))
+    return 1;
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
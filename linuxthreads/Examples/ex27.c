@@ -0,0 +1,221 @@
+/* Test for rwlocks of kind PTHREAD_RWLOCK_PREFER_READER_SCALABLE_NP,
+   whose readers keep off the rwlock itself while no writer comes: the
+   readers check that two counters updated by the writers are equal, and
+   take their read lock twice, which must not deadlock with a writer
+   waiting for the first one.  A read lock held by another thread must
+   make trywrlock, timedwrlock and destroy fail.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NTHREADS 8
+#define ROUNDS 20000
+
+static pthread_rwlock_t rwlock;
+static pthread_rwlock_t static_rwlock = PTHREAD_RWLOCK_SCALABLE_INITIALIZER_NP;
+static long a, b;
+
+static void *
+worker (void *arg)
+{
+  long n = (long) arg;
+  int i;
+
+  for (i = 0; i < ROUNDS; ++i)
+    if (i % 100 == n)
+      {
+	if (pthread_rwlock_wrlock (&rwlock) != 0)
+	  {
+	    puts ("wrlock failed");
+	    exit (1);
+	  }
+	++a;
+	++b;
+	if (pthread_rwlock_unlock (&rwlock) != 0)
+	  {
+	    puts ("unlock of a write lock failed");
+	    exit (1);
+	  }
+      }
+    else
+      {
+	if (pthread_rwlock_rdlock (&rwlock) != 0
+	    || pthread_rwlock_rdlock (&rwlock) != 0)
+	  {
+	    puts ("rdlock failed");
+	    exit (1);
+	  }
+	if (a != b)
+	  {
+	    puts ("reader saw a writer at work");
+	    exit (1);
+	  }
+	if (pthread_rwlock_unlock (&rwlock) != 0
+	    || pthread_rwlock_unlock (&rwlock) != 0)
+	  {
+	    puts ("unlock of a read lock failed");
+	    exit (1);
+	  }
+      }
+  return NULL;
+}
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int state;
+
+static void *
+reader (void *arg)
+{
+  pthread_rwlock_t *rw = arg;
+
+  if (pthread_rwlock_rdlock (rw) != 0)
+    {
+      puts ("rdlock in reader failed");
+      exit (1);
+    }
+  pthread_mutex_lock (&lock);
+  state = 1;
+  pthread_cond_signal (&cond);
+  while (state != 2)
+    pthread_cond_wait (&cond, &lock);
+  pthread_mutex_unlock (&lock);
+  if (pthread_rwlock_unlock (rw) != 0)
+    {
+      puts ("unlock in reader failed");
+      exit (1);
+    }
+  return NULL;
+}
+
+static int
+check_held (pthread_rwlock_t *rw)
+{
+  pthread_t th;
+  struct timespec ts;
+  int i;
+
+  /* Lock and unlock a few times, which lets the readers use the fast
+     path afterwards.  */
+  for (i = 0; i < 1000; ++i)
+    if (pthread_rwlock_rdlock (rw) != 0 || pthread_rwlock_unlock (rw) != 0)
+      {
+	puts ("rdlock or unlock failed");
+	return 1;
+      }
+
+  state = 0;
+  if (pthread_create (&th, NULL, reader, rw) != 0)
+    {
+      puts ("create failed");
+      return 1;
+    }
+  pthread_mutex_lock (&lock);
+  while (state != 1)
+    pthread_cond_wait (&cond, &lock);
+  pthread_mutex_unlock (&lock);
+
+  if (pthread_rwlock_trywrlock (rw) != EBUSY)
+    {
+      puts ("trywrlock did not fail with a reader");
+      return 1;
+    }
+  clock_gettime (CLOCK_REALTIME, &ts);
+  ts.tv_nsec += 100000000;
+  if (ts.tv_nsec >= 1000000000)
+    {
+      ts.tv_nsec -= 1000000000;
+      ++ts.tv_sec;
+    }
+  if (pthread_rwlock_timedwrlock (rw, &ts) != ETIMEDOUT)
+    {
+      puts ("timedwrlock did not time out with a reader");
+      return 1;
+    }
+  if (pthread_rwlock_destroy (rw) != EBUSY)
+    {
+      puts ("destroy did not fail with a reader");
+      return 1;
+    }
+  /* Other readers still get in.  */
+  if (pthread_rwlock_tryrdlock (rw) != 0 || pthread_rwlock_unlock (rw) != 0)
+    {
+      puts ("tryrdlock failed with a reader");
+      return 1;
+    }
+
+  pthread_mutex_lock (&lock);
+  state = 2;
+  pthread_cond_signal (&cond);
+  pthread_mutex_unlock (&lock);
+  if (pthread_join (th, NULL) != 0)
+    {
+      puts ("join failed");
+      return 1;
+    }
+
+  if (pthread_rwlock_trywrlock (rw) != 0 || pthread_rwlock_unlock (rw) != 0)
+    {
+      puts ("trywrlock failed without readers");
+      return 1;
+    }
+  return 0;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  pthread_rwlockattr_t ra;
+  pthread_t th[NTHREADS];
+  long i;
+  int kind;
+
+  if (pthread_rwlockattr_init (&ra) != 0
+      || pthread_rwlockattr_setkind_np (&ra,
+					PTHREAD_RWLOCK_PREFER_READER_SCALABLE_NP)
+	 != 0
+      || pthread_rwlockattr_getkind_np (&ra, &kind) != 0
+      || kind != PTHREAD_RWLOCK_PREFER_READER_SCALABLE_NP
+      || pthread_rwlock_init (&rwlock, &ra) != 0)
+    {
+      puts ("cannot set up the rwlock");
+      return 1;
+    }
+
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_create (&th[i], NULL, worker, (void *) i) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_join (th[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+  if (a != NTHREADS * (ROUNDS / 100) || b != a)
+    {
+      printf ("counters %ld and %ld, expected %d\n",
+	      a, b, NTHREADS * (ROUNDS / 100));
+      return 1;
+    }
+
+  if (check_held (&rwlock) || check_held (&static_rwlock))
+    return 1;
+  if (pthread_rwlock_destroy (&rwlock) != 0)
+    {
+      puts ("destroy failed");
+      return 1;
+    }
+
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
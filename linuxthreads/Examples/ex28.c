@@ -0,0 +1,203 @@
+/* Test for rwlocks of each preference kind, whose readers take and
+   release them without the internal lock while no thread waits: readers
+   check that two counters updated by the writers are equal.  Then, with
+   a read lock held and a writer waiting, another reader must only get in
+   if the rwlock prefers readers, and the holder must still get another
+   read lock unless the rwlock is non-recursive.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define NTHREADS 8
+#define ROUNDS 20000
+
+static pthread_rwlock_t rwlock;
+static long a, b;
+
+static void *
+worker (void *arg)
+{
+  long n = (long) arg;
+  int i;
+
+  for (i = 0; i < ROUNDS; ++i)
+    if (i % 50 == n)
+      {
+	if (pthread_rwlock_wrlock (&rwlock) != 0)
+	  {
+	    puts ("wrlock failed");
+	    exit (1);
+	  }
+	++a;
+	++b;
+	if (pthread_rwlock_unlock (&rwlock) != 0)
+	  {
+	    puts ("unlock of a write lock failed");
+	    exit (1);
+	  }
+      }
+    else
+      {
+	if (pthread_rwlock_rdlock (&rwlock) != 0)
+	  {
+	    puts ("rdlock failed");
+	    exit (1);
+	  }
+	if (a != b)
+	  {
+	    puts ("reader saw a writer at work");
+	    exit (1);
+	  }
+	if (pthread_rwlock_unlock (&rwlock) != 0)
+	  {
+	    puts ("unlock of a read lock failed");
+	    exit (1);
+	  }
+      }
+  return NULL;
+}
+
+static void *
+writer (void *arg)
+{
+  if (pthread_rwlock_wrlock (&rwlock) != 0)
+    {
+      puts ("wrlock in writer failed");
+      exit (1);
+    }
+  ++a;
+  ++b;
+  if (pthread_rwlock_unlock (&rwlock) != 0)
+    {
+      puts ("unlock in writer failed");
+      exit (1);
+    }
+  return NULL;
+}
+
+static void *
+tryreader (void *arg)
+{
+  int err = pthread_rwlock_tryrdlock (&rwlock);
+
+  if (err == 0)
+    pthread_rwlock_unlock (&rwlock);
+  return (void *) (long) err;
+}
+
+static int
+run (int kind)
+{
+  pthread_rwlockattr_t ra;
+  pthread_t th[NTHREADS], wth, rth;
+  void *res;
+  long i;
+
+  if (pthread_rwlockattr_init (&ra) != 0
+      || pthread_rwlockattr_setkind_np (&ra, kind) != 0
+      || pthread_rwlock_init (&rwlock, &ra) != 0)
+    {
+      puts ("cannot set up the rwlock");
+      return 1;
+    }
+  a = b = 0;
+
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_create (&th[i], NULL, worker, (void *) i) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_join (th[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+  if (a != NTHREADS * (ROUNDS / 50) || b != a)
+    {
+      printf ("kind %d: counters %ld and %ld, expected %d\n",
+	      kind, a, b, NTHREADS * (ROUNDS / 50));
+      return 1;
+    }
+
+  if (pthread_rwlock_rdlock (&rwlock) != 0)
+    {
+      puts ("rdlock failed");
+      return 1;
+    }
+  if (pthread_create (&wth, NULL, writer, NULL) != 0)
+    {
+      puts ("create failed");
+      return 1;
+    }
+  /* Give the writer time to queue up.  */
+  usleep (100000);
+
+  if (pthread_create (&rth, NULL, tryreader, NULL) != 0
+      || pthread_join (rth, &res) != 0)
+    {
+      puts ("tryreader failed");
+      return 1;
+    }
+  if (res != (kind == PTHREAD_RWLOCK_PREFER_READER_NP ? 0 : (void *) EBUSY))
+    {
+      printf ("kind %d: tryrdlock with a writer waiting returned %ld\n",
+	      kind, (long) res);
+      return 1;
+    }
+  if (kind != PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP)
+    {
+      if (pthread_rwlock_rdlock (&rwlock) != 0)
+	{
+	  puts ("recursive rdlock failed");
+	  return 1;
+	}
+      if (pthread_rwlock_unlock (&rwlock) != 0)
+	{
+	  puts ("unlock of the recursive read lock failed");
+	  return 1;
+	}
+    }
+  if (a != NTHREADS * (ROUNDS / 50))
+    {
+      printf ("kind %d: writer got in with a reader\n", kind);
+      return 1;
+    }
+  if (pthread_rwlock_unlock (&rwlock) != 0
+      || pthread_join (wth, NULL) != 0)
+    {
+      puts ("unlock or join of the writer failed");
+      return 1;
+    }
+  if (a != NTHREADS * (ROUNDS / 50) + 1)
+    {
+      printf ("kind %d: writer did not get in\n", kind);
+      return 1;
+    }
+
+  if (pthread_rwlock_destroy (&rwlock) != 0)
+    {
+      puts ("destroy failed");
+      return 1;
+    }
+  return 0;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  if (run (PTHREAD_RWLOCK_PREFER_READER_NP)
+      || run (PTHREAD_RWLOCK_PREFER_WRITER_NP)
+      || run (PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP))
+    return 1;
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
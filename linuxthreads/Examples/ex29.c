@@ -0,0 +1,164 @@
+/* Test for the tracking of the read locks of writer-preferring rwlocks,
+   which lets a thread take another read lock while a writer waits: a
+   thread holds read locks on more rwlocks than its descriptor tracks,
+   and must get each of them again with a writer waiting on it.  A
+   tryrdlock or timedrdlock which fails must not count as a read lock
+   held afterwards.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NLOCKS 40
+
+static pthread_rwlock_t locks[NLOCKS];
+
+static void *
+writer (void *arg)
+{
+  pthread_rwlock_t *rw = arg;
+
+  if (pthread_rwlock_wrlock (rw) != 0)
+    {
+      puts ("wrlock in writer failed");
+      exit (1);
+    }
+  if (pthread_rwlock_unlock (rw) != 0)
+    {
+      puts ("unlock in writer failed");
+      exit (1);
+    }
+  return NULL;
+}
+
+static int
+timed_rdlock (pthread_rwlock_t *rw)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+  ts.tv_nsec += 100000000;
+  if (ts.tv_nsec >= 1000000000)
+    {
+      ts.tv_nsec -= 1000000000;
+      ++ts.tv_sec;
+    }
+  return pthread_rwlock_timedrdlock (rw, &ts);
+}
+
+static void *
+reader (void *arg)
+{
+  pthread_rwlock_t *rw = arg;
+  int err;
+
+  /* A writer waits, and this thread holds no read lock yet.  */
+  if (pthread_rwlock_tryrdlock (rw) != EBUSY)
+    {
+      puts ("tryrdlock did not fail with a writer waiting");
+      exit (1);
+    }
+  if (timed_rdlock (rw) != ETIMEDOUT)
+    {
+      puts ("timedrdlock did not time out with a writer waiting");
+      exit (1);
+    }
+  /* Neither of them left a read lock behind.  */
+  err = timed_rdlock (rw);
+  if (err != ETIMEDOUT)
+    {
+      printf ("timedrdlock after failures returned %d\n", err);
+      exit (1);
+    }
+  return NULL;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  pthread_rwlockattr_t ra;
+  pthread_t wth, rth;
+  int i, j;
+
+  if (pthread_rwlockattr_init (&ra) != 0
+      || pthread_rwlockattr_setkind_np (&ra,
+					PTHREAD_RWLOCK_PREFER_WRITER_NP) != 0)
+    {
+      puts ("cannot set up the rwlock attribute");
+      return 1;
+    }
+  for (i = 0; i < NLOCKS; ++i)
+    if (pthread_rwlock_init (&locks[i], &ra) != 0
+	|| pthread_rwlock_rdlock (&locks[i]) != 0)
+      {
+	puts ("init or rdlock failed");
+	return 1;
+      }
+
+  for (i = 0; i < NLOCKS; ++i)
+    {
+      if (pthread_create (&wth, NULL, writer, &locks[i]) != 0)
+	{
+	  puts ("create failed");
+	  return 1;
+	}
+      /* Give the writer time to queue up.  */
+      usleep (20000);
+
+      if (i == 0)
+	{
+	  if (pthread_create (&rth, NULL, reader, &locks[i]) != 0
+	      || pthread_join (rth, NULL) != 0)
+	    {
+	      puts ("reader failed");
+	      return 1;
+	    }
+	}
+
+      for (j = 0; j < 3; ++j)
+	if (pthread_rwlock_rdlock (&locks[i]) != 0)
+	  {
+	    printf ("recursive rdlock %d of lock %d failed\n", j, i);
+	    return 1;
+	  }
+      if (pthread_rwlock_tryrdlock (&locks[i]) != EBUSY)
+	{
+	  printf ("recursive tryrdlock of lock %d did not fail\n", i);
+	  return 1;
+	}
+      for (j = 0; j < 3; ++j)
+	if (pthread_rwlock_unlock (&locks[i]) != 0)
+	  {
+	    printf ("unlock %d of lock %d failed\n", j, i);
+	    return 1;
+	  }
+      if (pthread_rwlock_unlock (&locks[i]) != 0
+	  || pthread_join (wth, NULL) != 0)
+	{
+	  puts ("unlock or join of the writer failed");
+	  return 1;
+	}
+    }
+
+  /* All the read locks are released again.  */
+  for (i = 0; i < NLOCKS; ++i)
+    {
+      if (pthread_rwlock_wrlock (&locks[i]) != 0
+	  || pthread_rwlock_unlock (&locks[i]) != 0
+	  || pthread_rwlock_destroy (&locks[i]) != 0)
+	{
+	  printf ("wrlock, unlock or destroy of lock %d failed\n", i);
+	  return 1;
+	}
+    }
+
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
@@ -0,0 +1,182 @@
+/* Test for sequence locks: writers update two counters under the lock,
+   and readers, which never lock anything, must only accept snapshots in
+   which the counters are equal.  A writer which sleeps with the lock held
+   must make pthread_seqlock_read_begin_wait_np wait for it.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define NREADERS 4
+#define NWRITERS 2
+#define ROUNDS 100000
+
+static pthread_seqlock_t seqlock = PTHREAD_SEQLOCK_INITIALIZER_NP;
+static volatile long a, b;
+static volatile int done;
+
+static void *
+writer (void *arg)
+{
+  int i;
+
+  for (i = 0; i < ROUNDS; ++i)
+    {
+      if (pthread_seqlock_write_lock_np (&seqlock) != 0)
+	{
+	  puts ("write_lock failed");
+	  exit (1);
+	}
+      ++a;
+      ++b;
+      if (pthread_seqlock_write_unlock_np (&seqlock) != 0)
+	{
+	  puts ("write_unlock failed");
+	  exit (1);
+	}
+    }
+  return NULL;
+}
+
+static void *
+reader (void *arg)
+{
+  unsigned long int seq;
+  long ra, rb;
+  int wait = arg != NULL;
+
+  while (!done)
+    {
+      do
+	{
+	  seq = (wait ? pthread_seqlock_read_begin_wait_np (&seqlock)
+		 : pthread_seqlock_read_begin_np (&seqlock));
+	  ra = a;
+	  rb = b;
+	}
+      while (pthread_seqlock_read_retry_np (&seqlock, seq));
+      if (ra != rb)
+	{
+	  printf ("reader saw %ld and %ld\n", ra, rb);
+	  exit (1);
+	}
+    }
+  return NULL;
+}
+
+static void *
+slow_reader (void *arg)
+{
+  unsigned long int seq = pthread_seqlock_read_begin_wait_np (&seqlock);
+
+  if ((seq & 1) != 0 || a != b)
+    {
+      puts ("read_begin_wait returned with the writer at work");
+      exit (1);
+    }
+  return (void *) a;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  pthread_t rth[NREADERS], wth[NWRITERS], th;
+  unsigned long int seq;
+  void *res;
+  long i;
+
+  for (i = 0; i < NREADERS; ++i)
+    if (pthread_create (&rth[i], NULL, reader, (void *) (i & 1)) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  for (i = 0; i < NWRITERS; ++i)
+    if (pthread_create (&wth[i], NULL, writer, NULL) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  for (i = 0; i < NWRITERS; ++i)
+    if (pthread_join (wth[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+  done = 1;
+  for (i = 0; i < NREADERS; ++i)
+    if (pthread_join (rth[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+  if (a != NWRITERS * ROUNDS || b != a)
+    {
+      printf ("counters %ld and %ld, expected %d\n",
+	      a, b, NWRITERS * ROUNDS);
+      return 1;
+    }
+
+  /* A reader must wait for a writer which holds the lock for long.  */
+  seq = pthread_seqlock_read_begin_np (&seqlock);
+  if (pthread_seqlock_write_lock_np (&seqlock) != 0)
+    {
+      puts ("write_lock failed");
+      return 1;
+    }
+  if (!pthread_seqlock_read_retry_np (&seqlock, seq))
+    {
+      puts ("read_retry did not notice the writer");
+      return 1;
+    }
+  if (pthread_seqlock_destroy_np (&seqlock) != EBUSY)
+    {
+      puts ("destroy did not fail with a writer");
+      return 1;
+    }
+  if (pthread_create (&th, NULL, slow_reader, NULL) != 0)
+    {
+      puts ("create failed");
+      return 1;
+    }
+  usleep (200000);
+  ++a;
+  ++b;
+  if (pthread_seqlock_write_unlock_np (&seqlock) != 0)
+    {
+      puts ("write_unlock failed");
+      return 1;
+    }
+  if (pthread_join (th, &res) != 0)
+    {
+      puts ("join failed");
+      return 1;
+    }
+  if ((long) res != NWRITERS * ROUNDS + 1)
+    {
+      puts ("slow reader did not see the update");
+      return 1;
+    }
+
+  if (pthread_seqlock_write_unlock_np (&seqlock) != EPERM)
+    {
+      puts ("write_unlock without the lock did not fail");
+      return 1;
+    }
+  if (pthread_seqlock_destroy_np (&seqlock) != 0
+      || pthread_seqlock_init_np (&seqlock) != 0
+      || pthread_seqlock_read_begin_np (&seqlock) != 0)
+    {
+      puts ("destroy or init failed");
+      return 1;
+    }
+
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
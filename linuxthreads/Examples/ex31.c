@@ -0,0 +1,313 @@
+/* Test for pthread_rwlock_tryupgrade_np and pthread_rwlock_downgrade_np
+   with rwlocks of each kind: the only reader can upgrade its read lock,
+   unless another reader holds one or, if the rwlock prefers writers, a
+   writer waits.  A downgrade lets in the waiting readers, but no
+   writer.  First, readers upgrade their read lock now and then to update
+   two counters, and check that they are equal.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define NTHREADS 8
+#define ROUNDS 20000
+
+static pthread_rwlock_t rwlock;
+static long a, b;
+
+static void *
+worker (void *arg)
+{
+  long n = (long) arg;
+  int i;
+
+  for (i = 0; i < ROUNDS; ++i)
+    {
+      if (pthread_rwlock_rdlock (&rwlock) != 0)
+	{
+	  puts ("rdlock in worker failed");
+	  exit (1);
+	}
+      if (a != b)
+	{
+	  puts ("reader saw a writer at work");
+	  exit (1);
+	}
+      if (i % 20 == n && pthread_rwlock_tryupgrade_np (&rwlock) == 0)
+	{
+	  ++a;
+	  ++b;
+	  if (pthread_rwlock_downgrade_np (&rwlock) != 0)
+	    {
+	      puts ("downgrade in worker failed");
+	      exit (1);
+	    }
+	  if (a != b)
+	    {
+	      puts ("downgraded reader saw a writer at work");
+	      exit (1);
+	    }
+	}
+      if (pthread_rwlock_unlock (&rwlock) != 0)
+	{
+	  puts ("unlock in worker failed");
+	  exit (1);
+	}
+    }
+  return NULL;
+}
+
+static void *
+tryrd (void *arg)
+{
+  int err = pthread_rwlock_tryrdlock (&rwlock);
+
+  if (err == 0)
+    pthread_rwlock_unlock (&rwlock);
+  return (void *) (long) err;
+}
+
+static void *
+trywr (void *arg)
+{
+  int err = pthread_rwlock_trywrlock (&rwlock);
+
+  if (err == 0)
+    pthread_rwlock_unlock (&rwlock);
+  return (void *) (long) err;
+}
+
+/* Run FN in another thread and return its result.  */
+static int
+in_thread (void *(*fn) (void *))
+{
+  pthread_t th;
+  void *res;
+
+  if (pthread_create (&th, NULL, fn, NULL) != 0
+      || pthread_join (th, &res) != 0)
+    {
+      puts ("create or join failed");
+      exit (1);
+    }
+  return (long) res;
+}
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int state;
+
+static void *
+holder (void *arg)
+{
+  if (pthread_rwlock_rdlock (&rwlock) != 0)
+    {
+      puts ("rdlock in holder failed");
+      exit (1);
+    }
+  pthread_mutex_lock (&lock);
+  state = 1;
+  pthread_cond_signal (&cond);
+  while (state != 2)
+    pthread_cond_wait (&cond, &lock);
+  pthread_mutex_unlock (&lock);
+  pthread_rwlock_unlock (&rwlock);
+  return NULL;
+}
+
+static void *
+writer (void *arg)
+{
+  if (pthread_rwlock_wrlock (&rwlock) != 0)
+    {
+      puts ("wrlock in writer failed");
+      exit (1);
+    }
+  pthread_rwlock_unlock (&rwlock);
+  return NULL;
+}
+
+static void *
+reader (void *arg)
+{
+  if (pthread_rwlock_rdlock (&rwlock) != 0)
+    {
+      puts ("rdlock in reader failed");
+      exit (1);
+    }
+  pthread_rwlock_unlock (&rwlock);
+  return NULL;
+}
+
+static int
+run (int kind)
+{
+  pthread_rwlockattr_t ra;
+  pthread_t th, wth[NTHREADS];
+  long i;
+  int prefer_reader = (kind == PTHREAD_RWLOCK_PREFER_READER_NP
+		       || kind == PTHREAD_RWLOCK_PREFER_READER_SCALABLE_NP);
+  int err;
+
+  if (pthread_rwlockattr_init (&ra) != 0
+      || pthread_rwlockattr_setkind_np (&ra, kind) != 0
+      || pthread_rwlock_init (&rwlock, &ra) != 0)
+    {
+      puts ("cannot set up the rwlock");
+      return 1;
+    }
+
+  a = b = 0;
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_create (&wth[i], NULL, worker, (void *) i) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_join (wth[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+  if (a != b)
+    {
+      printf ("kind %d: counters %ld and %ld\n", kind, a, b);
+      return 1;
+    }
+
+  /* Nothing to upgrade or downgrade.  */
+  if (pthread_rwlock_tryupgrade_np (&rwlock) != EPERM
+      || pthread_rwlock_downgrade_np (&rwlock) != EPERM)
+    {
+      printf ("kind %d: upgrade or downgrade without a lock worked\n", kind);
+      return 1;
+    }
+
+  /* The only reader upgrades, then downgrades again.  */
+  if (pthread_rwlock_rdlock (&rwlock) != 0
+      || pthread_rwlock_tryupgrade_np (&rwlock) != 0)
+    {
+      printf ("kind %d: upgrade of the only read lock failed\n", kind);
+      return 1;
+    }
+  if (in_thread (tryrd) != EBUSY || in_thread (trywr) != EBUSY)
+    {
+      printf ("kind %d: upgraded lock not write locked\n", kind);
+      return 1;
+    }
+  if (pthread_rwlock_downgrade_np (&rwlock) != 0)
+    {
+      printf ("kind %d: downgrade failed\n", kind);
+      return 1;
+    }
+  if (in_thread (tryrd) != 0 || in_thread (trywr) != EBUSY)
+    {
+      printf ("kind %d: downgraded lock not read locked\n", kind);
+      return 1;
+    }
+  if (pthread_rwlock_downgrade_np (&rwlock) != EPERM
+      || pthread_rwlock_unlock (&rwlock) != 0
+      || in_thread (trywr) != 0)
+    {
+      printf ("kind %d: unlock of the downgraded lock failed\n", kind);
+      return 1;
+    }
+
+  /* Another reader prevents the upgrade.  */
+  state = 0;
+  if (pthread_create (&th, NULL, holder, NULL) != 0)
+    {
+      puts ("create failed");
+      return 1;
+    }
+  pthread_mutex_lock (&lock);
+  while (state != 1)
+    pthread_cond_wait (&cond, &lock);
+  pthread_mutex_unlock (&lock);
+  if (pthread_rwlock_rdlock (&rwlock) != 0
+      || pthread_rwlock_tryupgrade_np (&rwlock) != EBUSY)
+    {
+      printf ("kind %d: upgrade with another reader did not fail\n", kind);
+      return 1;
+    }
+  pthread_mutex_lock (&lock);
+  state = 2;
+  pthread_cond_signal (&cond);
+  pthread_mutex_unlock (&lock);
+  if (pthread_join (th, NULL) != 0)
+    {
+      puts ("join failed");
+      return 1;
+    }
+  /* The read lock was kept, and can be upgraded now.  */
+  if (pthread_rwlock_tryupgrade_np (&rwlock) != 0
+      || pthread_rwlock_unlock (&rwlock) != 0)
+    {
+      printf ("kind %d: upgrade of the remaining read lock failed\n", kind);
+      return 1;
+    }
+
+  /* A waiting writer prevents the upgrade if the rwlock prefers
+     writers.  */
+  if (pthread_rwlock_rdlock (&rwlock) != 0
+      || pthread_create (&th, NULL, writer, NULL) != 0)
+    {
+      puts ("rdlock or create failed");
+      return 1;
+    }
+  usleep (100000);
+  err = pthread_rwlock_tryupgrade_np (&rwlock);
+  if (err != (prefer_reader ? 0 : EBUSY))
+    {
+      printf ("kind %d: upgrade with a writer waiting returned %d\n",
+	      kind, err);
+      return 1;
+    }
+  if (pthread_rwlock_unlock (&rwlock) != 0
+      || pthread_join (th, NULL) != 0)
+    {
+      puts ("unlock or join failed");
+      return 1;
+    }
+
+  /* A downgrade lets the waiting readers in.  */
+  if (pthread_rwlock_wrlock (&rwlock) != 0
+      || pthread_create (&th, NULL, reader, NULL) != 0)
+    {
+      puts ("wrlock or create failed");
+      return 1;
+    }
+  usleep (100000);
+  if (pthread_rwlock_downgrade_np (&rwlock) != 0
+      || pthread_join (th, NULL) != 0)
+    {
+      printf ("kind %d: reader did not get in after a downgrade\n", kind);
+      return 1;
+    }
+  if (pthread_rwlock_unlock (&rwlock) != 0
+      || pthread_rwlock_destroy (&rwlock) != 0)
+    {
+      puts ("unlock or destroy failed");
+      return 1;
+    }
+  return 0;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  if (run (PTHREAD_RWLOCK_PREFER_READER_NP)
+      || run (PTHREAD_RWLOCK_PREFER_WRITER_NP)
+      || run (PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP)
+      || run (PTHREAD_RWLOCK_PREFER_READER_SCALABLE_NP))
+    return 1;
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
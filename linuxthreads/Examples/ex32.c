@@ -0,0 +1,177 @@
+/* Test for semaphores: producers post to a semaphore which consumers
+   wait on, and the consumers must get exactly as many as were posted.
+   A sem_post from a signal handler must wake up a thread blocked in
+   sem_wait, sem_timedwait must time out with nothing to take, and a
+   thread blocked in sem_wait must be cancellable.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NPRODUCERS 4
+#define NCONSUMERS 4
+#define ROUNDS 50000
+
+static sem_t sem;
+static long taken;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *
+producer (void *arg)
+{
+  int i;
+
+  for (i = 0; i < ROUNDS; ++i)
+    if (sem_post (&sem) != 0)
+      {
+	puts ("sem_post failed");
+	exit (1);
+      }
+  return NULL;
+}
+
+static void *
+consumer (void *arg)
+{
+  int i;
+
+  for (i = 0; i < ROUNDS; ++i)
+    {
+      if (((i & 1) == 0 || sem_trywait (&sem) != 0) && sem_wait (&sem) != 0)
+	{
+	  puts ("sem_wait failed");
+	  exit (1);
+	}
+      pthread_mutex_lock (&lock);
+      ++taken;
+      pthread_mutex_unlock (&lock);
+    }
+  return NULL;
+}
+
+static void
+handler (int sig)
+{
+  sem_post (&sem);
+}
+
+static void *
+waiter (void *arg)
+{
+  if (sem_wait (&sem) != 0)
+    {
+      puts ("sem_wait in waiter failed");
+      exit (1);
+    }
+  return (void *) 1l;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  pthread_t pth[NPRODUCERS], cth[NCONSUMERS], th;
+  struct timespec ts;
+  void *res;
+  int i, val;
+
+  if (sem_init (&sem, 0, 0) != 0)
+    {
+      puts ("sem_init failed");
+      return 1;
+    }
+  for (i = 0; i < NCONSUMERS; ++i)
+    if (pthread_create (&cth[i], NULL, consumer, NULL) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  for (i = 0; i < NPRODUCERS; ++i)
+    if (pthread_create (&pth[i], NULL, producer, NULL) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  for (i = 0; i < NPRODUCERS; ++i)
+    if (pthread_join (pth[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+  for (i = 0; i < NCONSUMERS; ++i)
+    if (pthread_join (cth[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+  if (taken != NCONSUMERS * ROUNDS
+      || sem_getvalue (&sem, &val) != 0 || val != 0)
+    {
+      printf ("took %ld, %d left\n", taken, val);
+      return 1;
+    }
+
+  /* Nothing to take.  */
+  if (sem_trywait (&sem) != -1 || errno != EAGAIN)
+    {
+      puts ("sem_trywait did not fail with EAGAIN");
+      return 1;
+    }
+  clock_gettime (CLOCK_REALTIME, &ts);
+  ts.tv_nsec += 100000000;
+  if (ts.tv_nsec >= 1000000000)
+    {
+      ts.tv_nsec -= 1000000000;
+      ++ts.tv_sec;
+    }
+  if (sem_timedwait (&sem, &ts) != ETIMEDOUT)
+    {
+      puts ("sem_timedwait did not time out");
+      return 1;
+    }
+
+  /* A post from a signal handler wakes up the waiter.  */
+  if (signal (SIGUSR1, handler) == SIG_ERR
+      || pthread_create (&th, NULL, waiter, NULL) != 0)
+    {
+      puts ("signal or create failed");
+      return 1;
+    }
+  usleep (100000);
+  if (pthread_kill (pthread_self (), SIGUSR1) != 0
+      || pthread_join (th, &res) != 0 || res != (void *) 1l)
+    {
+      puts ("post from a signal handler did not wake up the waiter");
+      return 1;
+    }
+
+  /* A blocked waiter can be cancelled.  */
+  if (pthread_create (&th, NULL, waiter, NULL) != 0)
+    {
+      puts ("create failed");
+      return 1;
+    }
+  usleep (100000);
+  if (pthread_cancel (th) != 0
+      || pthread_join (th, &res) != 0 || res != PTHREAD_CANCELED)
+    {
+      puts ("waiter was not cancelled");
+      return 1;
+    }
+
+  if (sem_getvalue (&sem, &val) != 0 || val != 0 || sem_destroy (&sem) != 0)
+    {
+      puts ("getvalue or destroy failed");
+      return 1;
+    }
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
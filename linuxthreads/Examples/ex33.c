@@ -0,0 +1,117 @@
+/* Test for named semaphores: sem_open on the same name must return the
+   same mapping, O_EXCL must fail on an existing name, and a child
+   process must get every post of its parent through its own sem_open of
+   the name.  After sem_unlink the name must be gone.  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define ROUNDS 100000
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  char name[32];
+  sem_t *s1, *s2, *s3;
+  pid_t pid;
+  int i, status, val;
+
+  snprintf (name, sizeof (name), "/ex33-%d", (int) getpid ());
+  s1 = sem_open (name, O_CREAT | O_EXCL, 0600, 0);
+  if (s1 == SEM_FAILED)
+    {
+      if (errno == ENOSYS)
+	{
+	  puts ("named semaphores not supported");
+	  return 0;
+	}
+      puts ("sem_open failed");
+      return 1;
+    }
+  s2 = sem_open (name, O_CREAT, 0600, 5);
+  if (s2 != s1)
+    {
+      puts ("second sem_open did not share the mapping");
+      return 1;
+    }
+  if (sem_open (name, O_CREAT | O_EXCL, 0600, 0) != SEM_FAILED
+      || errno != EEXIST)
+    {
+      puts ("sem_open with O_EXCL did not fail with EEXIST");
+      return 1;
+    }
+  if (sem_open ("/ex33/bad", 0) != SEM_FAILED || errno != EINVAL)
+    {
+      puts ("sem_open of a bad name did not fail with EINVAL");
+      return 1;
+    }
+
+  pid = fork ();
+  if (pid == -1)
+    {
+      puts ("fork failed");
+      return 1;
+    }
+  if (pid == 0)
+    {
+      s3 = sem_open (name, 0);
+      if (s3 == SEM_FAILED)
+	{
+	  puts ("sem_open in the child failed");
+	  _exit (1);
+	}
+      for (i = 0; i < ROUNDS; ++i)
+	if (sem_wait (s3) != 0)
+	  {
+	    puts ("sem_wait in the child failed");
+	    _exit (1);
+	  }
+      _exit (sem_close (s3) != 0);
+    }
+  for (i = 0; i < ROUNDS; ++i)
+    if (sem_post (s1) != 0)
+      {
+	puts ("sem_post failed");
+	return 1;
+      }
+  if (waitpid (pid, &status, 0) != pid
+      || !WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    {
+      puts ("child failed");
+      return 1;
+    }
+  if (sem_getvalue (s1, &val) != 0 || val != 0)
+    {
+      printf ("%d left after the child\n", val);
+      return 1;
+    }
+
+  if (sem_close (s1) != 0 || sem_close (s2) != 0)
+    {
+      puts ("sem_close failed");
+      return 1;
+    }
+  if (sem_unlink (name) != 0)
+    {
+      puts ("sem_unlink failed");
+      return 1;
+    }
+  if (sem_unlink (name) != -1 || errno != ENOENT
+      || sem_open (name, 0) != SEM_FAILED || errno != ENOENT)
+    {
+      puts ("name still there after sem_unlink");
+      return 1;
+    }
+
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
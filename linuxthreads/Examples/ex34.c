@@ -0,0 +1,120 @@
+/* Test for PTHREAD_BARRIER_TREE_NP barriers: many threads go through the
+   barrier round after round, and none may leave it before all of them
+   arrived.  Exactly one of them must be the serial thread in each round,
+   and the barrier must be destroyable right after the last round.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NTHREADS 70
+#define ROUNDS 500
+
+static pthread_barrier_t barrier;
+static volatile int phase[NTHREADS];
+static int serials;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *
+worker (void *arg)
+{
+  long n = (long) arg;
+  int i, r, err;
+
+  for (r = 1; r <= ROUNDS; ++r)
+    {
+      phase[n] = r;
+      err = pthread_barrier_wait (&barrier);
+      if (err == PTHREAD_BARRIER_SERIAL_THREAD)
+	{
+	  pthread_mutex_lock (&lock);
+	  ++serials;
+	  pthread_mutex_unlock (&lock);
+	}
+      else if (err != 0)
+	{
+	  puts ("pthread_barrier_wait failed");
+	  exit (1);
+	}
+      for (i = 0; i < NTHREADS; ++i)
+	if (phase[i] < r)
+	  {
+	    printf ("thread %d not arrived in round %d\n", i, r);
+	    exit (1);
+	  }
+      /* Keep the threads from getting into the next round before all of
+	 them checked this one.  */
+      err = pthread_barrier_wait (&barrier);
+      if (err != 0 && err != PTHREAD_BARRIER_SERIAL_THREAD)
+	{
+	  puts ("second pthread_barrier_wait failed");
+	  exit (1);
+	}
+    }
+  return NULL;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  pthread_barrierattr_t ba;
+  pthread_t th[NTHREADS];
+  long i;
+  int kind;
+
+  if (pthread_barrierattr_init (&ba) != 0
+      || pthread_barrierattr_getkind_np (&ba, &kind) != 0
+      || kind != PTHREAD_BARRIER_DEFAULT_NP)
+    {
+      puts ("barrier attribute not set up with the default kind");
+      return 1;
+    }
+  if (pthread_barrierattr_setkind_np (&ba, -1) != EINVAL)
+    {
+      puts ("setkind_np with a bad kind did not fail");
+      return 1;
+    }
+  if (pthread_barrierattr_setkind_np (&ba, PTHREAD_BARRIER_TREE_NP) != 0)
+    {
+      puts ("tree barriers not supported");
+      return 0;
+    }
+  if (pthread_barrierattr_getkind_np (&ba, &kind) != 0
+      || kind != PTHREAD_BARRIER_TREE_NP
+      || pthread_barrier_init (&barrier, &ba, NTHREADS) != 0)
+    {
+      puts ("cannot set up the barrier");
+      return 1;
+    }
+
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_create (&th[i], NULL, worker, (void *) i) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_join (th[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+  if (serials != ROUNDS)
+    {
+      printf ("%d serial threads in %d rounds\n", serials, ROUNDS);
+      return 1;
+    }
+  if (pthread_barrier_destroy (&barrier) != 0)
+    {
+      puts ("destroy failed");
+      return 1;
+    }
+
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
@@ -0,0 +1,165 @@
+/* Test for the spinning of barrier and semaphore waiters: threads go
+   through barriers of each kind set up to spin not at all, by default,
+   or for long, and none may leave a barrier before all of them arrived.
+   Then two threads hand a semaphore back and forth, which lets the
+   waiter find the count while it spins.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NTHREADS 8
+#define ROUNDS 2000
+
+static pthread_barrier_t barrier;
+static volatile int phase[NTHREADS];
+
+static void *
+worker (void *arg)
+{
+  long n = (long) arg;
+  int i, r, err;
+
+  for (r = 1; r <= ROUNDS; ++r)
+    {
+      phase[n] = r;
+      err = pthread_barrier_wait (&barrier);
+      if (err != 0 && err != PTHREAD_BARRIER_SERIAL_THREAD)
+	{
+	  puts ("pthread_barrier_wait failed");
+	  exit (1);
+	}
+      for (i = 0; i < NTHREADS; ++i)
+	if (phase[i] < r)
+	  {
+	    printf ("thread %d not arrived in round %d\n", i, r);
+	    exit (1);
+	  }
+      err = pthread_barrier_wait (&barrier);
+      if (err != 0 && err != PTHREAD_BARRIER_SERIAL_THREAD)
+	{
+	  puts ("second pthread_barrier_wait failed");
+	  exit (1);
+	}
+    }
+  return NULL;
+}
+
+static int
+run (int kind, int spin)
+{
+  pthread_barrierattr_t ba;
+  pthread_t th[NTHREADS];
+  long i;
+  int val;
+
+  if (pthread_barrierattr_init (&ba) != 0
+      || pthread_barrierattr_setspin_np (&ba, spin) != 0
+      || pthread_barrierattr_getspin_np (&ba, &val) != 0 || val != spin)
+    {
+      puts ("cannot set up the barrier attribute");
+      return 1;
+    }
+  if (kind != PTHREAD_BARRIER_DEFAULT_NP
+      && pthread_barrierattr_setkind_np (&ba, kind) != 0)
+    /* Not supported here.  */
+    return 0;
+  if (pthread_barrier_init (&barrier, &ba, NTHREADS) != 0)
+    {
+      puts ("pthread_barrier_init failed");
+      return 1;
+    }
+
+  for (i = 0; i < NTHREADS; ++i)
+    phase[i] = 0;
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_create (&th[i], NULL, worker, (void *) i) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_join (th[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+  if (pthread_barrier_destroy (&barrier) != 0)
+    {
+      printf ("kind %d, spin %d: destroy failed\n", kind, spin);
+      return 1;
+    }
+  return 0;
+}
+
+static sem_t ping, pong;
+
+static void *
+ponger (void *arg)
+{
+  int r;
+
+  for (r = 0; r < ROUNDS * 10; ++r)
+    if (sem_wait (&ping) != 0 || sem_post (&pong) != 0)
+      {
+	puts ("sem_wait or sem_post in ponger failed");
+	exit (1);
+      }
+  return NULL;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  pthread_barrierattr_t ba;
+  pthread_t th;
+  int r, val;
+
+  if (pthread_barrierattr_init (&ba) != 0
+      || pthread_barrierattr_getspin_np (&ba, &val) != 0 || val != -1)
+    {
+      puts ("barrier attribute not set up with the default spin");
+      return 1;
+    }
+  if (pthread_barrierattr_setspin_np (&ba, -2) != EINVAL)
+    {
+      puts ("setspin_np with a bad count did not fail");
+      return 1;
+    }
+
+  if (run (PTHREAD_BARRIER_CENTRAL_NP, 0)
+      || run (PTHREAD_BARRIER_CENTRAL_NP, -1)
+      || run (PTHREAD_BARRIER_CENTRAL_NP, 100000)
+      || run (PTHREAD_BARRIER_TREE_NP, 0)
+      || run (PTHREAD_BARRIER_TREE_NP, 100000))
+    return 1;
+
+  if (sem_init (&ping, 0, 0) != 0 || sem_init (&pong, 0, 0) != 0
+      || pthread_create (&th, NULL, ponger, NULL) != 0)
+    {
+      puts ("cannot set up the semaphores");
+      return 1;
+    }
+  for (r = 0; r < ROUNDS * 10; ++r)
+    if (sem_post (&ping) != 0 || sem_wait (&pong) != 0)
+      {
+	puts ("sem_post or sem_wait failed");
+	return 1;
+      }
+  if (pthread_join (th, NULL) != 0
+      || sem_getvalue (&ping, &val) != 0 || val != 0
+      || sem_getvalue (&pong, &val) != 0 || val != 0)
+    {
+      puts ("semaphores not back to zero");
+      return 1;
+    }
+
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
@@ -0,0 +1,192 @@
+/* Test for pthread_once: many threads racing on the same object must run
+   the init routine exactly once and all return after it finished, a slow
+   init routine must not hold up pthread_once on other objects, and an
+   init routine cancelled halfway must be run again by the next caller.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define NTHREADS 20
+#define NONCES 50
+
+static pthread_once_t once[NONCES];
+static volatile int runs[NONCES];
+static volatile int done[NONCES];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int current;
+
+static void
+init (void)
+{
+  int n = current;
+
+  pthread_mutex_lock (&lock);
+  ++runs[n];
+  pthread_mutex_unlock (&lock);
+  usleep (1000);
+  done[n] = 1;
+}
+
+static pthread_barrier_t start;
+
+static void *
+racer (void *arg)
+{
+  int n;
+
+  for (n = 0; n < NONCES; ++n)
+    {
+      pthread_barrier_wait (&start);
+      if (pthread_once (&once[n], init) != 0)
+	{
+	  puts ("pthread_once failed");
+	  exit (1);
+	}
+      if (!done[n])
+	{
+	  printf ("returned before object %d was initialized\n", n);
+	  exit (1);
+	}
+      pthread_barrier_wait (&start);
+      /* Let the main thread set up the next object.  */
+      pthread_barrier_wait (&start);
+    }
+  return NULL;
+}
+
+static pthread_once_t slow_once = PTHREAD_ONCE_INIT;
+static pthread_once_t fast_once = PTHREAD_ONCE_INIT;
+static sem_t slow_go, slow_in;
+static int fast_runs;
+
+static void
+slow_init (void)
+{
+  sem_post (&slow_in);
+  sem_wait (&slow_go);
+}
+
+static void
+fast_init (void)
+{
+  ++fast_runs;
+}
+
+static void *
+slow (void *arg)
+{
+  pthread_once (&slow_once, slow_init);
+  return NULL;
+}
+
+static pthread_once_t cancel_once = PTHREAD_ONCE_INIT;
+static int cancel_runs;
+
+static void
+cancel_init (void)
+{
+  ++cancel_runs;
+  if (cancel_runs == 1)
+    {
+      sem_post (&slow_in);
+      /* Wait to be cancelled.  */
+      while (1)
+	sem_wait (&slow_go);
+    }
+}
+
+static void *
+canceled (void *arg)
+{
+  pthread_once (&cancel_once, cancel_init);
+  return NULL;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  pthread_t th[NTHREADS], sth;
+  void *res;
+  int i, n;
+
+  if (pthread_barrier_init (&start, NULL, NTHREADS + 1) != 0)
+    {
+      puts ("barrier_init failed");
+      return 1;
+    }
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_create (&th[i], NULL, racer, NULL) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  for (n = 0; n < NONCES; ++n)
+    {
+      current = n;
+      pthread_barrier_wait (&start);
+      pthread_barrier_wait (&start);
+      if (runs[n] != 1)
+	{
+	  printf ("init routine of object %d ran %d times\n", n, runs[n]);
+	  return 1;
+	}
+      pthread_barrier_wait (&start);
+    }
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_join (th[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+
+  /* A slow init routine does not hold up another object.  */
+  if (sem_init (&slow_go, 0, 0) != 0 || sem_init (&slow_in, 0, 0) != 0
+      || pthread_create (&sth, NULL, slow, NULL) != 0)
+    {
+      puts ("cannot start the slow initializer");
+      return 1;
+    }
+  sem_wait (&slow_in);
+  if (pthread_once (&fast_once, fast_init) != 0 || fast_runs != 1)
+    {
+      puts ("pthread_once on another object failed");
+      return 1;
+    }
+  sem_post (&slow_go);
+  if (pthread_join (sth, NULL) != 0)
+    {
+      puts ("join of the slow initializer failed");
+      return 1;
+    }
+
+  /* A cancelled init routine is run again.  */
+  if (pthread_create (&sth, NULL, canceled, NULL) != 0)
+    {
+      puts ("create failed");
+      return 1;
+    }
+  sem_wait (&slow_in);
+  if (pthread_cancel (sth) != 0
+      || pthread_join (sth, &res) != 0 || res != PTHREAD_CANCELED)
+    {
+      puts ("initializer was not cancelled");
+      return 1;
+    }
+  if (pthread_once (&cancel_once, cancel_init) != 0 || cancel_runs != 2)
+    {
+      puts ("init routine not run again after cancellation");
+      return 1;
+    }
+
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
@@ -0,0 +1,130 @@
+/* Test for pthread_key_delete: threads set a value for a key, which is
+   then deleted and created again while they still run.  The old values
+   must read as NULL in every thread, the destructor of the old key must
+   not be called for them, and the new key must work as usual.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NTHREADS 10
+#define ROUNDS 1000
+
+static pthread_key_t key;
+static pthread_barrier_t b;
+static int old_destr, new_destr;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+destr_old (void *p)
+{
+  pthread_mutex_lock (&lock);
+  ++old_destr;
+  pthread_mutex_unlock (&lock);
+}
+
+static void
+destr_new (void *p)
+{
+  pthread_mutex_lock (&lock);
+  ++new_destr;
+  pthread_mutex_unlock (&lock);
+}
+
+static void *
+tf (void *arg)
+{
+  if (pthread_setspecific (key, arg) != 0
+      || pthread_getspecific (key) != arg)
+    {
+      puts ("setspecific failed");
+      exit (1);
+    }
+  /* Main thread deletes and creates the key again.  */
+  pthread_barrier_wait (&b);
+  pthread_barrier_wait (&b);
+  if (pthread_getspecific (key) != NULL)
+    {
+      puts ("value of the deleted key still there");
+      exit (1);
+    }
+  if (pthread_setspecific (key, arg) != 0
+      || pthread_getspecific (key) != arg)
+    {
+      puts ("setspecific of the new key failed");
+      exit (1);
+    }
+  return NULL;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  pthread_t th[NTHREADS];
+  pthread_key_t k2;
+  long i;
+  int r;
+
+  if (pthread_key_create (&key, destr_old) != 0
+      || pthread_barrier_init (&b, NULL, NTHREADS + 1) != 0)
+    {
+      puts ("setup failed");
+      return 1;
+    }
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_create (&th[i], NULL, tf, (void *) (i + 1)) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  pthread_barrier_wait (&b);
+  if (pthread_key_delete (key) != 0)
+    {
+      puts ("key_delete failed");
+      return 1;
+    }
+  if (pthread_key_delete (key) != EINVAL)
+    {
+      puts ("second key_delete did not fail");
+      return 1;
+    }
+  if (pthread_key_create (&k2, destr_new) != 0 || k2 != key)
+    {
+      puts ("key not reused");
+      return 1;
+    }
+  pthread_barrier_wait (&b);
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_join (th[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+  if (old_destr != 0 || new_destr != NTHREADS)
+    {
+      printf ("%d old and %d new destructor calls\n", old_destr, new_destr);
+      return 1;
+    }
+
+  /* A value set in this thread does not survive a delete and create
+     either, however often the key is reused.  */
+  for (r = 0; r < ROUNDS; ++r)
+    {
+      if (pthread_setspecific (key, &r) != 0
+	  || pthread_key_delete (key) != 0
+	  || pthread_key_create (&key, NULL) != 0
+	  || pthread_getspecific (key) != NULL)
+	{
+	  printf ("delete and create failed in round %d\n", r);
+	  return 1;
+	}
+    }
+
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
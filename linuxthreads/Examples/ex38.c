@@ -0,0 +1,110 @@
+/* Test for the destruction of thread-specific data at thread exit: of
+   many keys, threads set only a few spread over the key table.  Exactly
+   the keys set to non-NULL values with a destructor must have it called,
+   and a destructor setting a value again must be called in the next
+   round.  */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NKEYS 200
+#define NTHREADS 10
+
+static pthread_key_t keys[NKEYS];
+static int calls[NKEYS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+destr (void *arg)
+{
+  long n = (long) arg;
+
+  pthread_mutex_lock (&lock);
+  ++calls[n];
+  pthread_mutex_unlock (&lock);
+}
+
+/* Destructor of key 3, which sets the key once more.  */
+static void
+destr_again (void *arg)
+{
+  destr ((void *) 3l);
+  if (arg == (void *) 3l)
+    pthread_setspecific (keys[3], (void *) -3l);
+}
+
+static void *
+tf (void *arg)
+{
+  long n;
+
+  for (n = 0; n < NKEYS; n += 7)
+    /* Key 0 has no value.  */
+    if (n != 0 && pthread_setspecific (keys[n], (void *) n) != 0)
+      {
+	puts ("setspecific failed");
+	exit (1);
+      }
+  if (pthread_setspecific (keys[3], (void *) 3l) != 0)
+    {
+      puts ("setspecific failed");
+      exit (1);
+    }
+  /* An explicit NULL does not get its destructor called.  */
+  pthread_setspecific (keys[1], (void *) 1l);
+  pthread_setspecific (keys[1], NULL);
+  return NULL;
+}
+
+#define TEST_FUNCTION do_test ()
+#define TIMEOUT 60
+static int
+do_test (void)
+{
+  pthread_t th[NTHREADS];
+  int i, expected;
+
+  for (i = 0; i < NKEYS; ++i)
+    if (pthread_key_create (&keys[i], i == 3 ? destr_again
+			    : i == 14 ? NULL : destr) != 0)
+      {
+	puts ("key_create failed");
+	return 1;
+      }
+
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_create (&th[i], NULL, tf, NULL) != 0)
+      {
+	puts ("create failed");
+	return 1;
+      }
+  for (i = 0; i < NTHREADS; ++i)
+    if (pthread_join (th[i], NULL) != 0)
+      {
+	puts ("join failed");
+	return 1;
+      }
+
+  for (i = 0; i < NKEYS; ++i)
+    {
+      if (i == 3)
+	/* Once for the value set in tf, once for the value set back.  */
+	expected = 2 * NTHREADS;
+      else if (i != 0 && i % 7 == 0 && i != 14)
+	expected = NTHREADS;
+      else
+	expected = 0;
+      if (calls[i] != expected)
+	{
+	  printf ("key %d: %d destructor calls, expected %d\n",
+		  i, calls[i], expected);
+	  return 1;
+	}
+    }
+
+  puts ("All OK");
+  return 0;
+}
+
+#include "../../test-skeleton.c"
@@ -19,20 +19,318 @@
    Boston, MA 02111-1307, USA.  */
 
 #include <errno.h>
+#include <limits.h>
+#include <malloc.h>
+#include <sched.h>
+#include <stdlib.h>
 #include "pthread.h"
 #include "internals.h"
 #include "spinlock.h"
 #include "queue.h"
 #include "restart.h"
 
+/* Waiters spin for a while on SMP before they go to sleep, in case the
+   last thread is about to arrive, and keep a moving average of the spins
+   they needed (see __pthread_wait_spin_count).  Where compare-and-swap
+   is available, the internal lock does not need the __spinlock of
+   __ba_lock, which then holds that average in its low BARRIER_SPIN_BITS
+   bits, and the most the waiters may spin, plus one, above them.  The
+   lock is then taken without spinning, which would keep its own average
+   there.  Elsewhere the waiters do not spin.  Tree barriers keep their
+   averages at their leaves instead (see below).  */
+
+#define BARRIER_SPIN_BITS	16
+#define BARRIER_SPIN_AVG	((1 << BARRIER_SPIN_BITS) - 1)
+#define BARRIER_SPIN_MAX	0x7ffe
+
+#define barrier_spin_word(barrier) ((barrier)->__ba_lock.__spinlock)
+#define barrier_spin_avg(barrier) \
+  (barrier_spin_word(barrier) & BARRIER_SPIN_AVG)
+
+static inline int
+barrier_can_spin(void)
+{
+#if defined TEST_FOR_COMPARE_AND_SWAP
+  return __pthread_has_cas;
+#elif defined HAS_COMPARE_AND_SWAP
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+static inline int
+barrier_spin_count(pthread_barrier_t *barrier, int avg)
+{
+  if (!barrier_can_spin())
+    return 0;
+  return __pthread_wait_spin_count(avg, (barrier_spin_word(barrier)
+					 >> BARRIER_SPIN_BITS) - 1);
+}
+
+static inline void
+barrier_spin_update(pthread_barrier_t *barrier, int spin_count)
+{
+  int word = barrier_spin_word(barrier);
+  int avg = word & BARRIER_SPIN_AVG;
+
+  __pthread_wait_spin_update(&avg, spin_count);
+  if (avg > BARRIER_SPIN_AVG)
+    avg = BARRIER_SPIN_AVG;
+  barrier_spin_word(barrier) = (word & ~BARRIER_SPIN_AVG) | avg;
+}
+
+/* A process-shared barrier cannot queue thread descriptors.  Its
+   __ba_lock is a futex lock, and its __ba_waiting holds a generation
+   number above the BARRIER_PSHARED bit, which is never set in a
+   descriptor address.  The serial thread bumps the generation number,
+   then wakes up the threads sleeping on it with the futex system call. */
+
+#define BARRIER_PSHARED		1
+#define BARRIER_GEN_INC		2
+#define BARRIER_GEN_MASK	0x3fffffffL
+
+#define barrier_pshared(barrier) \
+  (((long) (barrier)->__ba_waiting & BARRIER_PSHARED) != 0)
+#define barrier_gen(barrier) \
+  ((long) *(pthread_descr volatile *) &(barrier)->__ba_waiting)
+#define barrier_futex(barrier) ((long *) &(barrier)->__ba_waiting)
+
+static int
+barrier_pshared_wait(pthread_barrier_t *barrier)
+{
+  long val;
+  int spin_count, max_count;
+
+  __pthread_futex_lock(&barrier->__ba_lock, NULL);
+
+  if (barrier->__ba_present >= barrier->__ba_required - 1)
+    {
+      barrier->__ba_present = 0;
+      val = (barrier_gen(barrier) + BARRIER_GEN_INC) & BARRIER_GEN_MASK;
+      barrier->__ba_waiting = (pthread_descr) val;
+      __pthread_futex_unlock(&barrier->__ba_lock);
+      __pthread_futex_wakeup(barrier_futex(barrier), INT_MAX);
+      return PTHREAD_BARRIER_SERIAL_THREAD;
+    }
+
+  barrier->__ba_present++;
+  val = barrier_gen(barrier);
+  __pthread_futex_unlock(&barrier->__ba_lock);
+
+  max_count = barrier_spin_count(barrier, barrier_spin_avg(barrier));
+  for (spin_count = 0; spin_count < max_count; spin_count++) {
+    if (barrier_gen(barrier) != val)
+      break;
+#ifdef BUSY_WAIT_NOP
+    BUSY_WAIT_NOP;
+#endif
+  }
+  if (max_count > 0)
+    barrier_spin_update(barrier, spin_count);
+
+  while (barrier_gen(barrier) == val)
+    __pthread_futex_sleep(barrier_futex(barrier), val, CLOCK_REALTIME, NULL);
+  return 0;
+}
+
+/* A PTHREAD_BARRIER_TREE_NP barrier has its __ba_waiting point to a
+   combining tree, tagged with BARRIER_TREE.  Arriving threads spread over
+   the leaves, each of which takes up to BARRIER_TREE_FANIN of them, and
+   the last one to arrive at a node goes on to its parent.  The one which
+   completes the root is the serial thread: it bumps the generation
+   number, which the others watch for a while on SMP, then sleep on with
+   the futex system call.  They keep their average spins at their leaf.
+   Nothing is reset between rounds: the arrivals at a node only ever
+   grow, and a node is complete in round GEN once it counted
+   (GEN + 1) * bn_count of them.  bn_left counts the threads which left
+   a leaf, so that pthread_barrier_destroy can wait for them before it
+   frees the tree.  */
+
+#define BARRIER_TREE		2
+#define BARRIER_KIND_MASK	3
+#ifndef BARRIER_TREE_FANIN
+#define BARRIER_TREE_FANIN	4
+#endif
+#define BARRIER_TREE_LINE	64
+
+#define barrier_is_tree(barrier) \
+  (((long) (barrier)->__ba_waiting & BARRIER_KIND_MASK) == BARRIER_TREE)
+#define barrier_tree(barrier) \
+  ((struct barrier_tree *) \
+   ((long) (barrier)->__ba_waiting & ~BARRIER_KIND_MASK))
+
+struct barrier_node
+{
+  unsigned long int bn_arrived;	/* Arrivals since the barrier was set up */
+  unsigned long int bn_left;	/* Threads which left, at a leaf */
+  unsigned int bn_count;	/* Arrivals in each round */
+  int bn_parent;		/* Index of the parent, -1 at the root */
+  int bn_spin;			/* Average spins of the waiters, at a leaf */
+} __attribute__ ((aligned (BARRIER_TREE_LINE)));
+
+struct barrier_tree
+{
+  long bt_gen;			/* Round number, a futex word */
+  long bt_sleepers;		/* Threads sleeping on bt_gen */
+  int bt_nleaves;		/* Leaves come first in bt_nodes */
+  int bt_spinlock;		/* For compare_and_swap emulation */
+  struct barrier_node bt_nodes[1];
+};
+
+static inline void
+barrier_tree_add(unsigned long int *word, long delta,
+		 struct barrier_tree *tree)
+{
+  long oldval;
+
+  do
+    oldval = *(volatile long *) word;
+  while (!compare_and_swap((long *) word, oldval, oldval + delta,
+			   &tree->bt_spinlock));
+}
+
+/* Arrive at NODE in round GEN.  Return 1 if the node is complete then,
+   0 if not, or -1 if it was complete already.  */
+
+static inline int
+barrier_node_arrive(struct barrier_node *node, unsigned long int gen,
+		    struct barrier_tree *tree)
+{
+  unsigned long int base = gen * node->bn_count;
+  unsigned long int arrived;
+
+  do {
+    arrived = *(volatile unsigned long int *) &node->bn_arrived;
+    if (arrived - base >= node->bn_count)
+      return -1;
+  } while (!compare_and_swap((long *) &node->bn_arrived, arrived, arrived + 1,
+			     &tree->bt_spinlock));
+  return arrived + 1 - base == node->bn_count;
+}
+
+static int
+barrier_tree_wait(pthread_barrier_t *barrier)
+{
+  struct barrier_tree *tree = barrier_tree(barrier);
+  struct barrier_node *leaf, *node;
+  unsigned long int gen = *(volatile long *) &tree->bt_gen;
+  int i, done, spin_count, max_count, result = 0;
+
+  /* Start from a leaf picked by the handle number of the thread, so that
+     the threads spread over the leaves.  */
+  i = THREAD_GETMEM(thread_self(), p_nr) % tree->bt_nleaves;
+  while ((done = barrier_node_arrive(&tree->bt_nodes[i], gen, tree)) < 0)
+    if (++i == tree->bt_nleaves)
+      i = 0;
+  leaf = node = &tree->bt_nodes[i];
+  while (done && node->bn_parent >= 0) {
+    node = &tree->bt_nodes[node->bn_parent];
+    done = barrier_node_arrive(node, gen, tree);
+  }
+
+  if (done) {
+    /* Completed the root: release the others.  */
+    result = PTHREAD_BARRIER_SERIAL_THREAD;
+    /* Only this thread changes bt_gen now, so the compare-and-swap
+       succeeds.  It orders the change before the load of bt_sleepers,
+       which a plain store would not.  */
+    compare_and_swap(&tree->bt_gen, gen, gen + 1, &tree->bt_spinlock);
+    if (tree->bt_sleepers != 0)
+      __pthread_futex_wakeup(&tree->bt_gen, INT_MAX);
+  } else {
+    max_count = barrier_spin_count(barrier, leaf->bn_spin);
+    for (spin_count = 0; spin_count < max_count; spin_count++) {
+      if (*(volatile long *) &tree->bt_gen != gen)
+	break;
+#ifdef BUSY_WAIT_NOP
+      BUSY_WAIT_NOP;
+#endif
+    }
+    if (max_count > 0)
+      __pthread_wait_spin_update(&leaf->bn_spin, spin_count);
+    if (*(volatile long *) &tree->bt_gen == gen) {
+      /* The serial thread checks bt_sleepers after it bumps bt_gen,
+	 and the compare-and-swap of each orders it before the load of
+	 the other.  */
+      barrier_tree_add((unsigned long int *) &tree->bt_sleepers, 1, tree);
+      while (*(volatile long *) &tree->bt_gen == gen)
+	__pthread_futex_sleep(&tree->bt_gen, gen, CLOCK_REALTIME, NULL);
+      barrier_tree_add((unsigned long int *) &tree->bt_sleepers, -1, tree);
+    }
+    READ_MEMORY_BARRIER();
+  }
+  barrier_tree_add(&leaf->bn_left, 1, tree);
+  return result;
+}
+
+/* Set up a combining tree for COUNT threads.  */
+
+static struct barrier_tree *
+barrier_tree_alloc(unsigned int count)
+{
+  struct barrier_tree *tree;
+  unsigned int nnodes, width, start, next, j;
+
+  nnodes = 0;
+  width = count;
+  do {
+    width = (width + BARRIER_TREE_FANIN - 1) / BARRIER_TREE_FANIN;
+    nnodes += width;
+  } while (width > 1);
+
+  tree = memalign(BARRIER_TREE_LINE, sizeof(struct barrier_tree)
+		  + (nnodes - 1) * sizeof(struct barrier_node));
+  if (tree == NULL)
+    return NULL;
+  tree->bt_gen = 0;
+  tree->bt_sleepers = 0;
+  tree->bt_nleaves = (count + BARRIER_TREE_FANIN - 1) / BARRIER_TREE_FANIN;
+  tree->bt_spinlock = __LT_SPINLOCK_INIT;
+
+  /* Lay the tree out level by level, from the leaves up to the root;
+     WIDTH is the number of arrivals at the level being laid out.  */
+  start = 0;
+  width = count;
+  do {
+    next = start + (width + BARRIER_TREE_FANIN - 1) / BARRIER_TREE_FANIN;
+    for (j = start; j < next; j++) {
+      struct barrier_node *node = &tree->bt_nodes[j];
+
+      node->bn_arrived = 0;
+      node->bn_left = 0;
+      node->bn_spin = 0;
+      node->bn_count = BARRIER_TREE_FANIN;
+      if (j == next - 1 && width % BARRIER_TREE_FANIN != 0)
+	node->bn_count = width % BARRIER_TREE_FANIN;
+      node->bn_parent = -1;
+      if (next < nnodes)
+	node->bn_parent = next + (j - start) / BARRIER_TREE_FANIN;
+    }
+    width = next - start;
+    start = next;
+  } while (width > 1);
+  return tree;
+}
+
 int
 pthread_barrier_wait(pthread_barrier_t *barrier)
 {
-  pthread_descr self = thread_self();
+  pthread_descr self;
   pthread_descr temp_wake_queue, th;
   int result = 0;
+  int spin_count, max_count;
 
-  __pthread_lock(&barrier->__ba_lock, self);
+  if (barrier_pshared(barrier))
+    return barrier_pshared_wait(barrier);
+  if (barrier_is_tree(barrier))
+    return barrier_tree_wait(barrier);
+
+  self = thread_self();
+  if (barrier_can_spin())
+    __pthread_adaptive_lock(&barrier->__ba_lock, self, 0, NULL);
+  else
+    __pthread_lock(&barrier->__ba_lock, self);
 
   /* If the required number of threads have achieved rendezvous... */
   // pthread_barrier_wait被调用的次数达到阈值，__ba_present + 1 == __ba_required 
@@ -42,9 +340,9 @@ pthread_barrier_wait(pthread_barrier_t *barrier)
       result = PTHREAD_BARRIER_SERIAL_THREAD;
       /* Copy and clear wait queue and reset barrier. */
       // 被阻塞的线程队列
-      temp_wake_queue = barrier->__ba_waiting;
+      temp_wake_queue = NULL;
       // 重置字段
-      barrier->__ba_waiting = NULL;
+      queue_move(&temp_wake_queue, &barrier->__ba_waiting);
       barrier->__ba_present = 0;
     }
   else
@@ -60,7 +358,11 @@ pthread_barrier_wait(pthread_barrier_t *barrier)
   // 调用pthread_barrier_wait的次数还不够
   if (result == 0)
     {
-      /* Non-serial threads have to suspend */
+      /* Non-serial threads have to suspend, after watching for the
+	 restart for a while */
+      max_count = barrier_spin_count(barrier, barrier_spin_avg(barrier));
+      if (max_count > 0 && (spin_count = restart_spin(self, max_count)) >= 0)
+	barrier_spin_update(barrier, spin_count);
       // 挂起当前线程
       suspend(self);
       /* We don't bother dealing with cancellation because the POSIX
@@ -78,6 +380,17 @@ pthread_barrier_wait(pthread_barrier_t *barrier)
   return result;
 }
 
+/* pthread_barrierattr_t keeps the process-shared flag in __pshared, the
+   kind of barrier next to it, and the most the waiters may spin, plus
+   one, above them.  */
+
+#define BARRIERATTR_PSHARED	1
+#define BARRIERATTR_TREE	2
+#define BARRIERATTR_SPIN_SHIFT	2
+
+#define barrierattr_spin(attr) \
+  (((attr)->__pshared >> BARRIERATTR_SPIN_SHIFT) - 1)
+
 int
 pthread_barrier_init(pthread_barrier_t *barrier,
 				const pthread_barrierattr_t *attr,
@@ -93,12 +406,55 @@ pthread_barrier_init(pthread_barrier_t *barrier,
   barrier->__ba_present = 0;
   // 调用pthread_barrier_wait被阻塞的线程队列
   barrier->__ba_waiting = NULL;
+  if (barrier_can_spin())
+    barrier_spin_word(barrier) =
+      (attr != NULL ? barrierattr_spin(attr) + 1 : 0) << BARRIER_SPIN_BITS;
+  if (attr != NULL && (attr->__pshared & BARRIERATTR_PSHARED))
+    barrier->__ba_waiting = (pthread_descr) BARRIER_PSHARED;
+  else if (attr != NULL && (attr->__pshared & BARRIERATTR_TREE))
+    {
+      struct barrier_tree *tree = barrier_tree_alloc(count);
+
+      if (tree == NULL)
+	return ENOMEM;
+      barrier->__ba_waiting = (pthread_descr) ((long) tree | BARRIER_TREE);
+    }
+  return 0;
+}
+
+/* Check that no thread waits on the tree of BARRIER, and wait for the
+   threads released last to leave it.  */
+
+static int
+barrier_tree_destroy(pthread_barrier_t *barrier)
+{
+  struct barrier_tree *tree = barrier_tree(barrier);
+  unsigned long int gen = tree->bt_gen;
+  struct barrier_node *leaf;
+  int i;
+
+  for (i = 0; i < tree->bt_nleaves; i++) {
+    leaf = &tree->bt_nodes[i];
+    if (leaf->bn_arrived != gen * leaf->bn_count)
+      return EBUSY;
+  }
+  for (i = 0; i < tree->bt_nleaves; i++) {
+    leaf = &tree->bt_nodes[i];
+    while (*(volatile unsigned long int *) &leaf->bn_left != leaf->bn_arrived)
+      sched_yield();
+  }
+  free(tree);
+  barrier->__ba_waiting = NULL;
   return 0;
 }
 
 int
 pthread_barrier_destroy(pthread_barrier_t *barrier)
 {
+  if (barrier_pshared(barrier))
+    return barrier->__ba_present != 0 ? EBUSY : 0;
+  if (barrier_is_tree(barrier))
+    return barrier_tree_destroy(barrier);
   if (barrier->__ba_waiting != NULL) return EBUSY;
   return 0;
 }
@@ -106,7 +462,7 @@ pthread_barrier_destroy(pthread_barrier_t *barrier)
 int
 pthread_barrierattr_init(pthread_barrierattr_t *attr)
 {
-  attr->__pshared = PTHREAD_PROCESS_PRIVATE;
+  attr->__pshared = 0;
   return 0;
 }
 
@@ -120,7 +476,8 @@ int
 __pthread_barrierattr_getpshared(const pthread_barrierattr_t *attr,
 				 int *pshared)
 {
-  *pshared = attr->__pshared;
+  *pshared = ((attr->__pshared & BARRIERATTR_PSHARED)
+	      ? PTHREAD_PROCESS_SHARED : PTHREAD_PROCESS_PRIVATE);
   return 0;
 }
 
@@ -130,6 +487,55 @@ pthread_barrierattr_setpshared(pthread_barrierattr_t *attr, int pshared)
   if (pshared != PTHREAD_PROCESS_PRIVATE && pshared != PTHREAD_PROCESS_SHARED)
     return EINVAL;
 
-  attr->__pshared = pshared;
+  /* Process-shared barriers sleep on futexes.  */
+  if (pshared != PTHREAD_PROCESS_PRIVATE && !__pthread_futex_mutexes)
+    return ENOSYS;
+
+  if (pshared == PTHREAD_PROCESS_SHARED)
+    attr->__pshared |= BARRIERATTR_PSHARED;
+  else
+    attr->__pshared &= ~BARRIERATTR_PSHARED;
+  return 0;
+}
+
+int
+pthread_barrierattr_getkind_np(const pthread_barrierattr_t *attr, int *kind)
+{
+  *kind = ((attr->__pshared & BARRIERATTR_TREE)
+	   ? PTHREAD_BARRIER_TREE_NP : PTHREAD_BARRIER_CENTRAL_NP);
+  return 0;
+}
+
+int
+pthread_barrierattr_setkind_np(pthread_barrierattr_t *attr, int kind)
+{
+  if (kind != PTHREAD_BARRIER_CENTRAL_NP && kind != PTHREAD_BARRIER_TREE_NP)
+    return EINVAL;
+
+  /* The waiters of a tree barrier sleep on futexes.  */
+  if (kind == PTHREAD_BARRIER_TREE_NP && !__pthread_futex_mutexes)
+    return ENOSYS;
+
+  if (kind == PTHREAD_BARRIER_TREE_NP)
+    attr->__pshared |= BARRIERATTR_TREE;
+  else
+    attr->__pshared &= ~BARRIERATTR_TREE;
+  return 0;
+}
+
+int
+pthread_barrierattr_getspin_np(const pthread_barrierattr_t *attr, int *spin)
+{
+  *spin = barrierattr_spin(attr);
+  return 0;
+}
+
+int
+pthread_barrierattr_setspin_np(pthread_barrierattr_t *attr, int spin)
+{
+  if (spin < -1 || spin > BARRIER_SPIN_MAX)
+    return EINVAL;
+  attr->__pshared = ((attr->__pshared & ((1 << BARRIERATTR_SPIN_SHIFT) - 1))
+		     | ((spin + 1) << BARRIERATTR_SPIN_SHIFT));
   return 0;
 }
@@ -16,6 +16,7 @@
 /* Condition variables */
 
 #include <errno.h>
+#include <limits.h>
 #include <sched.h>
 #include <stddef.h>
 #include <sys/time.h>
@@ -25,20 +26,227 @@
 #include "queue.h"
 #include "restart.h"
 
+/* __c_waiting also tells which clock the timed waits use: the
+   COND_MONOTONIC bit, never set in a descriptor address, is set for
+   CLOCK_MONOTONIC.  The queue functions of a private condition variable
+   see the queue head without it (see cond_queue_open), so that
+   pthread_cond_t does not have to grow.
+
+   A process-shared condition variable cannot queue thread descriptors.
+   Its __c_waiting holds a sequence number instead, above the
+   COND_PSHARED bit, which is never set in a descriptor address either,
+   the COND_MONOTONIC bit and the COND_WAITERS bit, which waiters set.
+   Signal and broadcast bump the sequence number, then wake up threads
+   sleeping on it with the futex system call.  A waiter sleeps only as
+   long as the sequence number is the one it read while holding the
+   mutex, so it cannot miss a wakeup.  The sequence number wraps around
+   so that it fits in the futex word. */
+
+#define COND_PSHARED	1
+#define COND_MONOTONIC	2
+#define COND_WAITERS	4
+#define COND_SEQ_INC	8
+#define COND_SEQ_MASK	0x3fffffffL
+
+#define cond_pshared(cond) (((long) (cond)->__c_waiting & COND_PSHARED) != 0)
+#define cond_clock(cond) \
+  (((long) (cond)->__c_waiting & COND_MONOTONIC) \
+   ? CLOCK_MONOTONIC : CLOCK_REALTIME)
+#define cond_seq(cond) ((long) *(pthread_descr volatile *) &(cond)->__c_waiting)
+#define cond_futex(cond) ((long *) &(cond)->__c_waiting)
+
+/* Take the COND_MONOTONIC bit out of the queue head of a private
+   condition variable before working on the queue, and put it back
+   after.  Both are called with __c_lock held.  */
+
+static inline long cond_queue_open(pthread_cond_t *cond)
+{
+  long tag = (long) cond->__c_waiting & COND_MONOTONIC;
+
+  cond->__c_waiting = (pthread_descr) ((long) cond->__c_waiting & ~tag);
+  return tag;
+}
+
+static inline void cond_queue_close(pthread_cond_t *cond, long tag)
+{
+  cond->__c_waiting = (pthread_descr) ((long) cond->__c_waiting | tag);
+}
+
+/* pthread_condattr_t keeps the process-shared flag in __dummy, and the
+   clock of the timed waits above it.  */
+
+#define CONDATTR_PSHARED	1
+#define CONDATTR_CLOCK_SHIFT	1
+
+/* Wait morphing.  When several threads wait with the same mutex, and
+   that mutex is held, pthread_cond_broadcast wakes up only the first one
+   and moves the others over to the futex of the mutex (see
+   __pthread_restart_requeue_futex): they come back one at a time, as the
+   mutex is released, instead of all rushing for it and going back to
+   sleep.  For the handover to go on, each of these threads, including the
+   first one, relocks the mutex with __pthread_mutex_cond_lock, which
+   marks it contended.  Their p_condvar_avail is COND_AVAIL_REQUEUE for
+   this.  */
+
+#define COND_AVAIL		1
+#define COND_AVAIL_REQUEUE	2
+
+#ifdef __NR_futex
+#define cond_can_requeue(mutex) \
+  (__pthread_futex_mutexes \
+   && (mutex)->__m_kind != PTHREAD_MUTEX_QUEUED_NP \
+   && (mutex)->__m_lock.__status != FUTEX_LOCK_FREE)
+#define cond_requeue(th, mutex) \
+  __pthread_restart_requeue_futex(th, \
+				  __futex_word(&(mutex)->__m_lock.__status))
+#else
+#define cond_can_requeue(mutex) 0
+#define cond_requeue(th, mutex) restart(th)
+#endif
+
+static inline void cond_relock(pthread_mutex_t *mutex, pthread_descr self)
+{
+  if (THREAD_GETMEM(self, p_condvar_avail) == COND_AVAIL_REQUEUE)
+    __pthread_mutex_cond_lock(mutex);
+  else
+    pthread_mutex_lock(mutex);
+}
+
+/* Deferred wakeups.  When __pthread_cond_defer is set (see pthread.c),
+   pthread_cond_signal called by the owner of the mutex of the thread it
+   wakes up does not restart that thread, which would only run to block
+   on the mutex.  The thread goes on the p_condvar_deferred list of the
+   caller instead, and __pthread_cond_flush restarts it once the mutex is
+   released.  Its p_condvar_avail is set only then, so that it takes any
+   restart coming in meanwhile for a spurious one.  Mutexes of all kinds
+   but PTHREAD_MUTEX_QUEUED_NP record their owner in this mode (see
+   mutex.c).  */
+
+static int cond_defer(pthread_descr self, pthread_descr th)
+{
+  pthread_mutex_t *mutex = th->p_condvar_mutex;
+
+  if (mutex->__m_kind == PTHREAD_MUTEX_QUEUED_NP
+      || mutex->__m_owner != mutex_owner_id(mutex, self))
+    return 0;
+  th->p_condvar_nextdeferred = THREAD_GETMEM(self, p_condvar_deferred);
+  THREAD_SETMEM(self, p_condvar_deferred, th);
+  return 1;
+}
+
+/* Restart the threads whose wakeup SELF deferred, those waiting with
+   MUTEX or all of them if MUTEX is NULL.  */
+
+void __pthread_cond_flush(pthread_descr self, pthread_mutex_t *mutex)
+{
+  pthread_descr *prev = &self->p_condvar_deferred;
+  pthread_descr th;
+
+  while ((th = *prev) != NULL) {
+    if (mutex != NULL && th->p_condvar_mutex != mutex) {
+      prev = &th->p_condvar_nextdeferred;
+      continue;
+    }
+    *prev = th->p_condvar_nextdeferred;
+    th->p_condvar_avail = COND_AVAIL;
+    WRITE_MEMORY_BARRIER();
+    restart(th);
+  }
+}
+
 int pthread_cond_init(pthread_cond_t *cond,
                       const pthread_condattr_t *cond_attr)
 {
+  long tag = 0;
+
   __pthread_init_lock(&cond->__c_lock);
-  cond->__c_waiting = NULL;
+  if (cond_attr != NULL) {
+    if (cond_attr->__dummy & CONDATTR_PSHARED)
+      tag |= COND_PSHARED;
+    if ((cond_attr->__dummy >> CONDATTR_CLOCK_SHIFT) == CLOCK_MONOTONIC)
+      tag |= COND_MONOTONIC;
+  }
+  cond->__c_waiting = (pthread_descr) tag;
   return 0;
 }
 
 int pthread_cond_destroy(pthread_cond_t *cond)
 {
-  if (cond->__c_waiting != NULL) return EBUSY;
+  if (!cond_pshared(cond)
+      && ((long) cond->__c_waiting & ~COND_MONOTONIC) != 0) return EBUSY;
   return 0;
 }
 
+/* Wake up one (NR == 1) or all (NR == INT_MAX) threads waiting on a
+   process-shared condition variable, if any.  */
+
+static void cond_pshared_wake(pthread_cond_t *cond, int nr)
+{
+  long oldval, newval;
+
+  do {
+    oldval = cond_seq(cond);
+    if (!(oldval & COND_WAITERS))
+      return;
+    newval = (oldval + COND_SEQ_INC) & COND_SEQ_MASK;
+    /* All the waiters go; those coming later set the bit again.  */
+    if (nr == INT_MAX)
+      newval &= ~COND_WAITERS;
+  } while (!compare_and_swap(cond_futex(cond), oldval, newval,
+			     &cond->__c_lock.__spinlock));
+  __pthread_futex_wakeup(cond_futex(cond), nr);
+}
+
+/* Function called by pthread_cancel for a thread waiting on a
+   process-shared condition variable.  The thread cannot be told apart
+   from the other waiters, so wake them all up; pthread_cond_wait allows
+   spurious wakeups.  */
+
+static int cond_pshared_extricate_func(void *obj, pthread_descr th)
+{
+  cond_pshared_wake(obj, INT_MAX);
+  return 0;
+}
+
+static int cond_pshared_wait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+			     const struct timespec *abstime)
+{
+  volatile pthread_descr self = thread_self();
+  pthread_extricate_if extr;
+  long val;
+  int err;
+
+  extr.pu_object = cond;
+  extr.pu_extricate_func = cond_pshared_extricate_func;
+  __pthread_set_own_extricate_if(self, &extr);
+
+  do
+    val = cond_seq(cond);
+  while (!(val & COND_WAITERS)
+	 && !compare_and_swap(cond_futex(cond), val, val | COND_WAITERS,
+			      &cond->__c_lock.__spinlock));
+  val |= COND_WAITERS;
+
+  /* A cancellation from now on changes the sequence number.  */
+  if (THREAD_GETMEM(self, p_canceled)
+      && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE) {
+    __pthread_set_own_extricate_if(self, 0);
+    __pthread_do_exit(PTHREAD_CANCELED, CURRENT_STACK_FRAME);
+  }
+
+  pthread_mutex_unlock(mutex);
+  err = __pthread_futex_sleep(cond_futex(cond), val, cond_clock(cond),
+			      abstime);
+  __pthread_set_own_extricate_if(self, 0);
+  pthread_mutex_lock(mutex);
+
+  if (THREAD_GETMEM(self, p_canceled)
+      && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE)
+    __pthread_do_exit(PTHREAD_CANCELED, CURRENT_STACK_FRAME);
+
+  return err == ETIMEDOUT ? ETIMEDOUT : 0;
+}
+
 /* Function called by pthread_cancel to remove the thread from
    waiting on a condition variable queue. */
 
@@ -47,9 +255,12 @@ static int cond_extricate_func(void *obj, pthread_descr th)
   volatile pthread_descr self = thread_self();
   pthread_cond_t *cond = obj;
   int did_remove = 0;
+  long tag;
 
   __pthread_lock(&cond->__c_lock, self);
+  tag = cond_queue_open(cond);
   did_remove = remove_from_queue(&cond->__c_waiting, th);
+  cond_queue_close(cond, tag);
   __pthread_unlock(&cond->__c_lock);
 
   return did_remove;
@@ -61,19 +272,25 @@ int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
   pthread_extricate_if extr;
   int already_canceled = 0;
   int spurious_wakeup_count;
+  long tag;
 
   /* Check whether the mutex is locked and owned by this thread.  */
   if (mutex->__m_kind != PTHREAD_MUTEX_TIMED_NP
       && mutex->__m_kind != PTHREAD_MUTEX_ADAPTIVE_NP
-      && mutex->__m_owner != self)
+      && mutex->__m_kind != PTHREAD_MUTEX_QUEUED_NP
+      && mutex->__m_owner != mutex_owner_id(mutex, self))
     return EINVAL;
 
+  if (cond_pshared(cond))
+    return cond_pshared_wait(cond, mutex, NULL);
+
   /* Set up extrication interface */
   extr.pu_object = cond;
   extr.pu_extricate_func = cond_extricate_func;
 
   /* Register extrication interface */
   THREAD_SETMEM(self, p_condvar_avail, 0);
+  THREAD_SETMEM(self, p_condvar_mutex, mutex);
   __pthread_set_own_extricate_if(self, &extr);
 
   /* Atomically enqueue thread for waiting, but only if it is not
@@ -85,9 +302,11 @@ int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
 
   __pthread_lock(&cond->__c_lock, self);
   if (!(THREAD_GETMEM(self, p_canceled)
-      && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE))
+      && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE)) {
+    tag = cond_queue_open(cond);
     enqueue(&cond->__c_waiting, self);
-  else
+    cond_queue_close(cond, tag);
+  } else
     already_canceled = 1;
   __pthread_unlock(&cond->__c_lock);
 
@@ -121,7 +340,7 @@ int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
   if (THREAD_GETMEM(self, p_woken_by_cancel)
       && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE) {
     THREAD_SETMEM(self, p_woken_by_cancel, 0);
-    pthread_mutex_lock(mutex);
+    cond_relock(mutex, self);
     __pthread_do_exit(PTHREAD_CANCELED, CURRENT_STACK_FRAME);
   }
 
@@ -129,7 +348,7 @@ int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
   while (spurious_wakeup_count--)
     restart(self);
 
-  pthread_mutex_lock(mutex);
+  cond_relock(mutex, self);
   return 0;
 }
 
@@ -142,27 +361,35 @@ pthread_cond_timedwait_relative(pthread_cond_t *cond,
   int already_canceled = 0;
   pthread_extricate_if extr;
   int spurious_wakeup_count;
+  long tag;
 
   /* Check whether the mutex is locked and owned by this thread.  */
   if (mutex->__m_kind != PTHREAD_MUTEX_TIMED_NP
       && mutex->__m_kind != PTHREAD_MUTEX_ADAPTIVE_NP
-      && mutex->__m_owner != self)
+      && mutex->__m_kind != PTHREAD_MUTEX_QUEUED_NP
+      && mutex->__m_owner != mutex_owner_id(mutex, self))
     return EINVAL;
 
+  if (cond_pshared(cond))
+    return cond_pshared_wait(cond, mutex, abstime);
+
   /* Set up extrication interface */
   extr.pu_object = cond;
   extr.pu_extricate_func = cond_extricate_func;
 
   /* Register extrication interface */
   THREAD_SETMEM(self, p_condvar_avail, 0);
+  THREAD_SETMEM(self, p_condvar_mutex, mutex);
   __pthread_set_own_extricate_if(self, &extr);
 
   /* Enqueue to wait on the condition and check for cancellation. */
   __pthread_lock(&cond->__c_lock, self);
   if (!(THREAD_GETMEM(self, p_canceled)
-      && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE))
+      && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE)) {
+    tag = cond_queue_open(cond);
     enqueue(&cond->__c_waiting, self);
-  else
+    cond_queue_close(cond, tag);
+  } else
     already_canceled = 1;
   __pthread_unlock(&cond->__c_lock);
 
@@ -176,14 +403,20 @@ pthread_cond_timedwait_relative(pthread_cond_t *cond,
   spurious_wakeup_count = 0;
   while (1)
     {
-      if (!timedsuspend(self, abstime)) {
+      /* TAG is the COND_MONOTONIC bit as enqueue found it; reading
+	 __c_waiting now, without __c_lock, could see it taken out.  */
+      if (!timedsuspend_clock(self,
+			      tag ? CLOCK_MONOTONIC : CLOCK_REALTIME,
+			      abstime)) {
 	int was_on_queue;
 
 	/* __pthread_lock will queue back any spurious restarts that
 	   may happen to it. */
 
 	__pthread_lock(&cond->__c_lock, self);
+	tag = cond_queue_open(cond);
 	was_on_queue = remove_from_queue(&cond->__c_waiting, self);
+	cond_queue_close(cond, tag);
 	__pthread_unlock(&cond->__c_lock);
 
 	if (was_on_queue) {
@@ -215,7 +448,7 @@ pthread_cond_timedwait_relative(pthread_cond_t *cond,
   if (THREAD_GETMEM(self, p_woken_by_cancel)
       && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE) {
     THREAD_SETMEM(self, p_woken_by_cancel, 0);
-    pthread_mutex_lock(mutex);
+    cond_relock(mutex, self);
     __pthread_do_exit(PTHREAD_CANCELED, CURRENT_STACK_FRAME);
   }
 
@@ -223,7 +456,7 @@ pthread_cond_timedwait_relative(pthread_cond_t *cond,
   while (spurious_wakeup_count--)
     restart(self);
 
-  pthread_mutex_lock(mutex);
+  cond_relock(mutex, self);
   return 0;
 }
 
@@ -237,12 +470,23 @@ int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
 int pthread_cond_signal(pthread_cond_t *cond)
 {
   pthread_descr th;
+  long tag;
+
+  if (cond_pshared(cond)) {
+    cond_pshared_wake(cond, 1);
+    return 0;
+  }
 
   __pthread_lock(&cond->__c_lock, NULL);
+  tag = cond_queue_open(cond);
   th = dequeue(&cond->__c_waiting);
+  cond_queue_close(cond, tag);
   __pthread_unlock(&cond->__c_lock);
   if (th != NULL) {
-    th->p_condvar_avail = 1;
+    if (__builtin_expect (__pthread_cond_defer, 0)
+	&& cond_defer(thread_self(), th))
+      return 0;
+    th->p_condvar_avail = COND_AVAIL;
     WRITE_MEMORY_BARRIER();
     restart(th);
   }
@@ -251,24 +495,51 @@ int pthread_cond_signal(pthread_cond_t *cond)
 
 int pthread_cond_broadcast(pthread_cond_t *cond)
 {
-  pthread_descr tosignal, th;
+  pthread_descr tosignal, first, th;
+  pthread_mutex_t *mutex;
+  int requeue, requeued = 0;
+  long tag;
+
+  if (cond_pshared(cond)) {
+    cond_pshared_wake(cond, INT_MAX);
+    return 0;
+  }
 
   __pthread_lock(&cond->__c_lock, NULL);
   /* Copy the current state of the waiting queue and empty it */
-  tosignal = cond->__c_waiting;
-  cond->__c_waiting = NULL;
+  tosignal = NULL;
+  tag = cond_queue_open(cond);
+  queue_move(&tosignal, &cond->__c_waiting);
+  cond_queue_close(cond, tag);
   __pthread_unlock(&cond->__c_lock);
-  /* Now signal each process in the queue */
+  first = dequeue(&tosignal);
+  if (first == NULL)
+    return 0;
+  mutex = first->p_condvar_mutex;
+  requeue = cond_can_requeue(mutex);
+  /* Now signal each process in the queue, the first one last so that the
+     others are already asleep on the mutex when it takes it.  */
   while ((th = dequeue(&tosignal)) != NULL) {
-    th->p_condvar_avail = 1;
-    WRITE_MEMORY_BARRIER();
-    restart(th);
+    if (requeue && th->p_condvar_mutex == mutex) {
+      th->p_condvar_avail = COND_AVAIL_REQUEUE;
+      WRITE_MEMORY_BARRIER();
+      cond_requeue(th, mutex);
+      requeued = 1;
+    } else {
+      th->p_condvar_avail = COND_AVAIL;
+      WRITE_MEMORY_BARRIER();
+      restart(th);
+    }
   }
+  first->p_condvar_avail = requeued ? COND_AVAIL_REQUEUE : COND_AVAIL;
+  WRITE_MEMORY_BARRIER();
+  restart(first);
   return 0;
 }
 
 int pthread_condattr_init(pthread_condattr_t *attr)
 {
+  attr->__dummy = 0;
   return 0;
 }
 
@@ -279,7 +550,8 @@ int pthread_condattr_destroy(pthread_condattr_t *attr)
 
 int pthread_condattr_getpshared (const pthread_condattr_t *attr, int *pshared)
 {
-  *pshared = PTHREAD_PROCESS_PRIVATE;
+  *pshared = (attr->__dummy & CONDATTR_PSHARED
+	      ? PTHREAD_PROCESS_SHARED : PTHREAD_PROCESS_PRIVATE);
   return 0;
 }
 
@@ -288,9 +560,35 @@ int pthread_condattr_setpshared (pthread_condattr_t *attr, int pshared)
   if (pshared != PTHREAD_PROCESS_PRIVATE && pshared != PTHREAD_PROCESS_SHARED)
     return EINVAL;
 
-  /* For now it is not possible to shared a conditional variable.  */
-  if (pshared != PTHREAD_PROCESS_PRIVATE)
+  /* Process-shared condition variables sleep on futexes.  */
+  if (pshared != PTHREAD_PROCESS_PRIVATE && !__pthread_futex_mutexes)
     return ENOSYS;
 
+  if (pshared == PTHREAD_PROCESS_SHARED)
+    attr->__dummy |= CONDATTR_PSHARED;
+  else
+    attr->__dummy &= ~CONDATTR_PSHARED;
+  return 0;
+}
+
+int pthread_condattr_getclock (const pthread_condattr_t *attr,
+			       clockid_t *clock_id)
+{
+  *clock_id = attr->__dummy >> CONDATTR_CLOCK_SHIFT;
+  return 0;
+}
+
+int pthread_condattr_setclock (pthread_condattr_t *attr, clockid_t clock_id)
+{
+  struct timespec now;
+
+  /* Timed suspension knows of these two clocks only (see pthread.c).  */
+  if (clock_id != CLOCK_REALTIME
+      && (clock_id != CLOCK_MONOTONIC
+	  || ! __pthread_clock_now (CLOCK_MONOTONIC, &now)))
+    return EINVAL;
+
+  attr->__dummy = ((attr->__dummy & CONDATTR_PSHARED)
+		   | (clock_id << CONDATTR_CLOCK_SHIFT));
   return 0;
 }
@@ -65,20 +65,45 @@ struct pthread_atomic {
 };
 
 
+/* Link of a thread or wait node in a priority-ordered wait queue.
+   See queue.h for the representation.  */
+struct _pthread_wait_link {
+  struct _pthread_wait_link *wl_next;	/* Next in queue order */
+  struct _pthread_wait_link *wl_prev;	/* Previous in queue order */
+  struct _pthread_wait_link *wl_run;	/* Other end of the priority run */
+  int wl_prio;				/* Priority when enqueued */
+};
+
+
+/* Node of a thread in the queue of a queued spinlock (see pspinlock.c).
+   A thread has PTHREAD_SPIN_NODES of them, so that it can hold or wait
+   on that many queued spinlocks at a time.  */
+#define PTHREAD_SPIN_NODES 4
+
+struct _pthread_spin_node {
+  volatile int *sn_lock;	/* Spinlock the node is used for, or NULL */
+  volatile int sn_next;		/* Queue index of the next waiter, or 0 */
+  volatile int sn_wait;		/* Nonzero until the lock is handed over */
+};
+
+
 /* Context info for read write locks. The pthread_rwlock_info structure
    is information about a lock that has been read-locked by the thread
-   in whose list this structure appears. The pthread_rwlock_context
-   is embedded in the thread context and contains a pointer to the
-   head of the list of lock info structures, as well as a count of
-   read locks that are untracked, because no info structure could be
-   allocated for them. */
+   in whose table this structure appears.  The table is embedded in the
+   thread context, as an open addressing hash table of
+   PTHREAD_READLOCK_SLOTS entries keyed by the address of the lock.  The
+   thread context also contains a count of read locks that are
+   untracked, because the table was full. */
 struct _pthread_rwlock_t;
 typedef struct _pthread_rwlock_info {
-  struct _pthread_rwlock_info *pr_next;
-  struct _pthread_rwlock_t *pr_lock;
+  struct _pthread_rwlock_t *pr_lock;	/* Lock, or NULL if free */
   int pr_lock_count;
 } pthread_readlock_info;
 
+#ifndef PTHREAD_READLOCK_SLOTS
+#define PTHREAD_READLOCK_SLOTS 16	/* Must be a power of 2 */
+#endif
+
 
 /* We keep thread specific data in a special data structure, a two-level
    array.  The top-level array contains pointers to dynamically allocated
@@ -94,8 +119,16 @@ typedef struct _pthread_rwlock_info {
   ((PTHREAD_KEYS_MAX + PTHREAD_KEY_2NDLEVEL_SIZE - 1) \
    / PTHREAD_KEY_2NDLEVEL_SIZE)
 
+/* Each thread also has a bitmap of the keys it set a value for, so that
+   thread exit only looks at those keys.  */
+#define PTHREAD_KEY_BITMAP_BITS	(8 * sizeof (unsigned long))
+#define PTHREAD_KEY_BITMAP_SIZE \
+  ((PTHREAD_KEYS_MAX + PTHREAD_KEY_BITMAP_BITS - 1) \
+   / PTHREAD_KEY_BITMAP_BITS)
+
 
 union dtv;
+struct wait_node;
 
 
 struct _pthread_descr_struct {
@@ -133,7 +166,8 @@ struct _pthread_descr_struct {
   char * p_in_sighandler;       /* stack address of sighandler, or NULL */
   char p_sigwaiting;            /* true if a sigwait() is in progress */
   struct pthread_start_args p_start_args; /* arguments for thread creation */
-  void ** p_specific[PTHREAD_KEY_1STLEVEL_SIZE]; /* thread-specific data */
+  struct pthread_key_data * p_specific[PTHREAD_KEY_1STLEVEL_SIZE];
+				/* thread-specific data */
 #if !(USE_TLS && HAVE___THREAD)
   void * p_libc_specific[_LIBC_TSD_KEY_N]; /* thread-specific data for libc */
   int * p_errnop;               /* pointer to used errno variable */
@@ -155,9 +189,9 @@ struct _pthread_descr_struct {
   char p_condvar_avail;		/* flag if conditional variable became avail */
   char p_sem_avail;             /* flag if semaphore became available */
   pthread_extricate_if *p_extricate; /* See above */
-  pthread_readlock_info *p_readlock_list;  /* List of readlock info structs */
-  pthread_readlock_info *p_readlock_free;  /* Free list of structs */
-  int p_untracked_readlock_count;	/* Readlocks not tracked by list */
+  pthread_readlock_info *p_readlock_list;  /* Unused, see p_readlock_table */
+  pthread_readlock_info *p_readlock_free;  /* Unused */
+  int p_untracked_readlock_count;	/* Readlocks not tracked by table */
   int p_inheritsched;           /* copied from the thread attribute */
 #if HP_TIMING_AVAIL
   hp_timing_t p_cpuclock_offset; /* Initial CPU clock for thread.  */
@@ -165,6 +199,24 @@ struct _pthread_descr_struct {
 #ifdef USE_TLS
   char *p_stackaddr;		/* Stack address.  */
 #endif
+  pthread_descr p_qlock_next;	/* Next waiter on a queued fastlock */
+  long p_qlock_wait;		/* Waiting state on a queued fastlock */
+  struct _pthread_wait_link p_waitlink; /* Link in a waiting queue */
+  pthread_descr * p_waitqueue;	/* Waiting queue the thread is on, or NULL */
+  struct _pthread_wait_link p_locklink; /* Link among sorted fastlock waiters */
+  char p_lockq_first;		/* First of the sorted fastlock waiters */
+  struct wait_node *p_wait_nodes; /* Cache of free alt fastlock wait nodes */
+  int p_wait_nodes_count;	/* Number of nodes in p_wait_nodes */
+  struct _pthread_spin_node p_spin_nodes[PTHREAD_SPIN_NODES];
+				/* Nodes for queued spinlocks */
+  pthread_mutex_t *p_condvar_mutex; /* Mutex of the condition wait */
+  pthread_descr p_condvar_deferred; /* Condition waiters to restart when
+				       the mutex is released */
+  pthread_descr p_condvar_nextdeferred; /* Next on that list */
+  pthread_readlock_info p_readlock_table[PTHREAD_READLOCK_SLOTS];
+				/* Readlocks held by the thread */
+  unsigned long p_specific_used[PTHREAD_KEY_BITMAP_SIZE];
+				/* Keys which may have a value */
   /* New elements must be added at the end.  */
 } __attribute__ ((aligned(32))); /* We need to align the structure so that
 				    doubles are aligned properly.  This is 8
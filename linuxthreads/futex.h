@@ -0,0 +1,125 @@
+/* Access to the futex system call for LinuxThreads.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of the
+   License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; see the file COPYING.LIB.  If not,
+   write to the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+   Boston, MA 02111-1307, USA.  */
+
+#ifndef _FUTEX_H
+#define _FUTEX_H	1
+
+#include <errno.h>
+#include <endian.h>
+#include <time.h>
+#include <sysdep.h>
+#include <sys/syscall.h>
+
+/* Operation codes of the futex system call, see <linux/futex.h>.  */
+#define FUTEX_WAIT		0
+#define FUTEX_WAKE		1
+#define FUTEX_CMP_REQUEUE	4
+#define FUTEX_WAIT_BITSET	9
+
+#define FUTEX_BITSET_MATCH_ANY	0xffffffff
+
+#ifdef __NR_futex
+
+/* The futex system call operates on 32-bit words while the atomic
+   operations of pt-machine.h operate on longs.  Return the address of the
+   half of *P holding the least significant bits.  As long as the value
+   stored in *P fits in an int (including small negative values), that
+   half compares equal to the value cast to int.  */
+
+static inline int *
+__futex_word (long *p)
+{
+#if __BYTE_ORDER == __BIG_ENDIAN
+  return (int *) p + (sizeof (long) / sizeof (int) - 1);
+#else
+  return (int *) p;
+#endif
+}
+
+/* Sleep on ADDR as long as it contains VAL, for at most RELTIME if it is
+   not NULL.  Return 0 on wakeup, or an error code: EWOULDBLOCK if *ADDR
+   did not contain VAL, ETIMEDOUT, EINTR, or ENOSYS if the kernel has no
+   futexes.  errno is left untouched.  */
+
+static inline int
+__futex_wait (int *addr, int val, const struct timespec *reltime)
+{
+  int saved_errno = errno;
+  int err = 0;
+
+  if (INLINE_SYSCALL (futex, 4, addr, FUTEX_WAIT, val, reltime) == -1)
+    err = errno;
+  __set_errno (saved_errno);
+  return err;
+}
+
+/* Like __futex_wait, but ABSTIME is an absolute CLOCK_MONOTONIC time, so
+   the timeout needs no recomputation when the wait is interrupted.
+   Kernels before 2.6.25 don't know the operation and return ENOSYS.  */
+
+static inline int
+__futex_wait_abs (int *addr, int val, const struct timespec *abstime)
+{
+  int saved_errno = errno;
+  int err = 0;
+
+  if (INLINE_SYSCALL (futex, 6, addr, FUTEX_WAIT_BITSET, val, abstime,
+		      NULL, FUTEX_BITSET_MATCH_ANY) == -1)
+    err = errno;
+  __set_errno (saved_errno);
+  return err;
+}
+
+/* Wake up at most NR threads sleeping on ADDR.  Return 0 or an error
+   code; errno is left untouched.  */
+
+static inline int
+__futex_wake (int *addr, int nr)
+{
+  int saved_errno = errno;
+  int err = 0;
+
+  if (INLINE_SYSCALL (futex, 4, addr, FUTEX_WAKE, nr, NULL) == -1)
+    err = errno;
+  __set_errno (saved_errno);
+  return err;
+}
+
+/* If ADDR still contains VAL, wake up at most NR_WAKE threads sleeping
+   on it and move at most NR_MOVE others over to ADDR2, without waking
+   them up.  Return 0 or an error code: EAGAIN if *ADDR did not contain
+   VAL, ENOSYS or EINVAL if the kernel does not know the operation (it
+   appeared in 2.6.7).  errno is left untouched.  */
+
+static inline int
+__futex_cmp_requeue (int *addr, int nr_wake, int nr_move, int *addr2, int val)
+{
+  int saved_errno = errno;
+  int err = 0;
+
+  if (INLINE_SYSCALL (futex, 6, addr, FUTEX_CMP_REQUEUE, nr_wake,
+		      (void *) (long) nr_move, addr2, val) == -1)
+    err = errno;
+  __set_errno (saved_errno);
+  return err;
+}
+
+#endif /* __NR_futex */
+
+#endif /* futex.h */
@@ -48,6 +48,16 @@ typedef void (*destr_function)(void *);
 struct pthread_key_struct {
   int in_use;                   /* already allocated? */
   destr_function destr;         /* destruction routine */
+  unsigned long seq;            /* generation, bumped by pthread_key_delete */
+};
+
+/* The value of a key in a thread, along with the generation of the key
+   it was set for.  A value set before the key was last deleted has a
+   stale generation and reads as NULL. */
+
+struct pthread_key_data {
+  unsigned long seq;            /* generation of the key when set */
+  void * data;                  /* value */
 };
 
 
@@ -63,6 +73,7 @@ struct pthread_handle_struct {
   struct _pthread_fastlock h_lock; /* Fast lock for sychronized access */
   pthread_descr h_descr;        /* Thread descriptor or NULL if invalid */
   char * h_bottom;              /* Lowest address in the stack thread */
+  int h_suspended;              /* Nonzero while the thread is suspended */
 };
 
 /* The type of messages sent to the thread manager thread */
@@ -155,6 +166,13 @@ extern volatile pthread_descr __pthread_last_event;
 /* Flag which tells whether we are executing on SMP kernel. */
 extern int __pthread_smp_kernel;
 
+/* Flag which tells whether mutexes are futex words. */
+extern int __pthread_futex_mutexes;
+
+/* Flag which tells whether pthread_cond_signal defers wakeups until the
+   mutex is released (see condvar.c). */
+extern int __pthread_cond_defer;
+
 /* Return the handle corresponding to a thread id */
 
 static inline pthread_handle thread_handle(pthread_t id)
@@ -221,13 +239,26 @@ static inline int nonexisting_handle(pthread_handle h, pthread_t id)
 #define WRITE_MEMORY_BARRIER() MEMORY_BARRIER()
 #endif
 
-/* Max number of times we must spin on a spinlock calling sched_yield().
-   After MAX_SPIN_COUNT iterations, we put the calling thread to sleep. */
+/* Max number of times we wait for a spinlock to look free on SMP
+   systems, before we start backing off.  */
+
+#ifndef SPIN_PAUSE_COUNT
+#define SPIN_PAUSE_COUNT 100
+#endif
+
+/* Max number of times we must back off from a spinlock, calling
+   sched_yield() or spinning for a random time below a doubling bound of
+   at most MAX_SPIN_BACKOFF rounds on SMP systems.  After MAX_SPIN_COUNT
+   iterations, we put the calling thread to sleep. */
 
 #ifndef MAX_SPIN_COUNT
 #define MAX_SPIN_COUNT 50
 #endif
 
+#ifndef MAX_SPIN_BACKOFF
+#define MAX_SPIN_BACKOFF 1024
+#endif
+
 /* Max number of times the spinlock in the adaptive mutex implementation
    spins actively on SMP systems.  */
 
@@ -235,8 +266,66 @@ static inline int nonexisting_handle(pthread_handle h, pthread_t id)
 #define MAX_ADAPTIVE_SPIN_COUNT 100
 #endif
 
-/* Duration of sleep (in nanoseconds) when we can't acquire a spinlock
-   after MAX_SPIN_COUNT iterations of sched_yield().
+/* pthread_mutexattr_t keeps the mutex kind in the low bits of
+   __mutexkind, a process-shared flag, and the max spin count of adaptive
+   mutexes plus one (zero for the default) above them.  pthread_mutex_t
+   keeps the latter in __m_reserved, along with MUTEX_PSHARED.  */
+
+#define MUTEXATTR_KIND_MASK 0x7f
+#define MUTEXATTR_PSHARED 0x80
+#define MUTEXATTR_SPIN_SHIFT 8
+
+#define MUTEX_PSHARED 0x40000000
+
+/* Recursive and error checking mutexes record their owner in __m_owner.
+   The owner of a process-shared mutex may live in another process, where
+   descriptor addresses mean nothing, so they record its pid instead.  */
+
+static inline _pthread_descr
+mutex_owner_id (const pthread_mutex_t *mutex, pthread_descr self)
+{
+  if (mutex->__m_reserved & MUTEX_PSHARED)
+    return (_pthread_descr) (long) THREAD_GETMEM (self, p_pid);
+  return self;
+}
+
+/* The moving average of the spins needed to get an adaptive lock moves by
+   1/ADAPTIVE_SPIN_DECAY of the difference at each contended lock.  Both
+   can be overridden from the environment (see pthread.c).  */
+
+#ifndef ADAPTIVE_SPIN_DECAY
+#define ADAPTIVE_SPIN_DECAY 8
+#endif
+
+/* Max number of times a thread waiting on a barrier or semaphore spins
+   on SMP systems before going to sleep, unless the object sets its own
+   limit.  Can be overridden from the environment (see pthread.c).  */
+
+#ifndef MAX_WAIT_SPIN_COUNT
+#define MAX_WAIT_SPIN_COUNT 1000
+#endif
+
+/* Max number of times a thread waiting on a queued fastlock spins on its
+   own descriptor on SMP systems before going to sleep.  Unlike spinning
+   on the lock itself, this does not disturb the other processors.  */
+
+#ifndef MAX_QUEUED_SPIN_COUNT
+#define MAX_QUEUED_SPIN_COUNT 1000
+#endif
+
+/* Number of free wait nodes of alternate fastlocks a thread caches, and
+   max number of such caches kept in the global depot for reuse.  */
+
+#ifndef WAIT_NODE_CACHE_SIZE
+#define WAIT_NODE_CACHE_SIZE 16
+#endif
+
+#ifndef WAIT_NODE_DEPOT_SIZE
+#define WAIT_NODE_DEPOT_SIZE 64
+#endif
+
+/* Max duration of sleep (in nanoseconds) when we can't acquire a spinlock
+   after MAX_SPIN_COUNT backoff iterations.
    With the 2.0 and 2.1 kernels, this MUST BE > 2ms.
    (Otherwise the kernel does busy-waiting for realtime threads,
     giving other threads no chance to run.) */
@@ -298,6 +387,9 @@ extern int __pthread_getconcurrency (void);
 extern int __pthread_setconcurrency (int __level);
 extern int __pthread_mutex_timedlock (pthread_mutex_t *__mutex,
 				      const struct timespec *__abstime);
+extern void __pthread_mutex_cond_lock (pthread_mutex_t *__mutex);
+extern void __pthread_cond_flush (pthread_descr __self,
+				 pthread_mutex_t *__mutex);
 extern int __pthread_mutexattr_getpshared (const pthread_mutexattr_t *__attr,
 					   int *__pshared);
 extern int __pthread_mutexattr_setpshared (pthread_mutexattr_t *__attr,
@@ -308,11 +400,22 @@ extern void __pthread_kill_other_threads_np (void);
 
 extern void __pthread_restart_old(pthread_descr th);
 extern void __pthread_suspend_old(pthread_descr self);
-extern int __pthread_timedsuspend_old(pthread_descr self, const struct timespec *abs);
+extern int __pthread_timedsuspend_old(pthread_descr self, clockid_t clock,
+				      const struct timespec *abs);
 
 extern void __pthread_restart_new(pthread_descr th);
 extern void __pthread_suspend_new(pthread_descr self);
-extern int __pthread_timedsuspend_new(pthread_descr self, const struct timespec *abs);
+extern int __pthread_timedsuspend_new(pthread_descr self, clockid_t clock,
+				      const struct timespec *abs);
+
+extern void __pthread_restart_futex(pthread_descr th);
+extern void __pthread_restart_requeue_futex(pthread_descr th, int *addr);
+extern void __pthread_suspend_futex(pthread_descr self);
+extern int __pthread_timedsuspend_futex(pthread_descr self, clockid_t clock,
+					const struct timespec *abs);
+extern int __pthread_futex_wait_until(int *addr, int val, clockid_t clock,
+				      const struct timespec *abstime);
+extern int __pthread_clock_now(clockid_t clock, struct timespec *now);
 
 extern void __pthread_wait_for_restart_signal(pthread_descr self);
 
@@ -340,15 +443,17 @@ extern int __pthread_clock_gettime (hp_timing_t freq, struct timespec *tp);
 extern void __pthread_clock_settime (hp_timing_t offset);
 
 
-/* Global pointers to old or new suspend functions */
+/* Global pointers to old, new or futex suspend functions */
 
 extern void (*__pthread_restart)(pthread_descr);
 extern void (*__pthread_suspend)(pthread_descr);
-extern int (*__pthread_timedsuspend)(pthread_descr, const struct timespec *);
+extern int (*__pthread_timedsuspend)(pthread_descr, clockid_t,
+				     const struct timespec *);
 
 /* Prototypes for the function without cancelation support when the
    normal version has it.  */
 extern int __libc_close (int fd);
+extern int __libc_open (const char *file, int oflag, ...);
 extern int __libc_nanosleep (const struct timespec *requested_time,
 			     struct timespec *remaining);
 /* Prototypes for some of the new semaphore functions.  */
@@ -39,6 +39,10 @@ void __pthread_do_exit(void *retval, char *currentframe)
   THREAD_SETMEM(self, p_canceled, 0);
   /* Call cleanup functions and destroy the thread-specific data */
   __pthread_perform_cleanup(currentframe);
+  /* Restart the condition waiters whose wakeup is still deferred, even if
+     we still hold their mutex.  */
+  if (THREAD_GETMEM(self, p_condvar_deferred) != NULL)
+    __pthread_cond_flush(self, NULL);
   __pthread_destroy_specifics();
   /* Store return value */
   __pthread_lock(THREAD_GETMEM(self, p_lock), self);
@@ -294,7 +294,9 @@ pthread_start_thread(void *arg)
     request.req_kind = REQ_DEBUG;
     TEMP_FAILURE_RETRY(__libc_write(__pthread_manager_request,
 				    (char *) &request, sizeof(request)));
-    suspend(self);
+    /* The debugger restarts us with the restart signal, whichever way
+       suspend() is implemented. */
+    __pthread_wait_for_restart_signal(self);
   }
   /* Run the thread code */
   outcome = self->p_start_args.start_routine(THREAD_GETMEM(self,
@@ -809,7 +811,6 @@ static int pthread_handle_create(pthread_t *thread, const pthread_attr_t *attr,
 static void pthread_free(pthread_descr th)
 {
   pthread_handle handle;
-  pthread_readlock_info *iter, *next;
 
   ASSERT(th->p_exited);
   /* Make the handle invalid */
@@ -824,21 +825,8 @@ static void pthread_free(pthread_descr th)
   /* One fewer threads in __pthread_handles */
   __pthread_handles_num--;
 
-  /* Destroy read lock list, and list of free read lock structures.
-     If the former is not empty, it means the thread exited while
-     holding read locks! */
-
-  for (iter = th->p_readlock_list; iter != NULL; iter = next)
-    {
-      next = iter->pr_next;
-      free(iter);
-    }
-
-  for (iter = th->p_readlock_free; iter != NULL; iter = next)
-    {
-      next = iter->pr_next;
-      free(iter);
-    }
+  /* Free the cached wait nodes of alternate fastlocks.  */
+  __pthread_free_wait_nodes(th);
 
   /* If initial thread, nothing to free */
   if (!th->p_userstack)
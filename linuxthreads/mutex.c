@@ -29,24 +29,115 @@ int __pthread_mutex_init(pthread_mutex_t * mutex,
                        const pthread_mutexattr_t * mutex_attr)
 {
   __pthread_init_lock(&mutex->__m_lock);
-  mutex->__m_kind =
-    mutex_attr == NULL ? PTHREAD_MUTEX_TIMED_NP : mutex_attr->__mutexkind;
+  if (mutex_attr == NULL) {
+    mutex->__m_kind = PTHREAD_MUTEX_TIMED_NP;
+    mutex->__m_reserved = 0;
+  } else {
+    mutex->__m_kind = mutex_attr->__mutexkind & MUTEXATTR_KIND_MASK;
+    mutex->__m_reserved = mutex_attr->__mutexkind >> MUTEXATTR_SPIN_SHIFT;
+    if (mutex_attr->__mutexkind & MUTEXATTR_PSHARED) {
+      mutex->__m_reserved |= MUTEX_PSHARED;
+      /* Queued mutexes hand the lock over to a thread descriptor. */
+      if (mutex->__m_kind == PTHREAD_MUTEX_QUEUED_NP)
+	mutex->__m_kind = PTHREAD_MUTEX_TIMED_NP;
+    }
+  }
   mutex->__m_count = 0;
   mutex->__m_owner = NULL;
   return 0;
 }
 strong_alias (__pthread_mutex_init, pthread_mutex_init)
 
+#define mutex_pshared(mutex) (((mutex)->__m_reserved & MUTEX_PSHARED) != 0)
+#define mutex_spin(mutex) (((mutex)->__m_reserved & ~MUTEX_PSHARED) - 1)
+
+/* When __pthread_futex_mutexes is set, the fastlock of a mutex of any
+   kind but PTHREAD_MUTEX_QUEUED_NP is a futex lock (see spinlock.h).
+   Waiters sleep in the kernel; no thread descriptor nor wait node is
+   involved.  */
+
+#define mutex_futex() __builtin_expect (__pthread_futex_mutexes, 1)
+
+/* Spin on an adaptive mutex before sleeping, with the same tunables and
+   moving average as __pthread_lock (see spinlock.c).  Return nonzero if
+   the mutex was acquired.  */
+
+static int futex_mutex_spin(pthread_mutex_t * mutex)
+{
+  long * status = &mutex->__m_lock.__status;
+  int max_spin = mutex_spin(mutex);
+  int max_count, spin_count, owner;
+
+  if (max_spin < 0)
+    max_spin = __pthread_spin_max;
+  if (! __pthread_smp_kernel || max_spin == 0)
+    return 0;
+
+  max_count = mutex->__m_lock.__spinlock * 2 + 10;
+  if (max_count > max_spin)
+    max_count = max_spin;
+
+  for (spin_count = 0; spin_count < max_count; spin_count++) {
+    if (__pthread_futex_trylock(&mutex->__m_lock) == 0) {
+      mutex->__m_lock.__spinlock +=
+	(spin_count - mutex->__m_lock.__spinlock) / __pthread_spin_decay;
+      __pthread_spin_acquired++;
+      return 1;
+    }
+    if (__pthread_spin_owner && (owner = mutex->__m_count) != 0
+	&& __pthread_handles[owner - 1].h_suspended)
+      break;
+#ifdef BUSY_WAIT_NOP
+    BUSY_WAIT_NOP;
+#endif
+    __asm __volatile ("" : "=m" (*status) : "0" (*status));
+  }
+
+  mutex->__m_lock.__spinlock +=
+    (spin_count - mutex->__m_lock.__spinlock) / __pthread_spin_decay;
+  __pthread_spin_suspended++;
+  return 0;
+}
+
+static inline int futex_mutex_trylock(pthread_mutex_t * mutex)
+{
+  return __pthread_futex_trylock(&mutex->__m_lock);
+}
+
+static inline int futex_mutex_lock(pthread_mutex_t * mutex, int adaptive,
+				   const struct timespec * abstime)
+{
+  if (__pthread_futex_trylock(&mutex->__m_lock) == 0)
+    return 0;
+  if (! adaptive)
+    return __pthread_futex_lock_wait(&mutex->__m_lock, NULL, abstime);
+  if (futex_mutex_spin(mutex))
+    return 0;
+  /* Owners sleeping here are not running either.  Process-shared
+     mutexes record no owner for the spinners to check. */
+  return __pthread_futex_lock_wait(&mutex->__m_lock,
+				   __pthread_spin_owner && !mutex_pshared(mutex)
+				   ? thread_self() : NULL,
+				   abstime);
+}
+
+static inline void futex_mutex_unlock(pthread_mutex_t * mutex)
+{
+  __pthread_futex_unlock(&mutex->__m_lock);
+}
+
 int __pthread_mutex_destroy(pthread_mutex_t * mutex)
 {
   switch (mutex->__m_kind) {
   case PTHREAD_MUTEX_ADAPTIVE_NP:
   case PTHREAD_MUTEX_RECURSIVE_NP:
-    if ((mutex->__m_lock.__status & 1) != 0)
+    if ((mutex->__m_lock.__status & 1) != 0
+	|| (mutex_futex() && mutex->__m_lock.__status != 0))
       return EBUSY;
     return 0;
   case PTHREAD_MUTEX_ERRORCHECK_NP:
   case PTHREAD_MUTEX_TIMED_NP:
+  case PTHREAD_MUTEX_QUEUED_NP:
     if (mutex->__m_lock.__status != 0)
       return EBUSY;
     return 0;
@@ -56,6 +147,60 @@ int __pthread_mutex_destroy(pthread_mutex_t * mutex)
 }
 strong_alias (__pthread_mutex_destroy, pthread_mutex_destroy)
 
+/* When pthread_cond_signal defers wakeups (see condvar.c), it needs to
+   know the owner of the mutex, so timed and adaptive mutexes record it
+   in __m_owner too.  Releasing the mutex restarts the threads whose
+   wakeup its owner deferred.  */
+
+#define mutex_cond_defer() __builtin_expect (__pthread_cond_defer, 0)
+
+static inline void mutex_set_owner(pthread_mutex_t * mutex)
+{
+  if (mutex_cond_defer())
+    mutex->__m_owner = mutex_owner_id(mutex, thread_self());
+}
+
+static inline void mutex_clear_owner(pthread_mutex_t * mutex)
+{
+  if (mutex_cond_defer())
+    mutex->__m_owner = NULL;
+}
+
+static inline void mutex_flush_wakeups(pthread_mutex_t * mutex)
+{
+  pthread_descr self;
+
+  if (mutex_cond_defer()) {
+    self = thread_self();
+    if (THREAD_GETMEM(self, p_condvar_deferred) != NULL)
+      __pthread_cond_flush(self, mutex);
+  }
+}
+
+/* Adaptive mutexes record their owner in __m_count as its handle number
+   plus one, for the waiters to check whether it is running, but only if
+   that check is enabled (see spinlock.c) and the mutex is private.  */
+
+static inline void adaptive_set_owner(pthread_mutex_t * mutex)
+{
+  if (__pthread_spin_owner && !mutex_pshared(mutex))
+    mutex->__m_count = THREAD_GETMEM(thread_self(), p_nr) + 1;
+  mutex_set_owner(mutex);
+}
+
+static inline int adaptive_lock(pthread_mutex_t * mutex,
+				const struct timespec * abstime)
+{
+  if (mutex_futex()) {
+    if (futex_mutex_lock(mutex, 1, abstime) != 0)
+      return ETIMEDOUT;
+  } else
+    __pthread_adaptive_lock(&mutex->__m_lock, NULL, mutex_spin(mutex),
+			    &mutex->__m_count);
+  adaptive_set_owner(mutex);
+  return 0;
+}
+
 int __pthread_mutex_trylock(pthread_mutex_t * mutex)
 {
   pthread_descr self;
@@ -63,28 +208,47 @@ int __pthread_mutex_trylock(pthread_mutex_t * mutex)
 
   switch(mutex->__m_kind) {
   case PTHREAD_MUTEX_ADAPTIVE_NP:
+    if (mutex_futex())
+      retcode = futex_mutex_trylock(mutex);
+    else
+      retcode = __pthread_trylock(&mutex->__m_lock);
+    if (retcode == 0)
+      adaptive_set_owner(mutex);
+    return retcode;
+  case PTHREAD_MUTEX_QUEUED_NP:
     retcode = __pthread_trylock(&mutex->__m_lock);
     return retcode;
   case PTHREAD_MUTEX_RECURSIVE_NP:
-    self = thread_self();
+    self = mutex_owner_id(mutex, thread_self());
     if (mutex->__m_owner == self) {
       mutex->__m_count++;
       return 0;
     }
-    retcode = __pthread_trylock(&mutex->__m_lock);
+    if (mutex_futex())
+      retcode = futex_mutex_trylock(mutex);
+    else
+      retcode = __pthread_trylock(&mutex->__m_lock);
     if (retcode == 0) {
       mutex->__m_owner = self;
       mutex->__m_count = 0;
     }
     return retcode;
   case PTHREAD_MUTEX_ERRORCHECK_NP:
-    retcode = __pthread_alt_trylock(&mutex->__m_lock);
+    if (mutex_futex())
+      retcode = futex_mutex_trylock(mutex);
+    else
+      retcode = __pthread_alt_trylock(&mutex->__m_lock);
     if (retcode == 0) {
-      mutex->__m_owner = thread_self();
+      mutex->__m_owner = mutex_owner_id(mutex, thread_self());
     }
     return retcode;
   case PTHREAD_MUTEX_TIMED_NP:
-    retcode = __pthread_alt_trylock(&mutex->__m_lock);
+    if (mutex_futex())
+      retcode = futex_mutex_trylock(mutex);
+    else
+      retcode = __pthread_alt_trylock(&mutex->__m_lock);
+    if (retcode == 0)
+      mutex_set_owner(mutex);
     return retcode;
   default:
     return EINVAL;
@@ -98,26 +262,39 @@ int __pthread_mutex_lock(pthread_mutex_t * mutex)
 
   switch(mutex->__m_kind) {
   case PTHREAD_MUTEX_ADAPTIVE_NP:
-    __pthread_lock(&mutex->__m_lock, NULL);
+    adaptive_lock(mutex, NULL);
     return 0;
   case PTHREAD_MUTEX_RECURSIVE_NP:
-    self = thread_self();
+    self = mutex_owner_id(mutex, thread_self());
     if (mutex->__m_owner == self) {
       mutex->__m_count++;
       return 0;
     }
-    __pthread_lock(&mutex->__m_lock, self);
+    if (mutex_futex())
+      futex_mutex_lock(mutex, 0, NULL);
+    else
+      __pthread_lock(&mutex->__m_lock, self);
     mutex->__m_owner = self;
     mutex->__m_count = 0;
     return 0;
   case PTHREAD_MUTEX_ERRORCHECK_NP:
-    self = thread_self();
+    self = mutex_owner_id(mutex, thread_self());
     if (mutex->__m_owner == self) return EDEADLK;
-    __pthread_alt_lock(&mutex->__m_lock, self);
+    if (mutex_futex())
+      futex_mutex_lock(mutex, 0, NULL);
+    else
+      __pthread_alt_lock(&mutex->__m_lock, self);
     mutex->__m_owner = self;
     return 0;
   case PTHREAD_MUTEX_TIMED_NP:
-    __pthread_alt_lock(&mutex->__m_lock, NULL);
+    if (mutex_futex())
+      futex_mutex_lock(mutex, 0, NULL);
+    else
+      __pthread_alt_lock(&mutex->__m_lock, NULL);
+    mutex_set_owner(mutex);
+    return 0;
+  case PTHREAD_MUTEX_QUEUED_NP:
+    __pthread_queue_lock(&mutex->__m_lock, NULL);
     return 0;
   default:
     return EINVAL;
@@ -137,22 +314,28 @@ int __pthread_mutex_timedlock (pthread_mutex_t *mutex,
 
   switch(mutex->__m_kind) {
   case PTHREAD_MUTEX_ADAPTIVE_NP:
-    __pthread_lock(&mutex->__m_lock, NULL);
-    return 0;
+    return adaptive_lock(mutex, abstime);
   case PTHREAD_MUTEX_RECURSIVE_NP:
-    self = thread_self();
+    self = mutex_owner_id(mutex, thread_self());
     if (mutex->__m_owner == self) {
       mutex->__m_count++;
       return 0;
     }
-    __pthread_lock(&mutex->__m_lock, self);
+    if (mutex_futex()) {
+      if (futex_mutex_lock(mutex, 0, abstime) != 0)
+	return ETIMEDOUT;
+    } else
+      __pthread_lock(&mutex->__m_lock, self);
     mutex->__m_owner = self;
     mutex->__m_count = 0;
     return 0;
   case PTHREAD_MUTEX_ERRORCHECK_NP:
-    self = thread_self();
+    self = mutex_owner_id(mutex, thread_self());
     if (mutex->__m_owner == self) return EDEADLK;
-    res = __pthread_alt_timedlock(&mutex->__m_lock, self, abstime);
+    if (mutex_futex())
+      res = futex_mutex_lock(mutex, 0, abstime) == 0;
+    else
+      res = __pthread_alt_timedlock(&mutex->__m_lock, self, abstime);
     if (res != 0)
       {
 	mutex->__m_owner = self;
@@ -160,39 +343,96 @@ int __pthread_mutex_timedlock (pthread_mutex_t *mutex,
       }
     return ETIMEDOUT;
   case PTHREAD_MUTEX_TIMED_NP:
-    /* Only this type supports timed out lock. */
-    return (__pthread_alt_timedlock(&mutex->__m_lock, NULL, abstime)
-	    ? 0 : ETIMEDOUT);
+    if (mutex_futex())
+      res = futex_mutex_lock(mutex, 0, abstime) == 0;
+    else
+      /* Without futexes, only this type supports timed out lock. */
+      res = __pthread_alt_timedlock(&mutex->__m_lock, NULL, abstime);
+    if (res == 0)
+      return ETIMEDOUT;
+    mutex_set_owner(mutex);
+    return 0;
+  case PTHREAD_MUTEX_QUEUED_NP:
+    __pthread_queue_lock(&mutex->__m_lock, NULL);
+    return 0;
   default:
     return EINVAL;
   }
 }
 strong_alias (__pthread_mutex_timedlock, pthread_mutex_timedlock)
 
+/* Relock MUTEX, a futex mutex, at the end of a condition wait during
+   which pthread_cond_broadcast moved threads over to its futex (see
+   condvar.c).  The lock is marked contended whatever its state, so that
+   its release wakes up the next of them.  */
+
+void __pthread_mutex_cond_lock(pthread_mutex_t * mutex)
+{
+  __pthread_futex_lock_wait(&mutex->__m_lock, NULL, NULL);
+  switch (mutex->__m_kind) {
+  case PTHREAD_MUTEX_ADAPTIVE_NP:
+    adaptive_set_owner(mutex);
+    break;
+  case PTHREAD_MUTEX_RECURSIVE_NP:
+    mutex->__m_owner = mutex_owner_id(mutex, thread_self());
+    mutex->__m_count = 0;
+    break;
+  case PTHREAD_MUTEX_ERRORCHECK_NP:
+    mutex->__m_owner = mutex_owner_id(mutex, thread_self());
+    break;
+  case PTHREAD_MUTEX_TIMED_NP:
+    mutex_set_owner(mutex);
+    break;
+  }
+}
+
 int __pthread_mutex_unlock(pthread_mutex_t * mutex)
 {
   switch (mutex->__m_kind) {
   case PTHREAD_MUTEX_ADAPTIVE_NP:
-    __pthread_unlock(&mutex->__m_lock);
+    mutex->__m_count = 0;
+    mutex_clear_owner(mutex);
+    if (mutex_futex())
+      futex_mutex_unlock(mutex);
+    else
+      __pthread_unlock(&mutex->__m_lock);
+    mutex_flush_wakeups(mutex);
     return 0;
   case PTHREAD_MUTEX_RECURSIVE_NP:
-    if (mutex->__m_owner != thread_self())
+    if (mutex->__m_owner != mutex_owner_id(mutex, thread_self()))
       return EPERM;
     if (mutex->__m_count > 0) {
       mutex->__m_count--;
       return 0;
     }
     mutex->__m_owner = NULL;
-    __pthread_unlock(&mutex->__m_lock);
+    if (mutex_futex())
+      futex_mutex_unlock(mutex);
+    else
+      __pthread_unlock(&mutex->__m_lock);
+    mutex_flush_wakeups(mutex);
     return 0;
   case PTHREAD_MUTEX_ERRORCHECK_NP:
-    if (mutex->__m_owner != thread_self() || mutex->__m_lock.__status == 0)
+    if (mutex->__m_owner != mutex_owner_id(mutex, thread_self())
+	|| mutex->__m_lock.__status == 0)
       return EPERM;
     mutex->__m_owner = NULL;
-    __pthread_alt_unlock(&mutex->__m_lock);
+    if (mutex_futex())
+      futex_mutex_unlock(mutex);
+    else
+      __pthread_alt_unlock(&mutex->__m_lock);
+    mutex_flush_wakeups(mutex);
     return 0;
   case PTHREAD_MUTEX_TIMED_NP:
-    __pthread_alt_unlock(&mutex->__m_lock);
+    mutex_clear_owner(mutex);
+    if (mutex_futex())
+      futex_mutex_unlock(mutex);
+    else
+      __pthread_alt_unlock(&mutex->__m_lock);
+    mutex_flush_wakeups(mutex);
+    return 0;
+  case PTHREAD_MUTEX_QUEUED_NP:
+    __pthread_queue_unlock(&mutex->__m_lock);
     return 0;
   default:
     return EINVAL;
@@ -218,9 +458,10 @@ int __pthread_mutexattr_settype(pthread_mutexattr_t *attr, int kind)
   if (kind != PTHREAD_MUTEX_ADAPTIVE_NP
       && kind != PTHREAD_MUTEX_RECURSIVE_NP
       && kind != PTHREAD_MUTEX_ERRORCHECK_NP
-      && kind != PTHREAD_MUTEX_TIMED_NP)
+      && kind != PTHREAD_MUTEX_TIMED_NP
+      && kind != PTHREAD_MUTEX_QUEUED_NP)
     return EINVAL;
-  attr->__mutexkind = kind;
+  attr->__mutexkind = (attr->__mutexkind & ~MUTEXATTR_KIND_MASK) | kind;
   return 0;
 }
 weak_alias (__pthread_mutexattr_settype, pthread_mutexattr_settype)
@@ -229,17 +470,41 @@ weak_alias (__pthread_mutexattr_setkind_np, pthread_mutexattr_setkind_np)
 
 int __pthread_mutexattr_gettype(const pthread_mutexattr_t *attr, int *kind)
 {
-  *kind = attr->__mutexkind;
+  *kind = attr->__mutexkind & MUTEXATTR_KIND_MASK;
   return 0;
 }
 weak_alias (__pthread_mutexattr_gettype, pthread_mutexattr_gettype)
 strong_alias (__pthread_mutexattr_gettype, __pthread_mutexattr_getkind_np)
 weak_alias (__pthread_mutexattr_getkind_np, pthread_mutexattr_getkind_np)
 
+int pthread_mutexattr_setspin_np(pthread_mutexattr_t *attr, int spin)
+{
+  if (spin < -1 || spin >= (INT_MAX >> MUTEXATTR_SPIN_SHIFT))
+    return EINVAL;
+  attr->__mutexkind = (attr->__mutexkind & ((1 << MUTEXATTR_SPIN_SHIFT) - 1))
+		      | ((spin + 1) << MUTEXATTR_SPIN_SHIFT);
+  return 0;
+}
+
+int pthread_mutexattr_getspin_np(const pthread_mutexattr_t *attr, int *spin)
+{
+  *spin = (attr->__mutexkind >> MUTEXATTR_SPIN_SHIFT) - 1;
+  return 0;
+}
+
+int pthread_mutex_getspinstats_np(unsigned long *acquired,
+				  unsigned long *suspended)
+{
+  *acquired = __pthread_spin_acquired;
+  *suspended = __pthread_spin_suspended;
+  return 0;
+}
+
 int __pthread_mutexattr_getpshared (const pthread_mutexattr_t *attr,
 				   int *pshared)
 {
-  *pshared = PTHREAD_PROCESS_PRIVATE;
+  *pshared = (attr->__mutexkind & MUTEXATTR_PSHARED
+	      ? PTHREAD_PROCESS_SHARED : PTHREAD_PROCESS_PRIVATE);
   return 0;
 }
 weak_alias (__pthread_mutexattr_getpshared, pthread_mutexattr_getpshared)
@@ -249,40 +514,78 @@ int __pthread_mutexattr_setpshared (pthread_mutexattr_t *attr, int pshared)
   if (pshared != PTHREAD_PROCESS_PRIVATE && pshared != PTHREAD_PROCESS_SHARED)
     return EINVAL;
 
-  /* For now it is not possible to shared a conditional variable.  */
-  if (pshared != PTHREAD_PROCESS_PRIVATE)
+  /* Process-shared mutexes are futex locks.  */
+  if (pshared != PTHREAD_PROCESS_PRIVATE && !__pthread_futex_mutexes)
     return ENOSYS;
 
+  if (pshared == PTHREAD_PROCESS_SHARED)
+    attr->__mutexkind |= MUTEXATTR_PSHARED;
+  else
+    attr->__mutexkind &= ~MUTEXATTR_PSHARED;
   return 0;
 }
 weak_alias (__pthread_mutexattr_setpshared, pthread_mutexattr_setpshared)
 
 /* Once-only execution */
 
+/* The state of a pthread_once_t is in its two low bits.  An object in
+   progress also holds the fork generation of the process running the
+   init routine, and bit 2 tells that threads may be waiting for it.
+   The state only changes under once_masterlock, which is held briefly.
+   With futexes, threads waiting for an object sleep on the object
+   itself, so finishing one wakes up only its own waiters.  Without
+   them, waiters sleep on once_finished. */
+
 static pthread_mutex_t once_masterlock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t once_finished = PTHREAD_COND_INITIALIZER;
 static int fork_generation = 0;	/* Child process increments this after fork. */
 
 enum { NEVER = 0, IN_PROGRESS = 1, DONE = 2 };
 
+#define ONCE_STATE_MASK	3
+#define ONCE_WAITERS	4
+#define ONCE_GEN_MASK	(~7)
+#define ONCE_GEN_INC	8
+
+#ifdef __NR_futex
+#define once_futex() __pthread_futex_mutexes
+#else
+#define once_futex() 0
+#endif
+
+/* Set *ONCE_CONTROL to NEWVAL, which is NEVER or DONE, and wake up
+   whoever waits for it. */
+
+static void once_finish(pthread_once_t *once_control, int newval)
+{
+  int waiters;
+
+  pthread_mutex_lock(&once_masterlock);
+  waiters = *once_control & ONCE_WAITERS;
+  WRITE_MEMORY_BARRIER();
+  *once_control = newval;
+  pthread_mutex_unlock(&once_masterlock);
+
+  if (!once_futex())
+    pthread_cond_broadcast(&once_finished);
+#ifdef __NR_futex
+  else if (waiters)
+    __futex_wake(once_control, INT_MAX);
+#endif
+}
+
 /* If a thread is canceled while calling the init_routine out of
    pthread once, this handler will reset the once_control variable
    to the NEVER state. */
 
 static void pthread_once_cancelhandler(void *arg)
 {
-    pthread_once_t *once_control = arg;
-
-    pthread_mutex_lock(&once_masterlock);
-    *once_control = NEVER;
-    pthread_mutex_unlock(&once_masterlock);
-    pthread_cond_broadcast(&once_finished);
+    once_finish(arg, NEVER);
 }
 
 int __pthread_once(pthread_once_t * once_control, void (*init_routine)(void))
 {
-  /* flag for doing the condition broadcast outside of mutex */
-  int state_changed;
+  int val;
 
   /* Test without locking first for speed */
   if (*once_control == DONE) {
@@ -291,36 +594,43 @@ int __pthread_once(pthread_once_t * once_control, void (*init_routine)(void))
   }
   /* Lock and test again */
 
-  state_changed = 0;
-
   pthread_mutex_lock(&once_masterlock);
 
   /* If this object was left in an IN_PROGRESS state in a parent
      process (indicated by stale generation field), reset it to NEVER. */
-  if ((*once_control & 3) == IN_PROGRESS && (*once_control & ~3) != fork_generation)
+  if ((*once_control & ONCE_STATE_MASK) == IN_PROGRESS
+      && (*once_control & ONCE_GEN_MASK) != fork_generation)
     *once_control = NEVER;
 
   /* If init_routine is being called from another routine, wait until
      it completes. */
-  while ((*once_control & 3) == IN_PROGRESS) {
+  while ((*once_control & ONCE_STATE_MASK) == IN_PROGRESS) {
+#ifdef __NR_futex
+    if (once_futex()) {
+      /* Flag the object, then sleep on it until once_finish changes it. */
+      val = *once_control | ONCE_WAITERS;
+      *once_control = val;
+      pthread_mutex_unlock(&once_masterlock);
+      __futex_wait(once_control, val, NULL);
+      pthread_mutex_lock(&once_masterlock);
+      continue;
+    }
+#endif
     pthread_cond_wait(&once_finished, &once_masterlock);
   }
   /* Here *once_control is stable and either NEVER or DONE. */
-  if (*once_control == NEVER) {
+  val = *once_control;
+  if (val == NEVER)
     *once_control = IN_PROGRESS | fork_generation;
-    pthread_mutex_unlock(&once_masterlock);
+  pthread_mutex_unlock(&once_masterlock);
+
+  if (val == NEVER) {
     pthread_cleanup_push(pthread_once_cancelhandler, once_control);
     init_routine();
     pthread_cleanup_pop(0);
-    pthread_mutex_lock(&once_masterlock);
-    WRITE_MEMORY_BARRIER();
-    *once_control = DONE;
-    state_changed = 1;
-  }
-  pthread_mutex_unlock(&once_masterlock);
-
-  if (state_changed)
-    pthread_cond_broadcast(&once_finished);
+    once_finish(once_control, DONE);
+  } else
+    READ_MEMORY_BARRIER();
 
   return 0;
 }
@@ -333,7 +643,9 @@ strong_alias (__pthread_once, pthread_once)
  * fork, the lock is released. In the child, the lock and the condition
  * variable are simply reset.  The child also increments its generation
  * counter which lets pthread_once calls detect stale IN_PROGRESS states
- * and reset them back to NEVER.
+ * and reset them back to NEVER.  Threads of the parent sleeping on the
+ * futex of an object do not exist in the child, so the waiters bit such
+ * an object may carry goes with the stale state.
  */
 
 void __pthread_once_fork_prepare(void)
@@ -350,8 +662,8 @@ void __pthread_once_fork_child(void)
 {
   pthread_mutex_init(&once_masterlock, NULL);
   pthread_cond_init(&once_finished, NULL);
-  if (fork_generation <= INT_MAX - 4)
-    fork_generation += 4;	/* leave least significant two bits zero */
+  if (fork_generation <= INT_MAX - ONCE_GEN_INC)
+    fork_generation += ONCE_GEN_INC;	/* leave the state and waiters bits zero */
   else
     fork_generation = 0;
 }
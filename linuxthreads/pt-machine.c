@@ -20,6 +20,7 @@
 #define PT_EI
 
 extern long int testandset (int *spinlock);
+extern long int __spinlock_exchange (int *spinlock, int newval);
 extern int __compare_and_swap (long int *p, long int oldval, long int newval);
 
 #include <pt-machine.h>
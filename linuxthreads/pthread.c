@@ -16,6 +16,7 @@
 /* Thread creation, initialization, and basic low-level routines */
 
 #include <errno.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -93,7 +94,7 @@ struct _pthread_descr_struct __pthread_initial_thread = {
   0,                          /* char p_sigwaiting */
   PTHREAD_START_ARGS_INITIALIZER(NULL),
                               /* struct pthread_start_args p_start_args */
-  {NULL},                     /* void ** p_specific[PTHREAD_KEY_1STLEVEL_SIZE] */
+  {NULL},                     /* struct pthread_key_data * p_specific[] */
   {NULL},                     /* void * p_libc_specific[_LIBC_TSD_KEY_N] */
   &_errno,                    /* int *p_errnop */
   0,                          /* int p_errno */
@@ -153,7 +154,7 @@ struct _pthread_descr_struct __pthread_manager_thread = {
   0,                          /* char p_sigwaiting */
   PTHREAD_START_ARGS_INITIALIZER(__pthread_manager),
                               /* struct pthread_start_args p_start_args */
-  {NULL},                     /* void ** p_specific[PTHREAD_KEY_1STLEVEL_SIZE] */
+  {NULL},                     /* struct pthread_key_data * p_specific[] */
   {NULL},                     /* void * p_libc_specific[_LIBC_TSD_KEY_N] */
   &__pthread_manager_thread.p_errno, /* int *p_errnop */
   0,                          /* int p_errno */
@@ -217,15 +218,31 @@ size_t __pthread_max_stacksize;
 /* Nozero if the machine has more than one processor.  */
 int __pthread_smp_kernel;
 
+/* Nonzero if mutexes are futex words instead of fastlocks (see mutex.c).
+   This needs both the futex system call and compare-and-swap.  */
+int __pthread_futex_mutexes;
+
+/* Nonzero if pthread_cond_signal called by the owner of the mutex defers
+   the wakeup until the mutex is released (see condvar.c).  */
+int __pthread_cond_defer;
 
-#if !__ASSUME_REALTIME_SIGNALS
-/* Pointers that select new or old suspend/resume functions
-   based on availability of rt signals. */
 
+#ifdef __PTHREAD_SUSPEND_DYNAMIC
+/* Pointers that select new, old or futex suspend/resume functions
+   based on availability of rt signals and futexes. */
+
+# if !__ASSUME_REALTIME_SIGNALS
 void (*__pthread_restart)(pthread_descr) = __pthread_restart_old;
 void (*__pthread_suspend)(pthread_descr) = __pthread_suspend_old;
-int (*__pthread_timedsuspend)(pthread_descr, const struct timespec *) = __pthread_timedsuspend_old;
-#endif	/* __ASSUME_REALTIME_SIGNALS */
+int (*__pthread_timedsuspend)(pthread_descr, clockid_t,
+			      const struct timespec *) = __pthread_timedsuspend_old;
+# else
+void (*__pthread_restart)(pthread_descr) = __pthread_restart_new;
+void (*__pthread_suspend)(pthread_descr) = __pthread_wait_for_restart_signal;
+int (*__pthread_timedsuspend)(pthread_descr, clockid_t,
+			      const struct timespec *) = __pthread_timedsuspend_new;
+# endif
+#endif	/* __PTHREAD_SUSPEND_DYNAMIC */
 
 /* Communicate relevant LinuxThreads constants to gdb */
 
@@ -303,7 +320,7 @@ init_rtsigs (void)
     {
 #if __SIGRTMAX - __SIGRTMIN >= 3
       current_rtmin = __SIGRTMIN + 3;
-# if !__ASSUME_REALTIME_SIGNALS
+# if !__ASSUME_REALTIME_SIGNALS && defined __PTHREAD_SUSPEND_DYNAMIC
       __pthread_restart = __pthread_restart_new;
       __pthread_suspend = __pthread_wait_for_restart_signal;
       __pthread_timedsuspend = __pthread_timedsuspend_new;
@@ -319,6 +336,73 @@ init_rtsigs (void)
 }
 #endif
 
+#if defined __PTHREAD_SUSPEND_DYNAMIC && defined __NR_futex
+/* Switch suspend/restart over to futexes if the running kernel has
+   them.  Waking up a futex nobody sleeps on is harmless and tells us
+   whether the system call is implemented.  */
+
+static void
+init_futex (void)
+{
+  int probe = 0;
+
+  if (__futex_wake (&probe, 1) == 0)
+    {
+      __pthread_futex_mutexes = 1;
+      __pthread_restart = __pthread_restart_futex;
+      __pthread_suspend = __pthread_suspend_futex;
+      __pthread_timedsuspend = __pthread_timedsuspend_futex;
+    }
+}
+#endif
+
+/* Read the tunables of the adaptive spinning of fastlocks and of the
+   condition variables from the environment:
+     LINUXTHREADS_SPIN_MAX    max number of spins (0 disables spinning)
+     LINUXTHREADS_SPIN_DECAY  inverse weight of the last lock in the
+                              average spin count of a lock
+     LINUXTHREADS_SPIN_OWNER  if nonzero, stop spinning on an adaptive
+                              mutex whose owner is suspended
+     LINUXTHREADS_WAIT_SPIN_MAX  max number of spins of the waiters of
+                              barriers and semaphores (0 disables
+                              spinning)
+     LINUXTHREADS_COND_DEFER  if nonzero, defer the wakeups of
+                              pthread_cond_signal until the mutex is
+                              released
+   They are ignored in setuid programs.  */
+
+static void
+init_tunables (void)
+{
+  const char *env;
+  long val;
+
+  if (__libc_enable_secure)
+    return;
+  if ((env = getenv ("LINUXTHREADS_SPIN_MAX")) != NULL)
+    {
+      val = strtol (env, NULL, 10);
+      if (val >= 0 && val <= INT_MAX)
+	__pthread_spin_max = val;
+    }
+  if ((env = getenv ("LINUXTHREADS_SPIN_DECAY")) != NULL)
+    {
+      val = strtol (env, NULL, 10);
+      if (val >= 1 && val <= INT_MAX)
+	__pthread_spin_decay = val;
+    }
+  if ((env = getenv ("LINUXTHREADS_SPIN_OWNER")) != NULL)
+    __pthread_spin_owner = strtol (env, NULL, 10) != 0;
+  if ((env = getenv ("LINUXTHREADS_WAIT_SPIN_MAX")) != NULL)
+    {
+      val = strtol (env, NULL, 10);
+      if (val >= 0 && val <= INT_MAX)
+	__pthread_wait_spin_max = val;
+    }
+  if ((env = getenv ("LINUXTHREADS_COND_DEFER")) != NULL)
+    __pthread_cond_defer = strtol (env, NULL, 10) != 0;
+}
+
 /* Return number of available real-time signal with highest priority.  */
 int
 __libc_current_sigrtmin (void)
@@ -536,6 +620,18 @@ static void pthread_initialize(void)
 #ifdef __SIGRTMIN
   /* Initialize real-time signals. */
   init_rtsigs ();
+#endif
+#if defined __PTHREAD_SUSPEND_DYNAMIC && defined __NR_futex
+  /* Prefer futexes over the restart signal for suspend/restart. */
+  init_futex ();
+#elif defined __PTHREAD_SUSPEND_FUTEX
+  __pthread_futex_mutexes = 1;
+#endif
+#if !defined HAS_COMPARE_AND_SWAP
+  __pthread_futex_mutexes = 0;
+#elif defined TEST_FOR_COMPARE_AND_SWAP
+  if (!__pthread_has_cas)
+    __pthread_futex_mutexes = 0;
 #endif
   /* Setup signal handlers for the initial thread.
      Since signal handlers are shared between threads, these settings
@@ -569,6 +665,7 @@ static void pthread_initialize(void)
     __on_exit (pthread_onexit_process, NULL);
   /* How many processors.  */
   __pthread_smp_kernel = is_smp_system ();
+  init_tunables ();
 }
 
 void __pthread_initialize(void)
@@ -1061,6 +1158,8 @@ void __pthread_reset_main_thread(void)
   __pthread_main_thread = self;
   THREAD_SETMEM(self, p_nextlive, self);
   THREAD_SETMEM(self, p_prevlive, self);
+  /* The threads whose wakeup we deferred are not in this process.  */
+  THREAD_SETMEM(self, p_condvar_deferred, NULL);
 #if !(USE_TLS && HAVE___THREAD)
   /* Now this thread modifies the global variables.  */
   THREAD_SETMEM(self, p_errnop, &_errno);
@@ -1140,6 +1239,93 @@ void __pthread_wait_for_restart_signal(pthread_descr self)
   READ_MEMORY_BARRIER(); /* See comment in __pthread_restart_new */
 }
 
+/* Timed suspension measures timeouts against an absolute deadline on
+   CLOCK_MONOTONIC, so that setting the time of day while a thread waits
+   neither shortens nor extends the wait.  A CLOCK_REALTIME timeout given
+   by the user is converted once, on entry; a CLOCK_MONOTONIC one, from a
+   condition variable set up with pthread_condattr_setclock, is used as
+   is.  On kernels without a monotonic clock the deadline stays on
+   CLOCK_REALTIME.  */
+
+/* Store the current time on CLOCK in *NOW.  Return zero if the clock is
+   not supported.  */
+
+int
+__pthread_clock_now (clockid_t clock, struct timespec *now)
+{
+  if (clock == CLOCK_REALTIME)
+    {
+      struct timeval tv;
+
+      __gettimeofday (&tv, NULL);
+      TIMEVAL_TO_TIMESPEC (&tv, now);
+      return 1;
+    }
+  else
+    {
+#ifdef __NR_clock_gettime
+      int saved_errno = errno;
+      int res = INLINE_SYSCALL (clock_gettime, 2, clock, now);
+
+      __set_errno (saved_errno);
+      return res == 0;
+#else
+      return 0;
+#endif
+    }
+}
+
+/* Convert the time ABSTIME on CLOCK, CLOCK_REALTIME or CLOCK_MONOTONIC,
+   to a deadline on the clock returned.  */
+
+static clockid_t
+pthread_deadline (clockid_t clock, const struct timespec *abstime,
+		  struct timespec *deadline)
+{
+  struct timespec mono, now;
+
+  if (clock == CLOCK_MONOTONIC
+      || ! __pthread_clock_now (CLOCK_MONOTONIC, &mono))
+    {
+      *deadline = *abstime;
+      return clock;
+    }
+  __pthread_clock_now (CLOCK_REALTIME, &now);
+  deadline->tv_sec = mono.tv_sec + (abstime->tv_sec - now.tv_sec);
+  deadline->tv_nsec = mono.tv_nsec + (abstime->tv_nsec - now.tv_nsec);
+  if (deadline->tv_nsec < 0)
+    {
+      deadline->tv_nsec += 1000000000;
+      deadline->tv_sec -= 1;
+    }
+  else if (deadline->tv_nsec >= 1000000000)
+    {
+      deadline->tv_nsec -= 1000000000;
+      deadline->tv_sec += 1;
+    }
+  return CLOCK_MONOTONIC;
+}
+
+/* Store in *RELTIME the time left until DEADLINE on CLOCK.  Return zero
+   if the deadline has passed.  */
+
+static int
+pthread_time_left (clockid_t clock, const struct timespec *deadline,
+		   struct timespec *reltime)
+{
+  struct timespec now;
+
+  __pthread_clock_now (clock, &now);
+  reltime->tv_sec = deadline->tv_sec - now.tv_sec;
+  reltime->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+  if (reltime->tv_nsec < 0)
+    {
+      reltime->tv_nsec += 1000000000;
+      reltime->tv_sec -= 1;
+    }
+  return reltime->tv_sec >= 0;
+}
+
 #if !__ASSUME_REALTIME_SIGNALS
 /* The _old variants are for 2.0 and early 2.1 kernels which don't have RT
    signals.
@@ -1161,9 +1347,11 @@ void __pthread_suspend_old(pthread_descr self)
 }
 
 int
-__pthread_timedsuspend_old(pthread_descr self, const struct timespec *abstime)
+__pthread_timedsuspend_old(pthread_descr self, clockid_t clock,
+			   const struct timespec *abstime)
 {
   sigset_t unblock, initial_mask;
+  struct timespec deadline;
   int was_signalled = 0;
   sigjmp_buf jmpbuf;
 
@@ -1179,22 +1367,14 @@ __pthread_timedsuspend_old(pthread_descr self, const struct timespec *abstime)
       sigaddset(&unblock, __pthread_sig_restart);
       sigprocmask(SIG_UNBLOCK, &unblock, &initial_mask);
 
+      clock = pthread_deadline(clock, abstime, &deadline);
       while (1) {
-	struct timeval now;
 	struct timespec reltime;
 
-	/* Compute a time offset relative to now.  */
-	__gettimeofday (&now, NULL);
-	reltime.tv_nsec = abstime->tv_nsec - now.tv_usec * 1000;
-	reltime.tv_sec = abstime->tv_sec - now.tv_sec;
-	if (reltime.tv_nsec < 0) {
-	  reltime.tv_nsec += 1000000000;
-	  reltime.tv_sec -= 1;
-	}
-
 	/* Sleep for the required duration. If woken by a signal,
 	   resume waiting as required by Single Unix Specification.  */
-	if (reltime.tv_sec < 0 || __libc_nanosleep(&reltime, NULL) == 0)
+	if (! pthread_time_left(clock, &deadline, &reltime)
+	    || __libc_nanosleep(&reltime, NULL) == 0)
 	  break;
       }
 
@@ -1251,61 +1431,178 @@ void __pthread_restart_new(pthread_descr th)
 /* There is no __pthread_suspend_new because it would just
    be a wasteful wrapper for __pthread_wait_for_restart_signal */
 
+/* The restart signal is blocked outside of sigsuspend, so we can simply
+   accept it with sigtimedwait: no signal handler, no siglongjmp and no
+   signal mask changes are involved.  Return 1 if a restart signal was
+   consumed, 0 if the deadline passed first.  In the latter case the
+   thread may still be restarted later, so the caller must remove itself
+   from whatever it was waiting on, and if that fails, suspend() again to
+   consume the restart. */
+
 int
-__pthread_timedsuspend_new(pthread_descr self, const struct timespec *abstime)
+__pthread_timedsuspend_new(pthread_descr self, clockid_t clock,
+			   const struct timespec *abstime)
 {
-  sigset_t unblock, initial_mask;
-  int was_signalled = 0;
-  sigjmp_buf jmpbuf;
+  struct timespec deadline, reltime;
+  sigset_t set;
+
+  clock = pthread_deadline(clock, abstime, &deadline);
+  sigemptyset(&set);
+  sigaddset(&set, __pthread_sig_restart);
+
+  while (1) {
+    int saved_errno, sig, expired;
+
+    /* Once the deadline has passed, just collect a pending restart. */
+    expired = ! pthread_time_left(clock, &deadline, &reltime);
+    if (expired)
+      reltime.tv_sec = reltime.tv_nsec = 0;
+
+    /* If woken by another signal, resume waiting as required by
+       Single Unix Specification.  */
+    saved_errno = errno;
+    sig = INLINE_SYSCALL (rt_sigtimedwait, 4, &set, NULL, &reltime,
+			  _NSIG / 8);
+    __set_errno (saved_errno);
+    if (sig == __pthread_sig_restart)
+      break;
+    if (expired)
+      return 0;
+  }
 
-  if (sigsetjmp(jmpbuf, 1) == 0) {
-    THREAD_SETMEM(self, p_signal_jmp, &jmpbuf);
-    THREAD_SETMEM(self, p_signal, 0);
-    /* Unblock the restart signal */
-    sigemptyset(&unblock);
-    sigaddset(&unblock, __pthread_sig_restart);
-    sigprocmask(SIG_UNBLOCK, &unblock, &initial_mask);
-
-    while (1) {
-      struct timeval now;
-      struct timespec reltime;
-
-      /* Compute a time offset relative to now.  */
-      __gettimeofday (&now, NULL);
-      reltime.tv_nsec = abstime->tv_nsec - now.tv_usec * 1000;
-      reltime.tv_sec = abstime->tv_sec - now.tv_sec;
-      if (reltime.tv_nsec < 0) {
-	reltime.tv_nsec += 1000000000;
-	reltime.tv_sec -= 1;
-      }
+  READ_MEMORY_BARRIER(); /* See comment in __pthread_restart_new */
+  return 1;
+}
+
+#ifdef __NR_futex
+/* The _futex variants are for kernels with the futex system call.
+   Like the _old variants they count restarts in p_resume_count, but the
+   sleeping thread waits on the counter itself instead of waiting for a
+   signal.  The counter is -1 exactly when the thread is blocked (or about
+   to block) with no restart pending; the restart that brings it back to 0
+   wakes it up, any other restart is simply recorded.  No signal masks are
+   touched and no restart can be lost or merged with another one. */
+
+#define RESUME_COUNT(th) (*(volatile long *) &(th)->p_resume_count.p_count)
+
+void __pthread_restart_futex(pthread_descr th)
+{
+  WRITE_MEMORY_BARRIER(); /* See comment in __pthread_restart_new */
+  if (atomic_increment(&th->p_resume_count) == -1)
+    __futex_wake(__futex_word(&th->p_resume_count.p_count), 1);
+}
+
+/* Like __pthread_restart_futex, but if TH is blocked, move it over to
+   the futex ADDR instead of waking it up: it comes back when a thread
+   sleeping on ADDR is woken up.  Used for wait morphing in
+   pthread_cond_broadcast.  */
 
-      /* Sleep for the required duration. If woken by a signal,
-	 resume waiting as required by Single Unix Specification.  */
-      if (reltime.tv_sec < 0 || __libc_nanosleep(&reltime, NULL) == 0)
+void __pthread_restart_requeue_futex(pthread_descr th, int *addr)
+{
+  int *word = __futex_word(&th->p_resume_count.p_count);
+
+  WRITE_MEMORY_BARRIER();
+  if (atomic_increment(&th->p_resume_count) == -1
+      && __futex_cmp_requeue(word, 0, 1, addr, 0) != 0)
+    /* The count moved on, or no FUTEX_CMP_REQUEUE: just wake it up.  */
+    __futex_wake(word, 1);
+}
+
+void __pthread_suspend_futex(pthread_descr self)
+{
+  if (atomic_decrement(&self->p_resume_count) <= 0) {
+    /* Spurious wakeups and signals just bring us back here. */
+    while (RESUME_COUNT(self) < 0)
+      __futex_wait(__futex_word(&self->p_resume_count.p_count), -1, NULL);
+  }
+  READ_MEMORY_BARRIER();
+}
+
+#ifdef __NR_clock_gettime
+/* Nonzero if the kernel does not support FUTEX_WAIT_BITSET. */
+static int futex_wait_abs_unsupported;
+#endif
+
+int
+__pthread_timedsuspend_futex(pthread_descr self, clockid_t clock,
+			     const struct timespec *abstime)
+{
+  struct timespec deadline, reltime;
+  int err;
+
+  if (atomic_decrement(&self->p_resume_count) > 0) {
+    READ_MEMORY_BARRIER();
+    return 1;
+  }
+
+  clock = pthread_deadline(clock, abstime, &deadline);
+  while (RESUME_COUNT(self) < 0) {
+    /* If woken by a signal, resume waiting as required by Single Unix
+       Specification.  */
+#ifdef __NR_clock_gettime
+    if (clock == CLOCK_MONOTONIC && !futex_wait_abs_unsupported) {
+      if (deadline.tv_sec < 0)
+	break;
+      err = __futex_wait_abs(__futex_word(&self->p_resume_count.p_count),
+			     -1, &deadline);
+      if (err == ETIMEDOUT)
 	break;
+      if (err == ENOSYS)
+	futex_wait_abs_unsupported = 1;
+      continue;
     }
-
-    /* Block the restart signal again */
-    sigprocmask(SIG_SETMASK, &initial_mask, NULL);
-    was_signalled = 0;
-  } else {
-    was_signalled = 1;
+#endif
+    if (! pthread_time_left(clock, &deadline, &reltime))
+      break;
+    __futex_wait(__futex_word(&self->p_resume_count.p_count), -1, &reltime);
   }
-  THREAD_SETMEM(self, p_signal_jmp, NULL);
 
-  /* Now was_signalled is true if we exited the above code
-     due to the delivery of a restart signal.  In that case,
-     everything is cool. We have been removed from whatever
-     we were waiting on by the other thread, and consumed its signal.
+  /* Either a restart brought the count back to zero, or we timed out.
+     In the latter case take back our decrement; if that fails, a restart
+     came in meanwhile and we have consumed it.  So 1 is returned if and
+     only if a restart was consumed.  When 0 is returned the count is
+     balanced, but the thread may still be restarted later and the caller
+     must resolve this as for the _new variant. */
+  if (RESUME_COUNT(self) < 0
+      && compare_and_swap(&self->p_resume_count.p_count, -1, 0,
+			  &self->p_resume_count.p_spinlock))
+    return 0;
+
+  READ_MEMORY_BARRIER();
+  return 1;
+}
 
-     Otherwise we this thread woke up spontaneously, or due to a signal other
-     than restart. This is an ambiguous case  that must be resolved by
-     the caller; the thread is still eligible for a restart wakeup
-     so there is a race. */
+#undef RESUME_COUNT
 
-  READ_MEMORY_BARRIER(); /* See comment in __pthread_restart_new */
-  return was_signalled;
+/* Sleep on the futex ADDR as long as it contains VAL, until the time
+   ABSTIME on CLOCK if ABSTIME is not NULL.  Return as __futex_wait.  */
+
+int
+__pthread_futex_wait_until(int *addr, int val, clockid_t clock,
+			   const struct timespec *abstime)
+{
+  struct timespec deadline, reltime;
+  int err;
+
+  if (abstime == NULL)
+    return __futex_wait(addr, val, NULL);
+
+  clock = pthread_deadline(clock, abstime, &deadline);
+#ifdef __NR_clock_gettime
+  if (clock == CLOCK_MONOTONIC && !futex_wait_abs_unsupported) {
+    if (deadline.tv_sec < 0)
+      return ETIMEDOUT;
+    err = __futex_wait_abs(addr, val, &deadline);
+    if (err != ENOSYS)
+      return err;
+    futex_wait_abs_unsupported = 1;
+  }
+#endif
+  if (! pthread_time_left(clock, &deadline, &reltime))
+    return ETIMEDOUT;
+  return __futex_wait(addr, val, &reltime);
 }
+#endif /* __NR_futex */
 
 
 /* Debugging aid */
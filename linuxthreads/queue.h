@@ -14,45 +14,160 @@
 
 /* Waiting queues */
 
-/* Waiting queues are represented by lists of thread descriptors
-   linked through their p_nextwaiting field.  The lists are kept
-   sorted by decreasing priority, and then decreasing waiting time. */
+#include <stddef.h>
 
-static inline void enqueue(pthread_descr * q, pthread_descr th)
+/* Wait queues are doubly linked lists of struct _pthread_wait_link,
+   kept sorted by decreasing priority, and then decreasing waiting time.
+   Consecutive links of equal priority form a run.  The first and the
+   last link of each run point to each other through wl_run (a run of
+   one link points to itself); the links inside a run have wl_run ==
+   NULL.  Insertion skips over whole runs, so it takes time proportional
+   to the number of distinct higher priorities in the queue, which is
+   constant if all waiters have the same priority.  Removal of any link,
+   and in particular of the first one, takes constant time.  */
+
+static inline void wait_link_insert(struct _pthread_wait_link ** q,
+				    struct _pthread_wait_link * wl, int prio)
 {
-  int prio = th->p_priority;
-  ASSERT(th->p_nextwaiting == NULL);
-  for (; *q != NULL; q = &((*q)->p_nextwaiting)) {
-    if (prio > (*q)->p_priority) {
-      th->p_nextwaiting = *q;
-      *q = th;
-      return;
-    }
+  struct _pthread_wait_link *run, *prev, *tail;
+
+  wl->wl_prio = prio;
+  prev = NULL;
+  for (run = *q; run != NULL && run->wl_prio > prio; run = prev->wl_next)
+    prev = run->wl_run;
+
+  if (run != NULL && run->wl_prio == prio) {
+    /* Append to the end of the run of our priority. */
+    tail = run->wl_run;
+    wl->wl_prev = tail;
+    wl->wl_next = tail->wl_next;
+    if (wl->wl_next != NULL)
+      wl->wl_next->wl_prev = wl;
+    tail->wl_next = wl;
+    if (tail != run)
+      tail->wl_run = NULL;
+    run->wl_run = wl;
+    wl->wl_run = run;
+  } else {
+    /* Start a new run in front of the first lower priority run. */
+    wl->wl_prev = prev;
+    wl->wl_next = run;
+    if (run != NULL)
+      run->wl_prev = wl;
+    if (prev != NULL)
+      prev->wl_next = wl;
+    else
+      *q = wl;
+    wl->wl_run = wl;
+  }
+}
+
+static inline void wait_link_remove(struct _pthread_wait_link ** q,
+				    struct _pthread_wait_link * wl)
+{
+  struct _pthread_wait_link *next = wl->wl_next, *prev = wl->wl_prev;
+  struct _pthread_wait_link *other = wl->wl_run, *heir;
+
+  /* If WL ends a run of several links, its neighbour inside the run
+     takes over that end. */
+  if (other != NULL && other != wl) {
+    if (prev == NULL || prev->wl_prio != wl->wl_prio)
+      heir = next;
+    else
+      heir = prev;
+    heir->wl_run = other;
+    other->wl_run = heir;
   }
-  *q = th;
+
+  if (prev != NULL)
+    prev->wl_next = next;
+  else
+    *q = next;
+  if (next != NULL)
+    next->wl_prev = prev;
+  wl->wl_next = wl->wl_prev = wl->wl_run = NULL;
+}
+
+static inline struct _pthread_wait_link *
+wait_link_first(struct _pthread_wait_link ** q)
+{
+  struct _pthread_wait_link *wl = *q;
+  if (wl != NULL)
+    wait_link_remove(q, wl);
+  return wl;
+}
+
+/* The waiting queues of condition variables, semaphores, read-write
+   locks and barriers are wait queues of the p_waitlink field of thread
+   descriptors.  The queue head in the object points to the descriptor
+   of the first thread, and p_waitqueue records which queue a thread is
+   on. */
+
+#define queue_thread(wl) \
+  ((pthread_descr) ((char *) (wl) \
+		    - offsetof(struct _pthread_descr_struct, p_waitlink)))
+
+static inline struct _pthread_wait_link * queue_head(pthread_descr * q)
+{
+  return *q != NULL ? &(*q)->p_waitlink : NULL;
+}
+
+static inline void queue_set_head(pthread_descr * q,
+				  struct _pthread_wait_link * wl)
+{
+  *q = wl != NULL ? queue_thread(wl) : NULL;
+}
+
+static inline void enqueue(pthread_descr * q, pthread_descr th)
+{
+  struct _pthread_wait_link *head = queue_head(q);
+  ASSERT(th->p_waitqueue == NULL);
+  wait_link_insert(&head, &th->p_waitlink, th->p_priority);
+  queue_set_head(q, head);
+  th->p_waitqueue = q;
 }
 
 static inline pthread_descr dequeue(pthread_descr * q)
 {
+  struct _pthread_wait_link *head = queue_head(q);
   pthread_descr th;
-  th = *q;
-  if (th != NULL) {
-    *q = th->p_nextwaiting;
-    th->p_nextwaiting = NULL;
-  }
+
+  if (head == NULL)
+    return NULL;
+  th = queue_thread(head);
+  wait_link_remove(&head, &th->p_waitlink);
+  queue_set_head(q, head);
+  th->p_waitqueue = NULL;
   return th;
 }
 
 static inline int remove_from_queue(pthread_descr * q, pthread_descr th)
 {
-  for (; *q != NULL; q = &((*q)->p_nextwaiting)) {
-    if (*q == th) {
-      *q = th->p_nextwaiting;
-      th->p_nextwaiting = NULL;
-      return 1;
-    }
+  struct _pthread_wait_link *head;
+
+  if (th->p_waitqueue != q)
+    return 0;
+  head = queue_head(q);
+  wait_link_remove(&head, &th->p_waitlink);
+  queue_set_head(q, head);
+  th->p_waitqueue = NULL;
+  return 1;
+}
+
+/* Move all threads waiting on queue FROM to the empty queue TO. */
+
+static inline void queue_move(pthread_descr * to, pthread_descr * from)
+{
+  pthread_descr th;
+  struct _pthread_wait_link *wl;
+
+  ASSERT(*to == NULL);
+  *to = *from;
+  *from = NULL;
+  for (wl = queue_head(to); wl != NULL; wl = wl->wl_next) {
+    th = queue_thread(wl);
+    th->p_waitqueue = to;
   }
-  return 0;
 }
 
 static inline int queue_is_empty(pthread_descr * q)
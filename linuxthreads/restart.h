@@ -14,36 +14,110 @@
 
 #include <signal.h>
 #include <kernel-features.h>
+#include "futex.h"
 
-/* Primitives for controlling thread execution */
+/* Primitives for controlling thread execution.
+   If the kernel is known to support futexes, threads sleep on a futex.
+   If futexes are not compiled in but RT signals are known to work, the
+   restart signal is used.  Otherwise pthread_initialize picks the best
+   implementation at run time and we go through function pointers.  */
+
+#if __ASSUME_FUTEX && defined __NR_futex
+# define __PTHREAD_SUSPEND_FUTEX	1
+#elif __ASSUME_REALTIME_SIGNALS && !defined __NR_futex
+# define __PTHREAD_SUSPEND_RTSIG	1
+#else
+# define __PTHREAD_SUSPEND_DYNAMIC	1
+#endif
 
 static inline void restart(pthread_descr th)
 {
   /* See pthread.c */
-#if __ASSUME_REALTIME_SIGNALS
+#if defined __PTHREAD_SUSPEND_FUTEX
+  __pthread_restart_futex(th);
+#elif defined __PTHREAD_SUSPEND_RTSIG
   __pthread_restart_new(th);
 #else
   __pthread_restart(th);
 #endif
 }
 
+/* Publish in the thread handle whether the thread is suspended, so that
+   threads spinning on an adaptive mutex it holds can give up early.
+   Only needed while __pthread_spin_owner is set. */
+
+static inline void set_suspended(pthread_descr self, int suspended)
+{
+  if (__pthread_spin_owner)
+    __pthread_handles[THREAD_GETMEM(self, p_nr)].h_suspended = suspended;
+}
+
 static inline void suspend(pthread_descr self)
 {
+  set_suspended(self, 1);
   /* See pthread.c */
-#if __ASSUME_REALTIME_SIGNALS
+#if defined __PTHREAD_SUSPEND_FUTEX
+  __pthread_suspend_futex(self);
+#elif defined __PTHREAD_SUSPEND_RTSIG
   __pthread_wait_for_restart_signal(self);
 #else
   __pthread_suspend(self);
 #endif
+  set_suspended(self, 0);
 }
 
-static inline int timedsuspend(pthread_descr self,
+/* Suspend until restarted or until ABSTIME on CLOCK, CLOCK_REALTIME or
+   CLOCK_MONOTONIC.  */
+
+static inline int timedsuspend_clock(pthread_descr self, clockid_t clock,
 		const struct timespec *abstime)
 {
+  int res;
+
+  set_suspended(self, 1);
   /* See pthread.c */
-#if __ASSUME_REALTIME_SIGNALS
-  return __pthread_timedsuspend_new(self, abstime);
+#if defined __PTHREAD_SUSPEND_FUTEX
+  res = __pthread_timedsuspend_futex(self, clock, abstime);
+#elif defined __PTHREAD_SUSPEND_RTSIG
+  res = __pthread_timedsuspend_new(self, clock, abstime);
+#else
+  res = __pthread_timedsuspend(self, clock, abstime);
+#endif
+  set_suspended(self, 0);
+  return res;
+}
+
+static inline int timedsuspend(pthread_descr self,
+		const struct timespec *abstime)
+{
+  return timedsuspend_clock(self, CLOCK_REALTIME, abstime);
+}
+
+/* Spin up to MAX_COUNT times waiting for a restart before calling
+   suspend.  Only the futex implementation counts a restart sent to a
+   thread which is not suspended yet, so that it can be seen without
+   entering the kernel; the others do not spin at all.  Return the number
+   of spins done, MAX_COUNT if the restart did not come, or -1 if the
+   thread did not spin.  */
+
+static inline int restart_spin(pthread_descr self, int max_count)
+{
+#if defined __PTHREAD_SUSPEND_RTSIG || !defined __NR_futex
+  return -1;
 #else
-  return __pthread_timedsuspend(self, abstime);
+  int spin_count;
+
+# if defined __PTHREAD_SUSPEND_DYNAMIC
+  if (__pthread_suspend != __pthread_suspend_futex)
+    return -1;
+# endif
+  for (spin_count = 0; spin_count < max_count; spin_count++) {
+    if (*(volatile long *) &self->p_resume_count.p_count > 0)
+      break;
+# ifdef BUSY_WAIT_NOP
+    BUSY_WAIT_NOP;
+# endif
+  }
+  return spin_count;
 #endif
 }
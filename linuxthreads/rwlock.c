@@ -21,7 +21,9 @@
 
 #include <bits/libc-lock.h>
 #include <errno.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include "internals.h"
 #include "queue.h"
@@ -55,85 +57,584 @@ static int rwlock_wr_extricate_func(void *obj, pthread_descr th)
   return did_remove;
 }
 
+/* A process-shared rwlock cannot queue thread descriptors.  Its
+   __rw_lock is a futex lock, its __rw_writer holds the pid of the writer
+   and the waiting threads sleep on futex words: __rw_read_waiting holds
+   a sequence number for the readers, above a bit telling whether there
+   are any, and __rw_write_waiting one for the writers, above the number
+   of waiting writers.  The unlocking thread bumps the sequence number of
+   the threads it lets in before waking them up.  */
+
+#define RWLOCK_READERS_WAITING	1
+#define RWLOCK_RD_SEQ_INC	2
+#define RWLOCK_WRITERS_MASK	0xffff
+#define RWLOCK_WR_SEQ_INC	0x10000
+#define RWLOCK_SEQ_MASK		0x3fffffffL
+
+/* The kind of the rwlock is in the low RWLOCK_KIND_BITS bits of
+   __rw_kind, and the bias of the reader slots above them (see below).  */
+
+#define RWLOCK_KIND_BITS	8
+
+#ifndef RWLOCK_RBIAS_INHIBIT
+#define RWLOCK_RBIAS_INHIBIT	256
+#endif
+#define RWLOCK_RBIAS_UNDRAINED	(-RWLOCK_RBIAS_INHIBIT - 1)
+
+#define rwlock_kind(rwlock) \
+  ((rwlock)->__rw_kind & ((1 << RWLOCK_KIND_BITS) - 1))
+#define rwlock_rbias(rwlock) ((rwlock)->__rw_kind >> RWLOCK_KIND_BITS)
+#define rwlock_set_rbias(rwlock, bias) \
+  ((rwlock)->__rw_kind = rwlock_kind (rwlock)				      \
+			 | (int) ((unsigned int) (bias) << RWLOCK_KIND_BITS))
+#define rwlock_pshared(rwlock) \
+  ((rwlock)->__rw_pshared == PTHREAD_PROCESS_SHARED)
+#define rwlock_scalable(rwlock) \
+  (rwlock_kind (rwlock) == PTHREAD_RWLOCK_PREFER_READER_SCALABLE_NP)
+#define rwlock_prefer_reader(rwlock) \
+  (rwlock_kind (rwlock) == PTHREAD_RWLOCK_PREFER_READER_NP \
+   || rwlock_scalable (rwlock))
+#define rwlock_rd_word(rwlock) ((long) (rwlock)->__rw_read_waiting)
+#define rwlock_wr_word(rwlock) ((long) (rwlock)->__rw_write_waiting)
+#define rwlock_rd_futex(rwlock) ((long *) &(rwlock)->__rw_read_waiting)
+#define rwlock_wr_futex(rwlock) ((long *) &(rwlock)->__rw_write_waiting)
+
+/* __rw_readers holds the number of readers times RWLOCK_READER, the
+   RWLOCK_WRITER bit while __rw_writer is set, and the RWLOCK_SLOW bit.
+   While RWLOCK_SLOW is clear, a reader takes and releases a private
+   rwlock with a single compare-and-swap on __rw_readers, without taking
+   the internal lock.  Taking the internal lock sets RWLOCK_SLOW, which
+   sends these readers the slow way and leaves __rw_readers to the holder
+   of the internal lock.  Releasing it clears RWLOCK_SLOW again unless
+   threads are queued on the rwlock, which the last reader must then
+   wake up.  RWLOCK_SLOW is always set on process-shared rwlocks, and
+   the fast path is not used where compare-and-swap is not available.  */
+
+#define RWLOCK_SLOW		1
+#define RWLOCK_WRITER		2
+#define RWLOCK_READER		4
+
+#define rwlock_nr_readers(rwlock) ((rwlock)->__rw_readers / RWLOCK_READER)
+
+static inline int
+rwlock_has_cas (void)
+{
+#if defined TEST_FOR_COMPARE_AND_SWAP
+  return __pthread_has_cas;
+#elif defined HAS_COMPARE_AND_SWAP
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+static inline void
+rwlock_lock (pthread_rwlock_t *rwlock, pthread_descr self)
+{
+#if defined HAS_COMPARE_AND_SWAP
+  long oldval;
+#endif
+
+  if (rwlock_pshared (rwlock))
+    {
+      __pthread_futex_lock (&rwlock->__rw_lock, NULL);
+      return;
+    }
+  __pthread_lock (&rwlock->__rw_lock, self);
+#if defined HAS_COMPARE_AND_SWAP
+  if (rwlock_has_cas ())
+    do
+      oldval = rwlock->__rw_readers;
+    while (!(oldval & RWLOCK_SLOW)
+	   && !__compare_and_swap (&rwlock->__rw_readers, oldval,
+				   oldval | RWLOCK_SLOW));
+#endif
+}
+
+static inline void
+rwlock_unlock (pthread_rwlock_t *rwlock)
+{
+  if (rwlock_pshared (rwlock))
+    {
+      __pthread_futex_unlock (&rwlock->__rw_lock);
+      return;
+    }
+  if (rwlock_has_cas ()
+      && queue_is_empty (&rwlock->__rw_read_waiting)
+      && queue_is_empty (&rwlock->__rw_write_waiting))
+    {
+      WRITE_MEMORY_BARRIER ();
+      rwlock->__rw_readers &= ~RWLOCK_SLOW;
+    }
+  __pthread_unlock (&rwlock->__rw_lock);
+}
+
+/* Take or release a read lock of RWLOCK without the internal lock.
+   Return 1 if done.  */
+
+static inline int
+rwlock_fast_rdlock (pthread_rwlock_t *rwlock)
+{
+#if defined HAS_COMPARE_AND_SWAP
+  long oldval;
+
+  /* Readers of a scalable rwlock turned away from the slots take the
+     internal lock, to count down to their return (see below).  */
+  if (!rwlock_has_cas ()
+      || (rwlock_scalable (rwlock) && rwlock_rbias (rwlock) <= 0))
+    return 0;
+  do
+    {
+      oldval = rwlock->__rw_readers;
+      if (oldval & (RWLOCK_SLOW | RWLOCK_WRITER))
+	return 0;
+    }
+  while (!__compare_and_swap (&rwlock->__rw_readers, oldval,
+			      oldval + RWLOCK_READER));
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+static inline int
+rwlock_fast_rdunlock (pthread_rwlock_t *rwlock)
+{
+#if defined HAS_COMPARE_AND_SWAP
+  long oldval;
+
+  if (!rwlock_has_cas ())
+    return 0;
+  do
+    {
+      oldval = rwlock->__rw_readers;
+      if ((oldval & (RWLOCK_SLOW | RWLOCK_WRITER)) || oldval == 0)
+	return 0;
+    }
+  while (!__compare_and_swap_with_release_semantics (&rwlock->__rw_readers,
+						     oldval,
+						     oldval - RWLOCK_READER));
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+/* Set or clear the writer of RWLOCK, whose internal lock is held.  */
+
+static inline void
+rwlock_set_writer (pthread_rwlock_t *rwlock, pthread_descr writer)
+{
+  rwlock->__rw_writer = writer;
+  if (writer != NULL)
+    rwlock->__rw_readers |= RWLOCK_WRITER;
+  else
+    rwlock->__rw_readers &= ~RWLOCK_WRITER;
+}
+
+/* Value of __rw_writer for the calling thread.  */
+
+static inline pthread_descr
+rwlock_owner_id (pthread_rwlock_t *rwlock, pthread_descr self)
+{
+  if (rwlock_pshared (rwlock))
+    return (pthread_descr) (long) THREAD_GETMEM (self, p_pid);
+  return self;
+}
+
+static inline int
+rwlock_writers_waiting (pthread_rwlock_t *rwlock)
+{
+  if (rwlock_pshared (rwlock))
+    return (rwlock_wr_word (rwlock) & RWLOCK_WRITERS_MASK) != 0;
+  return !queue_is_empty (&rwlock->__rw_write_waiting);
+}
+
+/* Sleep on a process-shared rwlock as a reader or as a writer, until
+   woken up by rwlock_pshared_wake or until ABSTIME if it is not NULL.
+   The internal lock is held on entry and on return.  Return 0 or
+   ETIMEDOUT.  */
+
+static int
+rwlock_pshared_rdwait (pthread_rwlock_t *rwlock,
+		       const struct timespec *abstime)
+{
+  long val = rwlock_rd_word (rwlock) | RWLOCK_READERS_WAITING;
+  int err;
+
+  rwlock->__rw_read_waiting = (pthread_descr) val;
+  __pthread_futex_unlock (&rwlock->__rw_lock);
+  err = __pthread_futex_sleep (rwlock_rd_futex (rwlock), val,
+			       CLOCK_REALTIME, abstime);
+  __pthread_futex_lock (&rwlock->__rw_lock, NULL);
+  return err == ETIMEDOUT ? ETIMEDOUT : 0;
+}
+
+static int
+rwlock_pshared_wrwait (pthread_rwlock_t *rwlock,
+		       const struct timespec *abstime)
+{
+  long val = rwlock_wr_word (rwlock) + 1;
+  int err;
+
+  rwlock->__rw_write_waiting = (pthread_descr) val;
+  __pthread_futex_unlock (&rwlock->__rw_lock);
+  err = __pthread_futex_sleep (rwlock_wr_futex (rwlock), val,
+			       CLOCK_REALTIME, abstime);
+  __pthread_futex_lock (&rwlock->__rw_lock, NULL);
+  rwlock->__rw_write_waiting = (pthread_descr) (rwlock_wr_word (rwlock) - 1);
+  return err == ETIMEDOUT ? ETIMEDOUT : 0;
+}
+
+/* Release the internal lock of a process-shared rwlock which is not
+   write locked any more, or whose last waiting writer gave up, and let
+   in the threads which can take it: all the waiting readers, or one
+   waiting writer if it is free, with the same preferences as
+   pthread_rwlock_unlock.  */
+
+static void
+rwlock_pshared_wake (pthread_rwlock_t *rwlock)
+{
+  long rd = rwlock_rd_word (rwlock);
+  long wr = rwlock_wr_word (rwlock);
+  long *wake = NULL;
+  int nr = 0;
+
+  if (rwlock->__rw_writer == NULL)
+    {
+      if ((rd & RWLOCK_READERS_WAITING)
+	  && (rwlock_prefer_reader (rwlock)
+	      || (wr & RWLOCK_WRITERS_MASK) == 0))
+	{
+	  rd = ((rd + RWLOCK_RD_SEQ_INC) & RWLOCK_SEQ_MASK)
+	       & ~RWLOCK_READERS_WAITING;
+	  rwlock->__rw_read_waiting = (pthread_descr) rd;
+	  wake = rwlock_rd_futex (rwlock);
+	  nr = INT_MAX;
+	}
+      else if ((wr & RWLOCK_WRITERS_MASK) != 0
+	       && rwlock_nr_readers (rwlock) == 0)
+	{
+	  wr = (wr + RWLOCK_WR_SEQ_INC) & RWLOCK_SEQ_MASK;
+	  rwlock->__rw_write_waiting = (pthread_descr) wr;
+	  wake = rwlock_wr_futex (rwlock);
+	  nr = 1;
+	}
+    }
+  __pthread_futex_unlock (&rwlock->__rw_lock);
+  if (wake != NULL)
+    __pthread_futex_wakeup (wake, nr);
+}
+
+/* Readers of a PTHREAD_RWLOCK_PREFER_READER_SCALABLE_NP rwlock do not
+   touch it while they can.  They take it by claiming a slot of the global
+   rwlock_rslots table, picked from the address of the rwlock and the
+   handle number of the thread, so that threads reading the same rwlock
+   use slots on different cache lines.  This is only allowed while the
+   bias of the rwlock, kept in __rw_kind above its kind, is positive.  A
+   writer which finds the rwlock free but for them sets the bias to
+   RWLOCK_RBIAS_UNDRAINED and waits for the slots holding the rwlock to
+   be released before it takes it, so that their owners can still take
+   more read locks meanwhile.  The reader checks the bias after claiming
+   its slot, and goes the slow way if it finds it cleared.  The bias
+   stays at RWLOCK_RBIAS_UNDRAINED until a writer finds the slots free of
+   the rwlock with the internal lock held, so that a writer which gives
+   up waiting for them, or comes meanwhile, does not leave the next one
+   to take the rwlock from under the readers.  Only then it becomes
+   -RWLOCK_RBIAS_INHIBIT, and each read lock taken the slow way brings
+   the bias up by one, which lets the readers back into the slots after
+   RWLOCK_RBIAS_INHIBIT of them, so that writers which come often do not
+   have to scan the table every time.  A slot which is claimed already,
+   by another thread or for another rwlock, also sends the reader the
+   slow way.  Process-shared rwlocks never use the slots, which are
+   private to the process.
+
+   A writer waiting for a slot spins for a while, then sets the
+   RWLOCK_RSLOT_WAITER bit of the slot, never set in the address of an
+   rwlock, and sleeps on it with the futex system call.  The owner of the
+   slot finds the bit when it releases it, and wakes the writer up.  */
+
+#ifndef RWLOCK_RSLOTS
+#define RWLOCK_RSLOTS		2048	/* Must be a power of 2 */
+#endif
+#define RWLOCK_RSLOT_STRIDE	4	/* Slots in a cache line */
+#define RWLOCK_RSLOT_WAITER	1
+
+struct rwlock_rslot
+{
+  long rs_lock;			/* Address of the rwlock, or 0 */
+  pthread_descr rs_owner;	/* Thread which claimed the slot */
+};
+
+static struct rwlock_rslot rwlock_rslots[RWLOCK_RSLOTS];
+static int rwlock_rslots_spinlock = __LT_SPINLOCK_INIT;
+
+static inline struct rwlock_rslot *
+rwlock_rslot (pthread_rwlock_t *rwlock, pthread_descr self)
+{
+  unsigned long hash = (unsigned long) rwlock;
+
+  hash = (hash >> 4) ^ (hash >> 12);
+  hash += THREAD_GETMEM (self, p_nr) * RWLOCK_RSLOT_STRIDE;
+  return &rwlock_rslots[hash & (RWLOCK_RSLOTS - 1)];
+}
+
+#define rwlock_rslot_holds(slot, rwlock) \
+  (((slot)->rs_lock & ~RWLOCK_RSLOT_WAITER) == (long) (rwlock))
+
+/* Release SLOT, claimed for RWLOCK, and wake up the writers waiting for
+   it, if any.  Only the owner clears RWLOCK_RSLOT_WAITER.  */
+
+static inline void
+rwlock_rslot_release (struct rwlock_rslot *slot, pthread_rwlock_t *rwlock)
+{
+  WRITE_MEMORY_BARRIER ();
+  if (compare_and_swap (&slot->rs_lock, (long) rwlock, 0,
+			&rwlock_rslots_spinlock))
+    return;
+  slot->rs_lock = 0;
+  __pthread_futex_wakeup (&slot->rs_lock, INT_MAX);
+}
+
+/* Try to read lock RWLOCK through the slot of the calling thread, whose
+   descriptor *PSELF is looked up if NULL.  Return 1 if done.  */
+
+static inline int
+rwlock_rslot_rdlock (pthread_rwlock_t *rwlock, pthread_descr *pself)
+{
+  struct rwlock_rslot *slot;
+  pthread_descr self;
+
+  if (rwlock_rbias (rwlock) <= 0)
+    return 0;
+  if (*pself == NULL)
+    *pself = thread_self ();
+  self = *pself;
+  slot = rwlock_rslot (rwlock, self);
+  if (slot->rs_lock != 0
+      || ! compare_and_swap (&slot->rs_lock, 0, (long) rwlock,
+			     &rwlock_rslots_spinlock))
+    return 0;
+  /* The compare-and-swap orders the claim before this check.  */
+  MEMORY_BARRIER ();
+  if (__builtin_expect (rwlock_rbias (rwlock) <= 0, 0))
+    {
+      /* A writer came in.  */
+      rwlock_rslot_release (slot, rwlock);
+      return 0;
+    }
+  slot->rs_owner = self;
+  return 1;
+}
+
+/* Release the read lock SELF holds on RWLOCK through its slot, if any.
+   Return 1 if done.  Another thread may have claimed the same slot for
+   the same rwlock, hence the check of the owner.  */
+
+static inline int
+rwlock_rslot_unlock (pthread_rwlock_t *rwlock, pthread_descr self)
+{
+  struct rwlock_rslot *slot = rwlock_rslot (rwlock, self);
+
+  if (!rwlock_rslot_holds (slot, rwlock) || slot->rs_owner != self)
+    return 0;
+  slot->rs_owner = NULL;
+  rwlock_rslot_release (slot, rwlock);
+  return 1;
+}
+
+/* Account for a read lock of RWLOCK taken the slow way.  The internal
+   lock is held.  */
+
+static inline void
+rwlock_rbias_slow_rdlock (pthread_rwlock_t *rwlock)
+{
+  if (rwlock_scalable (rwlock) && rwlock_rbias (rwlock) <= 0
+      && rwlock_rbias (rwlock) != RWLOCK_RBIAS_UNDRAINED
+      && !rwlock_pshared (rwlock))
+    rwlock_set_rbias (rwlock, rwlock_rbias (rwlock) + 1);
+}
+
+/* Wait until no slot holds a read lock of RWLOCK, whose readers were
+   turned away from the slots.  Give up with EBUSY at the first one if
+   TRY is set, or with ETIMEDOUT once ABSTIME has passed, if not NULL.
+   Releasing and taking the internal lock since the bias was cleared
+   was a full barrier on the architectures where MEMORY_BARRIER is not,
+   so the readers see the bias cleared or we see their slots.  */
+
+static int
+rwlock_rslot_drain (pthread_rwlock_t *rwlock, int try,
+		    const struct timespec *abstime)
+{
+  struct rwlock_rslot *slot;
+  struct timespec now;
+  long val;
+  int spins;
+
+  MEMORY_BARRIER ();
+  for (slot = rwlock_rslots; slot < &rwlock_rslots[RWLOCK_RSLOTS]; ++slot)
+    for (spins = 0;
+	 ((val = slot->rs_lock) & ~RWLOCK_RSLOT_WAITER) == (long) rwlock;
+	 ++spins)
+      {
+	if (try)
+	  return EBUSY;
+	if (spins < SPIN_PAUSE_COUNT)
+	  {
+	    READ_MEMORY_BARRIER ();
+	    continue;
+	  }
+	if (abstime != NULL)
+	  {
+	    __pthread_clock_now (CLOCK_REALTIME, &now);
+	    if (now.tv_sec > abstime->tv_sec
+		|| (now.tv_sec == abstime->tv_sec
+		    && now.tv_nsec >= abstime->tv_nsec))
+	      return ETIMEDOUT;
+	  }
+	if (!(val & RWLOCK_RSLOT_WAITER)
+	    && !compare_and_swap (&slot->rs_lock, val,
+				  val | RWLOCK_RSLOT_WAITER,
+				  &rwlock_rslots_spinlock))
+	  continue;
+	/* Without futexes, poll the slot.  */
+	if (__pthread_futex_sleep (&slot->rs_lock, val | RWLOCK_RSLOT_WAITER,
+				   CLOCK_REALTIME, abstime) == ENOSYS)
+	  sched_yield ();
+      }
+  return 0;
+}
+
+/* Turn the readers of RWLOCK away from the slots.  The internal lock is
+   held, and RWLOCK is free but for them.  Return 1 if the slots may hold
+   read locks of RWLOCK, which the caller must then wait for with
+   rwlock_rslot_drain after releasing the internal lock, before looking
+   at RWLOCK again.  */
+
+static int
+rwlock_rbias_revoke (pthread_rwlock_t *rwlock)
+{
+  if (rwlock_rbias (rwlock) > 0)
+    {
+      rwlock_set_rbias (rwlock, RWLOCK_RBIAS_UNDRAINED);
+      return 1;
+    }
+  if (rwlock_rbias (rwlock) == RWLOCK_RBIAS_UNDRAINED)
+    {
+      if (rwlock_rslot_drain (rwlock, 1, NULL) != 0)
+	return 1;
+      rwlock_set_rbias (rwlock, -RWLOCK_RBIAS_INHIBIT);
+    }
+  return 0;
+}
+
+/*
+ * The read locks of writer-preferring rwlocks held by a thread are tracked
+ * in the open addressing hash table p_readlock_table of its descriptor,
+ * with linear probing.  Entries are removed by moving the entries behind
+ * them back, so that no deleted marker is needed and a lookup stops at
+ * the first free entry.  Looking up, adding and removing an entry all
+ * take at most PTHREAD_READLOCK_SLOTS probes.
+ */
+
+static inline unsigned int
+rwlock_readlock_hash(pthread_rwlock_t *rwlock)
+{
+  unsigned long addr = (unsigned long) rwlock;
+
+  return ((addr >> 3) ^ (addr >> 9)) & (PTHREAD_READLOCK_SLOTS - 1);
+}
+
 /*
  * Check whether the calling thread already owns one or more read locks on the
  * specified lock. If so, return a pointer to the read lock info structure
  * corresponding to that lock.
  */
-// 判断锁是否在当前线程的读锁列表中
+// 判断锁是否在当前线程的读锁表中
 static pthread_readlock_info *
-rwlock_is_in_list(pthread_descr self, pthread_rwlock_t *rwlock)
+rwlock_find_readlock(pthread_descr self, pthread_rwlock_t *rwlock)
 {
-  pthread_readlock_info *info;
+  pthread_readlock_info *table = self->p_readlock_table;
+  unsigned int i = rwlock_readlock_hash(rwlock);
+  int n;
 
-  for (info = THREAD_GETMEM (self, p_readlock_list); info != NULL;
-       info = info->pr_next)
+  for (n = 0; n < PTHREAD_READLOCK_SLOTS; n++)
     {
-      if (info->pr_lock == rwlock)
-	return info;
+      if (table[i].pr_lock == rwlock)
+	return &table[i];
+      if (table[i].pr_lock == NULL)
+	break;
+      i = (i + 1) & (PTHREAD_READLOCK_SLOTS - 1);
     }
 
   return NULL;
 }
 
 /*
- * Add a new lock to the thread's list of locks for which it has a read lock.
- * A new info node must be allocated for this, which is taken from the thread's
- * free list, or by calling malloc. If malloc fails, a null pointer is
- * returned. Otherwise the lock info structure is initialized and pushed
- * onto the thread's list.
+ * Add a new lock to the thread's table of locks for which it has a read
+ * lock, with a count of one.  If the table is full, a null pointer is
+ * returned.
  */
-// 把锁加入当前线程的读锁队列
+// 把锁加入当前线程的读锁表
 static pthread_readlock_info *
-rwlock_add_to_list(pthread_descr self, pthread_rwlock_t *rwlock)
+rwlock_add_readlock(pthread_descr self, pthread_rwlock_t *rwlock)
 {
-  pthread_readlock_info *info = THREAD_GETMEM (self, p_readlock_free);
-  // 有可用的读锁，更新头指针指向下一个读锁
-  if (info != NULL)
-    THREAD_SETMEM (self, p_readlock_free, info->pr_next);
-  else
-    // 否则申请一个新的读锁结构体
-    info = malloc(sizeof *info);
+  pthread_readlock_info *table = self->p_readlock_table;
+  unsigned int i = rwlock_readlock_hash(rwlock);
+  int n;
 
-  if (info == NULL)
-    return NULL;
-  // 头插法插入读锁队列
-  info->pr_lock_count = 1;
-  info->pr_lock = rwlock;
-  info->pr_next = THREAD_GETMEM (self, p_readlock_list);
-  THREAD_SETMEM (self, p_readlock_list, info);
+  for (n = 0; n < PTHREAD_READLOCK_SLOTS; n++)
+    {
+      if (table[i].pr_lock == NULL)
+	{
+	  table[i].pr_lock = rwlock;
+	  table[i].pr_lock_count = 1;
+	  return &table[i];
+	}
+      i = (i + 1) & (PTHREAD_READLOCK_SLOTS - 1);
+    }
 
-  return info;
+  return NULL;
 }
 
 /*
  * If the thread owns a read lock over the given pthread_rwlock_t,
- * and this read lock is tracked in the thread's lock list,
- * this function returns a pointer to the info node in that list.
- * It also decrements the lock count within that node, and if
- * it reaches zero, it removes the node from the list.
- * If nothing is found, it returns a null pointer.
+ * and this read lock is tracked in the thread's lock table,
+ * this function decrements the lock count of its entry, and if
+ * it reaches zero, it removes the entry from the table.
+ * It returns 1 if an entry was found, otherwise zero.
  */
-// 从队列里删除锁
-static pthread_readlock_info *
-rwlock_remove_from_list(pthread_descr self, pthread_rwlock_t *rwlock)
+// 从读锁表里删除锁
+static int
+rwlock_remove_readlock(pthread_descr self, pthread_rwlock_t *rwlock)
 {
-  pthread_readlock_info **pinfo;
+  pthread_readlock_info *table = self->p_readlock_table;
+  pthread_readlock_info *info = rwlock_find_readlock(self, rwlock);
+  unsigned int i, j, k;
+
+  if (info == NULL)
+    return 0;
+  // 支持嵌套获得锁
+  if (--info->pr_lock_count > 0)
+    return 1;
 
-  for (pinfo = &self->p_readlock_list; *pinfo != NULL; pinfo = &(*pinfo)->pr_next)
+  /* Move back the entries which cannot be found any more past the free
+     entry at I, up to the next free entry.  */
+  i = info - table;
+  for (j = (i + 1) & (PTHREAD_READLOCK_SLOTS - 1);
+       j != i && table[j].pr_lock != NULL;
+       j = (j + 1) & (PTHREAD_READLOCK_SLOTS - 1))
     {
-      if ((*pinfo)->pr_lock == rwlock)
-	{
-	  pthread_readlock_info *info = *pinfo;
-    // 支持嵌套获得锁
-	  if (--info->pr_lock_count == 0)
-      // 指向info节点的下一个节点，即删除info节点
-	    *pinfo = info->pr_next;
-	  return info;
-	}
+      k = rwlock_readlock_hash(table[j].pr_lock);
+      /* The entry at J stays if its home K lies cyclically in (I, J].  */
+      if (i < j ? (k > i && k <= j) : (k > i || k <= j))
+	continue;
+      table[i] = table[j];
+      i = j;
     }
+  table[i].pr_lock = NULL;
 
-  return NULL;
+  return 1;
 }
 
 /*
@@ -152,12 +653,12 @@ rwlock_can_rdlock(pthread_rwlock_t *rwlock, int have_lock_already)
 
   /* Lock prefers readers; get it. */
   // 没有写者，优先读者，则可以加写锁
-  if (rwlock->__rw_kind == PTHREAD_RWLOCK_PREFER_READER_NP)
+  if (rwlock_prefer_reader(rwlock))
     return 1;
 
   /* Lock prefers writers, but none are waiting. */
   // 没有写者也不是优先读者，但是优先写者，但是没却有等待写的线程，则可以加读锁
-  if (queue_is_empty(&rwlock->__rw_write_waiting))
+  if (!rwlock_writers_waiting(rwlock))
     return 1;
 
   /* Writers are waiting, but this thread already has a read lock */
@@ -178,48 +679,52 @@ rwlock_can_rdlock(pthread_rwlock_t *rwlock, int have_lock_already)
  * If the thread has any ``untracked read locks'' then it just assumes
  * that this lock is among them, just to be safe, and returns 1.
  *
- * Also, if it finds the thread's lock in the list, it sets the pointer
- * referenced by pexisting to refer to the list entry.
- *
- * If the thread has no untracked locks, and the lock is not found
- * in its list, then it is added to the list. If this fails,
- * then *pout_of_mem is set to 1.
+ * Also, if it finds the thread's lock in the table, it sets the pointer
+ * referenced by pexisting to refer to the table entry.
  */
 // 线程是否获得了某个读锁
 static int
 rwlock_have_already(pthread_descr *pself, pthread_rwlock_t *rwlock,
-    pthread_readlock_info **pexisting, int *pout_of_mem)
+    pthread_readlock_info **pexisting)
 {
   pthread_readlock_info *existing = NULL;
-  int out_of_mem = 0, have_lock_already = 0;
+  int have_lock_already = 0;
   pthread_descr self = *pself;
 
-  if (rwlock->__rw_kind == PTHREAD_RWLOCK_PREFER_WRITER_NP)
+  if (rwlock_kind (rwlock) == PTHREAD_RWLOCK_PREFER_WRITER_NP)
     {
       if (!self)
 	*pself = self = thread_self();
-      // 该锁是否在当前线程已经获得的读锁队列
-      existing = rwlock_is_in_list(self, rwlock);
-      // 非空说明已经在线程的读锁队列，返回1
+      // 该锁是否在当前线程已经获得的读锁表
+      existing = rwlock_find_readlock(self, rwlock);
+      // 非空说明已经在线程的读锁表，返回1
       if (existing != NULL
 	  || THREAD_GETMEM (self, p_untracked_readlock_count) > 0)
 	have_lock_already = 1;
-      else
-	{
-    // 否则加入读锁队列
-	  existing = rwlock_add_to_list(self, rwlock);
-    // 加入失败说明没有内存
-	  if (existing == NULL)
-	    out_of_mem = 1;
-	}
     }
-  // 是否加入失败
-  *pout_of_mem = out_of_mem;
   // 返回读锁的信息
   *pexisting = existing;
 
   return have_lock_already;
 }
+
+/* Account for a read lock SELF just took, with the results of
+   rwlock_have_already.  A new lock goes into the table of the thread,
+   or is left untracked if the table is full.  */
+
+static inline void
+rwlock_track_rdlock(pthread_descr self, pthread_rwlock_t *rwlock,
+    pthread_readlock_info *existing, int have_lock_already)
+{
+  if (rwlock_kind (rwlock) != PTHREAD_RWLOCK_PREFER_WRITER_NP)
+    return;
+  // 递归获得，加一，即获得了该读锁两次
+  if (existing != NULL)
+    ++existing->pr_lock_count;
+  else if (have_lock_already || rwlock_add_readlock(self, rwlock) == NULL)
+    ++self->p_untracked_readlock_count;
+}
+
 // 初始化读写锁
 int
 __pthread_rwlock_init (pthread_rwlock_t *rwlock,
@@ -241,6 +746,10 @@ __pthread_rwlock_init (pthread_rwlock_t *rwlock,
       rwlock->__rw_kind = attr->__lockkind;
       rwlock->__rw_pshared = attr->__pshared;
     }
+  /* The lock and wait words of a process-shared rwlock all start at
+     zero as well, but its readers never take the fast path.  */
+  if (rwlock_pshared (rwlock))
+    rwlock->__rw_readers = RWLOCK_SLOW;
 
   return 0;
 }
@@ -250,16 +759,20 @@ strong_alias (__pthread_rwlock_init, pthread_rwlock_init)
 int
 __pthread_rwlock_destroy (pthread_rwlock_t *rwlock)
 {
-  int readers;
+  long readers;
   _pthread_descr writer;
 
-  __pthread_lock (&rwlock->__rw_lock, NULL);
-  readers = rwlock->__rw_readers;
+  rwlock_lock (rwlock, NULL);
+  readers = rwlock_nr_readers (rwlock);
   writer = rwlock->__rw_writer;
-  __pthread_unlock (&rwlock->__rw_lock);
+  rwlock_unlock (rwlock);
   // 还有读写着则不能销毁
   if (readers > 0 || writer != NULL)
     return EBUSY;
+  if ((rwlock_rbias (rwlock) > 0
+       || rwlock_rbias (rwlock) == RWLOCK_RBIAS_UNDRAINED)
+      && rwlock_rslot_drain (rwlock, 1, NULL) != 0)
+    return EBUSY;
 
   return 0;
 }
@@ -270,38 +783,45 @@ __pthread_rwlock_rdlock (pthread_rwlock_t *rwlock)
 {
   pthread_descr self = NULL;
   pthread_readlock_info *existing;
-  int out_of_mem, have_lock_already;
+  int have_lock_already;
+
+  if (rwlock_rslot_rdlock (rwlock, &self))
+    return 0;
   // 当前线程是否已经获得了该读锁
-  have_lock_already = rwlock_have_already(&self, rwlock,
-					  &existing, &out_of_mem);
+  have_lock_already = rwlock_have_already(&self, rwlock, &existing);
 
   if (self == NULL)
     self = thread_self ();
+
+  if (rwlock_fast_rdlock (rwlock))
+    {
+      rwlock_track_rdlock (self, rwlock, existing, have_lock_already);
+      return 0;
+    }
   // 循环判断是否可以获取读锁了
   for (;;)
     {
-      __pthread_lock (&rwlock->__rw_lock, self);
+      rwlock_lock (rwlock, self);
       // 是否可以获得该读锁
       if (rwlock_can_rdlock(rwlock, have_lock_already))
 	break;
+      if (rwlock_pshared (rwlock))
+	{
+	  rwlock_pshared_rdwait (rwlock, NULL);
+	  rwlock_unlock (rwlock);
+	  continue;
+	}
       // 不能获得则加入等待获取读锁队列
       enqueue (&rwlock->__rw_read_waiting, self);
-      __pthread_unlock (&rwlock->__rw_lock);
+      rwlock_unlock (rwlock);
       // 挂起
       suspend (self); /* This is not a cancellation point */
     }
   // 可以获得该读锁则锁的读者加一
-  ++rwlock->__rw_readers;
-  __pthread_unlock (&rwlock->__rw_lock);
-  // have_lock_already为1说明exsiting非空,out_of_mem等于1说明exsiting是NULL
-  if (have_lock_already || out_of_mem)
-    { 
-      // 递归获得，加一，即获得了该读锁两次
-      if (existing != NULL)
-	++existing->pr_lock_count;
-      else
-	++self->p_untracked_readlock_count;
-    }
+  rwlock->__rw_readers += RWLOCK_READER;
+  rwlock_rbias_slow_rdlock (rwlock);
+  rwlock_unlock (rwlock);
+  rwlock_track_rdlock (self, rwlock, existing, have_lock_already);
 
   return 0;
 }
@@ -313,42 +833,64 @@ __pthread_rwlock_timedrdlock (pthread_rwlock_t *rwlock,
 {
   pthread_descr self = NULL;
   pthread_readlock_info *existing;
-  int out_of_mem, have_lock_already;
+  int have_lock_already;
   pthread_extricate_if extr;
 
   if (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000)
     return EINVAL;
 
-  have_lock_already = rwlock_have_already(&self, rwlock,
-					  &existing, &out_of_mem);
+  if (rwlock_rslot_rdlock (rwlock, &self))
+    return 0;
+
+  have_lock_already = rwlock_have_already(&self, rwlock, &existing);
 
   if (self == NULL)
     self = thread_self ();
 
+  if (rwlock_fast_rdlock (rwlock))
+    {
+      rwlock_track_rdlock (self, rwlock, existing, have_lock_already);
+      return 0;
+    }
+
   /* Set up extrication interface */
   extr.pu_object = rwlock;
   extr.pu_extricate_func = rwlock_rd_extricate_func;
 
-  /* Register extrication interface */
-  __pthread_set_own_extricate_if (self, &extr);
+  /* Register extrication interface.  Process-shared rwlocks have no
+     queue to extricate the thread from.  */
+  if (!rwlock_pshared (rwlock))
+    __pthread_set_own_extricate_if (self, &extr);
 
   for (;;)
     {
-      __pthread_lock (&rwlock->__rw_lock, self);
+      rwlock_lock (rwlock, self);
 
       if (rwlock_can_rdlock(rwlock, have_lock_already))
 	break;
 
+      if (rwlock_pshared (rwlock))
+	{
+	  if (rwlock_pshared_rdwait (rwlock, abstime) == ETIMEDOUT
+	      && !rwlock_can_rdlock (rwlock, have_lock_already))
+	    {
+	      rwlock_unlock (rwlock);
+	      return ETIMEDOUT;
+	    }
+	  rwlock_unlock (rwlock);
+	  continue;
+	}
+
       enqueue (&rwlock->__rw_read_waiting, self);
-      __pthread_unlock (&rwlock->__rw_lock);
+      rwlock_unlock (rwlock);
       /* This is not a cancellation point */
       if (timedsuspend (self, abstime) == 0)
 	{
 	  int was_on_queue;
 
-	  __pthread_lock (&rwlock->__rw_lock, self);
+	  rwlock_lock (rwlock, self);
 	  was_on_queue = remove_from_queue (&rwlock->__rw_read_waiting, self);
-	  __pthread_unlock (&rwlock->__rw_lock);
+	  rwlock_unlock (rwlock);
 
 	  if (was_on_queue)
 	    {
@@ -363,16 +905,10 @@ __pthread_rwlock_timedrdlock (pthread_rwlock_t *rwlock,
 
   __pthread_set_own_extricate_if (self, 0);
 
-  ++rwlock->__rw_readers;
-  __pthread_unlock (&rwlock->__rw_lock);
-
-  if (have_lock_already || out_of_mem)
-    {
-      if (existing != NULL)
-	++existing->pr_lock_count;
-      else
-	++self->p_untracked_readlock_count;
-    }
+  rwlock->__rw_readers += RWLOCK_READER;
+  rwlock_rbias_slow_rdlock (rwlock);
+  rwlock_unlock (rwlock);
+  rwlock_track_rdlock (self, rwlock, existing, have_lock_already);
 
   return 0;
 }
@@ -383,39 +919,39 @@ __pthread_rwlock_tryrdlock (pthread_rwlock_t *rwlock)
 {
   pthread_descr self = thread_self();
   pthread_readlock_info *existing;
-  int out_of_mem, have_lock_already;
+  int have_lock_already;
   int retval = EBUSY;
-  // 是否已经获得了该读锁
-  have_lock_already = rwlock_have_already(&self, rwlock,
-      &existing, &out_of_mem);
 
-  __pthread_lock (&rwlock->__rw_lock, self);
+  if (rwlock_rslot_rdlock (rwlock, &self))
+    return 0;
+  // 是否已经获得了该读锁
+  have_lock_already = rwlock_have_already(&self, rwlock, &existing);
 
-  /* 0 is passed to here instead of have_lock_already.
-     This is to meet Single Unix Spec requirements:
-     if writers are waiting, pthread_rwlock_tryrdlock
-     does not acquire a read lock, even if the caller has
-     one or more read locks already. */
-  // 写死0，即使当前线程获得了该读锁，第二次获取的时候，如果有等待写的线程，则优先让写
-  if (rwlock_can_rdlock(rwlock, 0))
+  if (rwlock_fast_rdlock (rwlock))
+    retval = 0;
+  else
     {
-      ++rwlock->__rw_readers;
-      retval = 0;
-    }
+      rwlock_lock (rwlock, self);
+
+      /* 0 is passed to here instead of have_lock_already.
+	 This is to meet Single Unix Spec requirements:
+	 if writers are waiting, pthread_rwlock_tryrdlock
+	 does not acquire a read lock, even if the caller has
+	 one or more read locks already. */
+      // 写死0，即使当前线程获得了该读锁，第二次获取的时候，如果有等待写的线程，则优先让写
+      if (rwlock_can_rdlock(rwlock, 0))
+	{
+	  rwlock->__rw_readers += RWLOCK_READER;
+	  rwlock_rbias_slow_rdlock (rwlock);
+	  retval = 0;
+	}
 
-  __pthread_unlock (&rwlock->__rw_lock);
+      rwlock_unlock (rwlock);
+    }
 
   if (retval == 0)
-    {
-      if (have_lock_already || out_of_mem)
-	{ 
     // 递归获得了锁，加一
-	  if (existing != NULL)
-	    ++existing->pr_lock_count;
-	  else
-	    ++self->p_untracked_readlock_count;
-	}
-    }
+    rwlock_track_rdlock (self, rwlock, existing, have_lock_already);
 
   return retval;
 }
@@ -429,20 +965,34 @@ __pthread_rwlock_wrlock (pthread_rwlock_t *rwlock)
 
   while(1)
     {
-      __pthread_lock (&rwlock->__rw_lock, self);
+      rwlock_lock (rwlock, self);
       // 没有读者，也没有写者
-      if (rwlock->__rw_readers == 0 && rwlock->__rw_writer == NULL)
+      if (rwlock_nr_readers (rwlock) == 0 && rwlock->__rw_writer == NULL)
 	{
+	  if (rwlock_rbias_revoke (rwlock))
+	    {
+	      /* Wait for the readers in the slots, then look again.  */
+	      rwlock_unlock (rwlock);
+	      rwlock_rslot_drain (rwlock, 0, NULL);
+	      continue;
+	    }
     // 设置当前线程为写者
-	  rwlock->__rw_writer = self;
-	  __pthread_unlock (&rwlock->__rw_lock);
+	  rwlock_set_writer (rwlock, rwlock_owner_id (rwlock, self));
+	  rwlock_unlock (rwlock);
 	  return 0;
 	}
 
+      if (rwlock_pshared (rwlock))
+	{
+	  rwlock_pshared_wrwait (rwlock, NULL);
+	  rwlock_unlock (rwlock);
+	  continue;
+	}
+
       /* Suspend ourselves, then try again */
       // 把当前线程插入等待获取写锁队列
       enqueue (&rwlock->__rw_write_waiting, self);
-      __pthread_unlock (&rwlock->__rw_lock);
+      rwlock_unlock (rwlock);
       // 挂起当前线程
       suspend (self); /* This is not a cancellation point */
     }
@@ -468,36 +1018,60 @@ __pthread_rwlock_timedwrlock (pthread_rwlock_t *rwlock,
 
   /* Register extrication interface */
   // 设置p_extricate字段
-  __pthread_set_own_extricate_if (self, &extr);
+  if (!rwlock_pshared (rwlock))
+    __pthread_set_own_extricate_if (self, &extr);
 
   while(1)
     {
-      __pthread_lock (&rwlock->__rw_lock, self);
+      rwlock_lock (rwlock, self);
       // 没有读写者
-      if (rwlock->__rw_readers == 0 && rwlock->__rw_writer == NULL)
+      if (rwlock_nr_readers (rwlock) == 0 && rwlock->__rw_writer == NULL)
 	{
+	  if (rwlock_rbias_revoke (rwlock))
+	    {
+	      rwlock_unlock (rwlock);
+	      if (rwlock_rslot_drain (rwlock, 0, abstime) != 0)
+		{
+		  __pthread_set_own_extricate_if (self, 0);
+		  return ETIMEDOUT;
+		}
+	      continue;
+	    }
     // 直接设置当前线程为写者，获得写锁
-	  rwlock->__rw_writer = self;
+	  rwlock_set_writer (rwlock, rwlock_owner_id (rwlock, self));
     // 清空p_extricate字段
 	  __pthread_set_own_extricate_if (self, 0);
-	  __pthread_unlock (&rwlock->__rw_lock);
+	  rwlock_unlock (rwlock);
 	  return 0;
 	}
 
+      if (rwlock_pshared (rwlock))
+	{
+	  if (rwlock_pshared_wrwait (rwlock, abstime) == ETIMEDOUT
+	      && !(rwlock_nr_readers (rwlock) == 0 && rwlock->__rw_writer == NULL))
+	    {
+	      /* Readers may have been waiting for us only.  */
+	      rwlock_pshared_wake (rwlock);
+	      return ETIMEDOUT;
+	    }
+	  rwlock_unlock (rwlock);
+	  continue;
+	}
+
       /* Suspend ourselves, then try again */
       // 插入等待获得写锁的队列
       enqueue (&rwlock->__rw_write_waiting, self);
-      __pthread_unlock (&rwlock->__rw_lock);
+      rwlock_unlock (rwlock);
       /* This is not a cancellation point */
       // 限时阻塞
       if (timedsuspend (self, abstime) == 0)
 	{
 	  int was_on_queue;
 
-	  __pthread_lock (&rwlock->__rw_lock, self);
+	  rwlock_lock (rwlock, self);
     // 删除成功则返回1，说明存在该节点
 	  was_on_queue = remove_from_queue (&rwlock->__rw_write_waiting, self);
-	  __pthread_unlock (&rwlock->__rw_lock);
+	  rwlock_unlock (rwlock);
 
 	  if (was_on_queue)
 	    {
@@ -518,19 +1092,47 @@ __pthread_rwlock_trywrlock (pthread_rwlock_t *rwlock)
 {
   int result = EBUSY;
 
-  __pthread_lock (&rwlock->__rw_lock, NULL);
+  rwlock_lock (rwlock, NULL);
   // 没有读者和写者，才能获取写锁，否则直接返回，不阻塞
-  if (rwlock->__rw_readers == 0 && rwlock->__rw_writer == NULL)
+  while (rwlock_nr_readers (rwlock) == 0 && rwlock->__rw_writer == NULL)
     {
-      rwlock->__rw_writer = thread_self ();
+      if (rwlock_rbias_revoke (rwlock))
+	{
+	  rwlock_unlock (rwlock);
+	  if (rwlock_rslot_drain (rwlock, 1, NULL) != 0)
+	    return EBUSY;
+	  rwlock_lock (rwlock, NULL);
+	  continue;
+	}
+      rwlock_set_writer (rwlock, rwlock_owner_id (rwlock, thread_self ()));
       result = 0;
+      break;
     }
-  __pthread_unlock (&rwlock->__rw_lock);
+  rwlock_unlock (rwlock);
 
   return result;
 }
 strong_alias (__pthread_rwlock_trywrlock, pthread_rwlock_trywrlock)
 
+/* Recursive lock fixup after the release of a read lock of RWLOCK.  */
+
+static inline void
+rwlock_untrack_rdlock (pthread_rwlock_t *rwlock)
+{
+  if (rwlock_kind (rwlock) == PTHREAD_RWLOCK_PREFER_WRITER_NP)
+    {
+      pthread_descr self = thread_self();
+      // 从读锁表中删除，不在表里
+      if (!rwlock_remove_readlock(self, rwlock))
+	{
+	  // untrack的锁减一
+	  int val = THREAD_GETMEM (self, p_untracked_readlock_count);
+	  if (val > 0)
+	    THREAD_SETMEM (self, p_untracked_readlock_count, val - 1);
+	}
+    }
+}
+
 // 解锁
 int
 __pthread_rwlock_unlock (pthread_rwlock_t *rwlock)
@@ -538,32 +1140,46 @@ __pthread_rwlock_unlock (pthread_rwlock_t *rwlock)
   pthread_descr torestart;
   pthread_descr th;
 
-  __pthread_lock (&rwlock->__rw_lock, NULL);
+  if (rwlock_scalable (rwlock) && rwlock_rslot_unlock (rwlock, thread_self ()))
+    return 0;
+
+  if (rwlock_fast_rdunlock (rwlock))
+    {
+      rwlock_untrack_rdlock (rwlock);
+      return 0;
+    }
+
+  rwlock_lock (rwlock, NULL);
   // 有写者
   if (rwlock->__rw_writer != NULL)
     {
       /* Unlocking a write lock.  */
       // 写者不是当前线程，则不能解锁，返回没有权限解锁
-      if (rwlock->__rw_writer != thread_self ())
+      if (rwlock->__rw_writer != rwlock_owner_id (rwlock, thread_self ()))
 	{
-	  __pthread_unlock (&rwlock->__rw_lock);
+	  rwlock_unlock (rwlock);
 	  return EPERM;
 	}
       // 没有写者或者写者是当前线程，重置写者字段
-      rwlock->__rw_writer = NULL;
+      rwlock_set_writer (rwlock, NULL);
+      if (rwlock_pshared (rwlock))
+	{
+	  rwlock_pshared_wake (rwlock);
+	  return 0;
+	}
       /*
        1 有等待获取写锁的线程并且优先让他们获得锁，
        2 没有等待获得写锁的线程
        则唤醒等待读的线程（如果是满足2，则不管是否优先让读，或者等待读锁的队列是否为空）
       */
-      if ((rwlock->__rw_kind == PTHREAD_RWLOCK_PREFER_READER_NP
+      if ((rwlock_prefer_reader (rwlock)
 	   && !queue_is_empty(&rwlock->__rw_read_waiting))
 	  || (th = dequeue(&rwlock->__rw_write_waiting)) == NULL)
 	{
 	  /* Restart all waiting readers.  */
-	  torestart = rwlock->__rw_read_waiting;
-	  rwlock->__rw_read_waiting = NULL;
-	  __pthread_unlock (&rwlock->__rw_lock);
+	  torestart = NULL;
+	  queue_move (&torestart, &rwlock->__rw_read_waiting);
+	  rwlock_unlock (rwlock);
 	  while ((th = dequeue (&torestart)) != NULL)
 	    restart (th);
 	}
@@ -571,7 +1187,7 @@ __pthread_rwlock_unlock (pthread_rwlock_t *rwlock)
     // 否则唤醒等待获取写锁的线程
 	{
 	  /* Restart one waiting writer.  */
-	  __pthread_unlock (&rwlock->__rw_lock);
+	  rwlock_unlock (rwlock);
 	  restart (th);
 	}
     }
@@ -580,59 +1196,150 @@ __pthread_rwlock_unlock (pthread_rwlock_t *rwlock)
     {
       /* Unlocking a read lock.  */
       // 也没有读者
-      if (rwlock->__rw_readers == 0)
+      if (rwlock_nr_readers (rwlock) == 0)
 	{
-	  __pthread_unlock (&rwlock->__rw_lock);
+	  rwlock_unlock (rwlock);
     // 返回没有权限，因为当前线程没有获得这个锁
 	  return EPERM;
 	}
       // 没有写者，有读者，读者减一
-      --rwlock->__rw_readers;
-      // 没有读者了
-      if (rwlock->__rw_readers == 0)
-	/* Restart one waiting writer, if any.  */
-  // 获得等待写的线程队列，准备唤醒
-	th = dequeue (&rwlock->__rw_write_waiting);
+      rwlock->__rw_readers -= RWLOCK_READER;
+      if (rwlock_pshared (rwlock))
+	rwlock_pshared_wake (rwlock);
       else
-      // 还有读者，则不需要唤醒等待写的线程
-	th = NULL;
+	{
+	  // 没有读者了
+	  if (rwlock_nr_readers (rwlock) == 0)
+	    /* Restart one waiting writer, if any.  */
+	    // 获得等待写的线程队列，准备唤醒
+	    th = dequeue (&rwlock->__rw_write_waiting);
+	  else
+	    // 还有读者，则不需要唤醒等待写的线程
+	    th = NULL;
 
-      __pthread_unlock (&rwlock->__rw_lock);
-      // 需要唤醒写者，则唤醒
-      if (th != NULL)
-	restart (th);
+	  rwlock_unlock (rwlock);
+	  // 需要唤醒写者，则唤醒
+	  if (th != NULL)
+	    restart (th);
+	}
 
-      /* Recursive lock fixup */
+      rwlock_untrack_rdlock (rwlock);
+    }
+
+  return 0;
+}
+strong_alias (__pthread_rwlock_unlock, pthread_rwlock_unlock)
 
-      if (rwlock->__rw_kind == PTHREAD_RWLOCK_PREFER_WRITER_NP)
+/* Turn the read lock the calling thread holds on RWLOCK into a write
+   lock, if no other thread holds a read lock.  A rwlock which prefers
+   writers goes to the writers waiting for it first.  The read lock is
+   kept if the upgrade fails.  Only a rwlock which prefers writers and
+   is not shared between processes knows its readers; for it the call
+   fails with EPERM if the calling thread holds no read lock.  */
+// 把读锁升级为写锁
+int
+pthread_rwlock_tryupgrade_np (pthread_rwlock_t *rwlock)
+{
+  pthread_descr self = thread_self ();
+  int result = EBUSY;
+
+  // 当前线程没有持有读锁
+  if (rwlock_kind (rwlock) == PTHREAD_RWLOCK_PREFER_WRITER_NP
+      && !rwlock_pshared (rwlock)
+      && rwlock_find_readlock (self, rwlock) == NULL
+      && THREAD_GETMEM (self, p_untracked_readlock_count) == 0)
+    return EPERM;
+
+  rwlock_lock (rwlock, self);
+  /* A read lock held through a slot is counted in __rw_readers from now
+     on, where the slots cannot hide it from the checks below.  */
+  if (rwlock_scalable (rwlock) && rwlock_rslot_unlock (rwlock, self))
+    {
+      rwlock->__rw_readers += RWLOCK_READER;
+      rwlock_rbias_slow_rdlock (rwlock);
+    }
+  for (;;)
+    {
+      if (rwlock->__rw_writer != NULL || rwlock_nr_readers (rwlock) == 0)
 	{
-	  pthread_descr self = thread_self();
-    // 从读锁队列中删除 
-	  pthread_readlock_info *victim = rwlock_remove_from_list(self, rwlock);
-    // 存在队列里
-	  if (victim != NULL)
-	    {
-        // 引用数为0，则插入free队列
-	      if (victim->pr_lock_count == 0)
-		{
-		  victim->pr_next = THREAD_GETMEM (self, p_readlock_free);
-		  THREAD_SETMEM (self, p_readlock_free, victim);
-		}
-	    }
-    // 不存在队列
-	  else
-	    {
-        // untrack的锁减一
-	      int val = THREAD_GETMEM (self, p_untracked_readlock_count);
-	      if (val > 0)
-		THREAD_SETMEM (self, p_untracked_readlock_count, val - 1);
-	    }
+	  result = EPERM;
+	  break;
+	}
+      // 还有其他读者
+      if (rwlock_nr_readers (rwlock) > 1)
+	break;
+      // 优先写者，并且有等待写的线程，让它们先获得锁
+      if (!rwlock_prefer_reader (rwlock) && rwlock_writers_waiting (rwlock))
+	break;
+      if (rwlock_rbias_revoke (rwlock))
+	{
+	  /* Wait for the other readers in the slots, then look again.  */
+	  rwlock_unlock (rwlock);
+	  if (rwlock_rslot_drain (rwlock, 1, NULL) != 0)
+	    return EBUSY;
+	  rwlock_lock (rwlock, self);
+	  continue;
 	}
+      // 当前线程是唯一的读者，直接成为写者
+      rwlock->__rw_readers -= RWLOCK_READER;
+      rwlock_set_writer (rwlock, rwlock_owner_id (rwlock, self));
+      result = 0;
+      break;
     }
+  rwlock_unlock (rwlock);
+
+  if (result == 0)
+    rwlock_untrack_rdlock (rwlock);
+
+  return result;
+}
+
+/* Turn the write lock the calling thread holds on RWLOCK into a read
+   lock, and let in the waiting readers which may share it, all with the
+   internal lock held so that no writer gets in meanwhile.  */
+// 把写锁降级为读锁
+int
+pthread_rwlock_downgrade_np (pthread_rwlock_t *rwlock)
+{
+  pthread_descr self = thread_self ();
+  pthread_readlock_info *existing;
+  int have_lock_already;
+  pthread_descr torestart;
+  pthread_descr th;
+
+  have_lock_already = rwlock_have_already (&self, rwlock, &existing);
+
+  rwlock_lock (rwlock, self);
+  if (rwlock->__rw_writer == NULL
+      || rwlock->__rw_writer != rwlock_owner_id (rwlock, self))
+    {
+      rwlock_unlock (rwlock);
+      return EPERM;
+    }
+  rwlock_set_writer (rwlock, NULL);
+  rwlock->__rw_readers += RWLOCK_READER;
+  rwlock_rbias_slow_rdlock (rwlock);
+
+  if (rwlock_pshared (rwlock))
+    /* Wakes up the readers, or nobody since we still hold a read lock.  */
+    rwlock_pshared_wake (rwlock);
+  else
+    {
+      /* Restart all waiting readers, unless the rwlock prefers the
+	 waiting writers, which still wait for our read lock.  */
+      torestart = NULL;
+      if (rwlock_prefer_reader (rwlock)
+	  || queue_is_empty (&rwlock->__rw_write_waiting))
+	queue_move (&torestart, &rwlock->__rw_read_waiting);
+      rwlock_unlock (rwlock);
+      while ((th = dequeue (&torestart)) != NULL)
+	restart (th);
+    }
+
+  rwlock_track_rdlock (self, rwlock, existing, have_lock_already);
 
   return 0;
 }
-strong_alias (__pthread_rwlock_unlock, pthread_rwlock_unlock)
 
 
 // 初始化读写锁属性
@@ -668,8 +1375,8 @@ pthread_rwlockattr_setpshared (pthread_rwlockattr_t *attr, int pshared)
   if (pshared != PTHREAD_PROCESS_PRIVATE && pshared != PTHREAD_PROCESS_SHARED)
     return EINVAL;
 
-  /* For now it is not possible to shared a conditional variable.  */
-  if (pshared != PTHREAD_PROCESS_PRIVATE)
+  /* Process-shared rwlocks sleep on futexes.  */
+  if (pshared != PTHREAD_PROCESS_PRIVATE && !__pthread_futex_mutexes)
     return ENOSYS;
 
   attr->__pshared = pshared;
@@ -692,6 +1399,7 @@ pthread_rwlockattr_setkind_np (pthread_rwlockattr_t *attr, int pref)
   if (pref != PTHREAD_RWLOCK_PREFER_READER_NP
       && pref != PTHREAD_RWLOCK_PREFER_WRITER_NP
       && pref != PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP
+      && pref != PTHREAD_RWLOCK_PREFER_READER_SCALABLE_NP
       && pref != PTHREAD_RWLOCK_DEFAULT_NP)
     return EINVAL;
 
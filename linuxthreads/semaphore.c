@@ -15,6 +15,17 @@
 /* Semaphores a la POSIX 1003.1b */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <mntent.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
 #include "pthread.h"
 #include "semaphore.h"
 #include "internals.h"
@@ -22,6 +33,175 @@
 #include "restart.h"
 #include "queue.h"
 #include <shlib-compat.h>
+
+/* When __pthread_futex_mutexes is set, sem_init makes futex semaphores,
+   whose count is only ever changed with compare-and-swap, so that
+   sem_wait and sem_post take a single one when nobody has to sleep, and
+   sem_post needs no lock and can be called from signal handlers.  Their
+   __sem_waiting holds a sequence number above the SEM_FUTEX bit, which is
+   never set in a descriptor address, and the threads with nothing to
+   take sleep on it.  The __status of __sem_lock counts these threads; a
+   sem_post which finds any bumps the sequence number and wakes one up.
+   A sleeper which leaves without taking the count it was woken up for,
+   because it timed out or was cancelled, passes the wakeup on.  Before
+   they sleep, threads watch the count for a while on SMP, and keep a
+   moving average of the spins they needed in the __spinlock of
+   __sem_lock (see __pthread_wait_spin_count).  Other semaphores queue
+   their waiters under __sem_lock.  */
+
+#define SEM_FUTEX	1
+#define SEM_SEQ_INC	2
+#define SEM_SEQ_MASK	0x3fffffffL
+
+#define sem_futex(sem) (((long) (sem)->__sem_waiting & SEM_FUTEX) != 0)
+#define sem_seq(sem) ((long) *(pthread_descr volatile *) &(sem)->__sem_waiting)
+#define sem_seq_word(sem) ((long *) &(sem)->__sem_waiting)
+#define sem_sleepers(sem) ((sem)->__sem_lock.__status)
+
+static inline long sem_futex_add(long * word, long delta, sem_t * sem)
+{
+  long oldval;
+
+  do
+    oldval = *(volatile long *) word;
+  while (!compare_and_swap(word, oldval, oldval + delta,
+			   &sem->__sem_lock.__spinlock));
+  return oldval;
+}
+
+/* Take one from the count of SEM.  Return 0, or EAGAIN if it is zero.  */
+
+static inline int sem_futex_trywait(sem_t * sem)
+{
+  long oldval;
+
+  do {
+    oldval = *(volatile long *) &sem->__sem_value;
+    if (oldval <= 0)
+      return EAGAIN;
+  } while (!compare_and_swap(&sem->__sem_value, oldval, oldval - 1,
+			     &sem->__sem_lock.__spinlock));
+  return 0;
+}
+
+/* Bump the sequence number of SEM and wake up NR threads sleeping on
+   it.  */
+
+static void sem_futex_bump(sem_t * sem, int nr)
+{
+  long oldval;
+
+  do
+    oldval = sem_seq(sem);
+  while (!compare_and_swap(sem_seq_word(sem), oldval,
+			   ((oldval + SEM_SEQ_INC) & SEM_SEQ_MASK) | SEM_FUTEX,
+			   &sem->__sem_lock.__spinlock));
+  __pthread_futex_wakeup(sem_seq_word(sem), nr);
+}
+
+static inline void sem_futex_wake(sem_t * sem)
+{
+  if (*(volatile long *) &sem_sleepers(sem) != 0)
+    sem_futex_bump(sem, 1);
+}
+
+static int sem_futex_post(sem_t * sem)
+{
+  long oldval;
+
+  do {
+    oldval = *(volatile long *) &sem->__sem_value;
+    if (oldval >= SEM_VALUE_MAX) {
+      /* Overflow */
+      errno = ERANGE;
+      return -1;
+    }
+  } while (!compare_and_swap(&sem->__sem_value, oldval, oldval + 1,
+			     &sem->__sem_lock.__spinlock));
+  /* The compare-and-swap orders the count before the check of the
+     sleepers.  */
+  sem_futex_wake(sem);
+  return 0;
+}
+
+/* Function called by pthread_cancel for a thread sleeping on a futex
+   semaphore.  The thread cannot be told apart from the other sleepers,
+   so wake them all up; they go back to sleep if there is still nothing
+   to take.  The sequence number changes even if the thread is not
+   counted as a sleeper yet, so that it cannot go to sleep without
+   seeing the cancellation.  */
+
+static int sem_futex_extricate_func(void *obj, pthread_descr th)
+{
+  sem_futex_bump(obj, INT_MAX);
+  return 0;
+}
+
+/* Slow path of sem_wait and sem_timedwait on a futex semaphore: sleep
+   until one can be taken from the count of SEM, or until ABSTIME if it is
+   not NULL.  Return 0 or ETIMEDOUT.  */
+
+static int sem_futex_wait(sem_t * sem, const struct timespec * abstime)
+{
+  volatile pthread_descr self = thread_self();
+  pthread_extricate_if extr;
+  long seq;
+  int result, err = 0;
+  int spin_count, max_count;
+
+  max_count = __pthread_wait_spin_count(sem->__sem_lock.__spinlock, -1);
+  for (spin_count = 0; spin_count < max_count; spin_count++) {
+    if (*(volatile long *) &sem->__sem_value > 0
+	&& sem_futex_trywait(sem) == 0) {
+      __pthread_wait_spin_update(&sem->__sem_lock.__spinlock, spin_count);
+      return 0;
+    }
+#ifdef BUSY_WAIT_NOP
+    BUSY_WAIT_NOP;
+#endif
+  }
+  if (max_count > 0)
+    __pthread_wait_spin_update(&sem->__sem_lock.__spinlock, max_count);
+
+  extr.pu_object = sem;
+  extr.pu_extricate_func = sem_futex_extricate_func;
+  __pthread_set_own_extricate_if(self, &extr);
+
+  /* A sem_post from now on bumps the sequence number.  */
+  sem_futex_add(&sem_sleepers(sem), 1, sem);
+  for (;;) {
+    seq = sem_seq(sem);
+    if (sem_futex_trywait(sem) == 0) {
+      result = 0;
+      break;
+    }
+    if (THREAD_GETMEM(self, p_canceled)
+	&& THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE) {
+      result = ECANCELED;
+      break;
+    }
+    if (err == ETIMEDOUT) {
+      result = ETIMEDOUT;
+      break;
+    }
+    err = __pthread_futex_sleep(sem_seq_word(sem), seq, CLOCK_REALTIME,
+				abstime);
+  }
+  sem_futex_add(&sem_sleepers(sem), -1, sem);
+  __pthread_set_own_extricate_if(self, 0);
+
+  /* We got the semaphore; ignore any cancellation.  */
+  if (result == 0)
+    return 0;
+
+  /* We may have been woken up for a count we leave to the others.  */
+  if (*(volatile long *) &sem->__sem_value > 0)
+    sem_futex_wake(sem);
+  if (result == ECANCELED)
+    __pthread_do_exit(PTHREAD_CANCELED, CURRENT_STACK_FRAME);
+  return result;
+}
+
 // 初始化信号量
 int __new_sem_init(sem_t *sem, int pshared, unsigned int value)
 {
@@ -29,7 +209,8 @@ int __new_sem_init(sem_t *sem, int pshared, unsigned int value)
     errno = EINVAL;
     return -1;
   }
-  if (pshared) {
+  // 进程间共享的信号量只能是futex信号量
+  if (pshared && !__pthread_futex_mutexes) {
     errno = ENOSYS;
     return -1;
   }
@@ -38,6 +219,8 @@ int __new_sem_init(sem_t *sem, int pshared, unsigned int value)
   sem->__sem_value = value;
   // 等待资源的线程队列
   sem->__sem_waiting = NULL;
+  if (__pthread_futex_mutexes)
+    sem->__sem_waiting = (pthread_descr) SEM_FUTEX;
   return 0;
 }
 
@@ -65,6 +248,12 @@ int __new_sem_wait(sem_t * sem)
   int already_canceled = 0;
   int spurious_wakeup_count;
 
+  if (sem_futex(sem)) {
+    if (sem_futex_trywait(sem) != 0)
+      sem_futex_wait(sem, NULL);
+    return 0;
+  }
+
   /* Set up extrication interface */
   extr.pu_object = sem;
   extr.pu_extricate_func = new_sem_extricate_func;
@@ -131,6 +320,13 @@ int __new_sem_trywait(sem_t * sem)
 {
   int retval;
 
+  if (sem_futex(sem)) {
+    if (sem_futex_trywait(sem) != 0) {
+      errno = EAGAIN;
+      return -1;
+    }
+    return 0;
+  }
   __pthread_lock(&sem->__sem_lock, NULL);
   if (sem->__sem_value == 0) {
     errno = EAGAIN;
@@ -149,6 +345,9 @@ int __new_sem_post(sem_t * sem)
   pthread_descr th;
   struct pthread_request request;
 
+  // 不用加锁，在信号处理函数中也可以直接执行
+  if (sem_futex(sem))
+    return sem_futex_post(sem);
   if (THREAD_GETMEM(self, p_in_sighandler) == NULL) {
     __pthread_lock(&sem->__sem_lock, self);
     // 有线程在等待资源，直接消费掉
@@ -197,29 +396,265 @@ int __new_sem_getvalue(sem_t * sem, int * sval)
 int __new_sem_destroy(sem_t * sem)
 { 
   // 还有线程在等待
-  if (sem->__sem_waiting != NULL) {
+  if (sem_futex(sem) ? sem_sleepers(sem) != 0 : sem->__sem_waiting != NULL) {
     __set_errno (EBUSY);
     return -1;
   }
   return 0;
 }
 
+/* Named semaphores.  Each lives in a file of a tmpfs directory, which
+   holds a process-shared futex semaphore and is mapped into memory by
+   sem_open.  A new file is written out under a temporary name and then
+   linked to the name of the semaphore, so that nobody can open it
+   before it is initialized.  Every process maps a semaphore once, and
+   sem_open and sem_close count the references to the mapping.  */
+
+#define SEM_SHM_MAGIC	0x01021994	/* tmpfs */
+#define SEM_SHM_DEFAULT	"/dev/shm"
+#define SEM_SHM_PREFIX	"sem."
+#define SEM_TMP_TRIES	100
+
+struct sem_mapping {
+  struct sem_mapping * sm_next;
+  dev_t sm_dev;
+  ino_t sm_ino;
+  sem_t * sm_sem;
+  int sm_refcount;
+};
+
+static struct _pthread_fastlock sem_mappings_lock = __LOCK_INITIALIZER;
+static struct sem_mapping * sem_mappings;
+static char * sem_shm_dir;
+static int sem_shm_searched;
+
+/* Find a tmpfs directory for the named semaphores, and store it in
+   sem_shm_dir.  Called with sem_mappings_lock held.  */
+
+static void sem_find_shm_dir(void)
+{
+  struct statfs fs;
+  struct mntent mnt, *mp;
+  char buf[512];
+  FILE *fp;
+
+  sem_shm_searched = 1;
+  if (statfs(SEM_SHM_DEFAULT, &fs) == 0 && fs.f_type == SEM_SHM_MAGIC) {
+    sem_shm_dir = (char *) SEM_SHM_DEFAULT;
+    return;
+  }
+  fp = setmntent("/proc/mounts", "r");
+  if (fp == NULL)
+    return;
+  while ((mp = getmntent_r(fp, &mnt, buf, sizeof(buf))) != NULL)
+    if ((strcmp(mp->mnt_type, "tmpfs") == 0 || strcmp(mp->mnt_type, "shm") == 0)
+	&& statfs(mp->mnt_dir, &fs) == 0 && fs.f_type == SEM_SHM_MAGIC) {
+      sem_shm_dir = strdup(mp->mnt_dir);
+      break;
+    }
+  endmntent(fp);
+}
+
+/* Store the path of the file of the named semaphore NAME in PATH, which
+   has room for PATH_MAX characters.  Return PATH, or NULL with errno
+   set if NAME is not a valid semaphore name.  */
+
+static char *sem_named_path(const char * name, char * path)
+{
+  size_t len;
+
+  __pthread_lock(&sem_mappings_lock, NULL);
+  if (!sem_shm_searched)
+    sem_find_shm_dir();
+  __pthread_unlock(&sem_mappings_lock);
+  if (sem_shm_dir == NULL || !__pthread_futex_mutexes) {
+    __set_errno (ENOSYS);
+    return NULL;
+  }
+  // 跳过开头的'/'，名字中不能再有'/'
+  while (*name == '/')
+    ++name;
+  len = strlen(name);
+  if (len == 0 || strchr(name, '/') != NULL) {
+    __set_errno (EINVAL);
+    return NULL;
+  }
+  if (len + sizeof(SEM_SHM_PREFIX) - 1 > NAME_MAX
+      || (strlen(sem_shm_dir) + sizeof("/" SEM_SHM_PREFIX "tmpXXXXXXXX") + len
+	  > PATH_MAX)) {
+    __set_errno (ENAMETOOLONG);
+    return NULL;
+  }
+  strcpy(stpcpy(stpcpy(path, sem_shm_dir), "/" SEM_SHM_PREFIX), name);
+  return path;
+}
+
+/* Create the file PATH for a new named semaphore with count VALUE and
+   return a descriptor open on it, or -1 with errno set.  errno is EEXIST
+   if somebody else created the file first.  */
+
+static int sem_named_create(const char * path, mode_t mode, unsigned int value)
+{
+  static unsigned long int counter;
+  size_t dirlen = strrchr(path, '/') + 1 - path;
+  char tmp[PATH_MAX];
+  unsigned long int r;
+  sem_t sem;
+  int fd, i, tries, err;
+
+  memset(&sem, 0, sizeof(sem));
+  __new_sem_init(&sem, 1, value);
+  memcpy(tmp, path, dirlen);
+  // 先以临时的名字创建并初始化，再链接到信号量的名字
+  for (tries = 0; ; tries++) {
+    r = ((unsigned long int) __getpid() << 16) ^ (unsigned long int) time(NULL)
+	^ (counter++ * 0x9e3779b9UL);
+    strcpy(tmp + dirlen, SEM_SHM_PREFIX "tmp");
+    for (i = 0; i < 8; i++, r >>= 5)
+      tmp[dirlen + sizeof(SEM_SHM_PREFIX "tmp") - 1 + i] =
+	"abcdefghijklmnopqrstuvwxyz012345"[r & 31];
+    tmp[dirlen + sizeof(SEM_SHM_PREFIX "tmp") - 1 + 8] = '\0';
+    fd = __libc_open(tmp, O_RDWR | O_CREAT | O_EXCL, mode);
+    if (fd >= 0)
+      break;
+    if (errno != EEXIST || tries == SEM_TMP_TRIES)
+      return -1;
+  }
+  if (TEMP_FAILURE_RETRY(__libc_write(fd, (char *) &sem, sizeof(sem)))
+      != sizeof(sem))
+    err = errno != 0 ? errno : ENOSPC;
+  else if (link(tmp, path) != 0)
+    err = errno;
+  else
+    err = 0;
+  unlink(tmp);
+  if (err != 0) {
+    __libc_close(fd);
+    __set_errno (err);
+    return -1;
+  }
+  return fd;
+}
+
+/* Map the named semaphore open on FD, or take another reference to the
+   mapping if the process has one already.  */
+
+static sem_t *sem_named_map(int fd)
+{
+  struct stat st;
+  struct sem_mapping *sm;
+  sem_t *result = SEM_FAILED;
+
+  if (fstat(fd, &st) != 0)
+    return SEM_FAILED;
+  if (st.st_size < (off_t) sizeof(sem_t)) {
+    __set_errno (EINVAL);
+    return SEM_FAILED;
+  }
+  __pthread_lock(&sem_mappings_lock, NULL);
+  for (sm = sem_mappings; sm != NULL; sm = sm->sm_next)
+    if (sm->sm_dev == st.st_dev && sm->sm_ino == st.st_ino) {
+      sm->sm_refcount++;
+      result = sm->sm_sem;
+      goto out;
+    }
+  sm = malloc(sizeof(*sm));
+  if (sm == NULL)
+    goto out;
+  result = mmap(NULL, sizeof(sem_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, 0);
+  if (result == MAP_FAILED) {
+    free(sm);
+    result = SEM_FAILED;
+    goto out;
+  }
+  sm->sm_dev = st.st_dev;
+  sm->sm_ino = st.st_ino;
+  sm->sm_sem = result;
+  sm->sm_refcount = 1;
+  sm->sm_next = sem_mappings;
+  sem_mappings = sm;
+ out:
+  __pthread_unlock(&sem_mappings_lock);
+  return result;
+}
+
 sem_t *sem_open(const char *name, int oflag, ...)
 {
-  __set_errno (ENOSYS);
-  return SEM_FAILED;
+  char buf[PATH_MAX];
+  char *path = sem_named_path(name, buf);
+  mode_t mode = 0;
+  unsigned int value = 0;
+  sem_t *result;
+  va_list ap;
+  int fd, err;
+
+  if (path == NULL)
+    return SEM_FAILED;
+  if (oflag & O_CREAT) {
+    va_start(ap, oflag);
+    mode = va_arg(ap, mode_t);
+    value = va_arg(ap, unsigned int);
+    va_end(ap);
+    if (value > SEM_VALUE_MAX) {
+      __set_errno (EINVAL);
+      return SEM_FAILED;
+    }
+  }
+  for (;;) {
+    if (!((oflag & O_CREAT) && (oflag & O_EXCL))) {
+      fd = __libc_open(path, O_RDWR);
+      if (fd >= 0 || errno != ENOENT || !(oflag & O_CREAT))
+	break;
+    }
+    // 其他进程可能抢先创建了同名的信号量，重新打开它
+    fd = sem_named_create(path, mode, value);
+    if (fd >= 0 || errno != EEXIST || (oflag & O_EXCL))
+      break;
+  }
+  if (fd < 0)
+    return SEM_FAILED;
+  result = sem_named_map(fd);
+  err = errno;
+  __libc_close(fd);
+  __set_errno (err);
+  return result;
 }
 
 int sem_close(sem_t *sem)
 {
-  __set_errno (ENOSYS);
-  return -1;
+  struct sem_mapping *sm, **prev;
+  int result = 0;
+
+  __pthread_lock(&sem_mappings_lock, NULL);
+  for (prev = &sem_mappings; (sm = *prev) != NULL; prev = &sm->sm_next)
+    if (sm->sm_sem == sem)
+      break;
+  if (sm == NULL) {
+    __set_errno (EINVAL);
+    result = -1;
+  } else if (--sm->sm_refcount == 0) {
+    *prev = sm->sm_next;
+    munmap(sem, sizeof(sem_t));
+    free(sm);
+  }
+  __pthread_unlock(&sem_mappings_lock);
+  return result;
 }
 
 int sem_unlink(const char *name)
 {
-  __set_errno (ENOSYS);
-  return -1;
+  char buf[PATH_MAX];
+  char *path = sem_named_path(name, buf);
+
+  if (path == NULL)
+    return -1;
+  if (unlink(path) != 0) {
+    if (errno == EPERM)
+      __set_errno (EACCES);
+    return -1;
+  }
+  return 0;
 }
 
 int sem_timedwait(sem_t *sem, const struct timespec *abstime)
@@ -229,6 +664,14 @@ int sem_timedwait(sem_t *sem, const struct timespec *abstime)
   int already_canceled = 0;
   int spurious_wakeup_count;
 
+  if (sem_futex(sem)) {
+    if (sem_futex_trywait(sem) == 0)
+      return 0;
+    if (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000)
+      return EINVAL;
+    return sem_futex_wait(sem, abstime);
+  }
+
   __pthread_lock(&sem->__sem_lock, self);
   if (sem->__sem_value > 0) {
     --sem->__sem_value;
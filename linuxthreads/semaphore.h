@@ -32,7 +32,7 @@ typedef struct _pthread_descr_struct *_pthread_descr;
 typedef struct
 {
   struct _pthread_fastlock __sem_lock;
-  int __sem_value;
+  long int __sem_value;
   _pthread_descr __sem_waiting;
 } sem_t;
 
@@ -0,0 +1,123 @@
+/* Sequence lock implementation.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of the
+   License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; see the file COPYING.LIB.  If not,
+   write to the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+   Boston, MA 02111-1307, USA.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include "internals.h"
+#include "spinlock.h"
+
+/* The writers of a sequence lock serialize on its __sl_lock, and make
+   __sl_seq odd for as long as they update the data.  A reader takes an
+   even sequence number before reading the data and checks afterwards that
+   it did not change, so that readers never store into the lock and do
+   not slow down each other.  A reader which does not want to spin while
+   a writer is at work sleeps on __sl_lock instead, behind the writer.  */
+
+#define seqlock_writer(seq) (((seq) & 1) != 0)
+
+int
+pthread_seqlock_init_np (pthread_seqlock_t *seqlock)
+{
+  __pthread_init_lock (&seqlock->__sl_lock);
+  seqlock->__sl_seq = 0;
+  return 0;
+}
+
+int
+pthread_seqlock_destroy_np (pthread_seqlock_t *seqlock)
+{
+  if (seqlock_writer (seqlock->__sl_seq))
+    return EBUSY;
+  return 0;
+}
+
+unsigned long int
+pthread_seqlock_read_begin_np (const pthread_seqlock_t *seqlock)
+{
+  unsigned long int seq;
+  int spins = 0;
+
+  while (seqlock_writer (seq = seqlock->__sl_seq))
+    {
+      if (++spins < SPIN_PAUSE_COUNT)
+	{
+#ifdef BUSY_WAIT_NOP
+	  BUSY_WAIT_NOP;
+#endif
+	}
+      else
+	sched_yield ();
+    }
+  READ_MEMORY_BARRIER ();
+  return seq;
+}
+
+unsigned long int
+pthread_seqlock_read_begin_wait_np (pthread_seqlock_t *seqlock)
+{
+  unsigned long int seq;
+  int spins = 0;
+
+  while (seqlock_writer (seq = seqlock->__sl_seq))
+    {
+      if (++spins < SPIN_PAUSE_COUNT)
+	{
+#ifdef BUSY_WAIT_NOP
+	  BUSY_WAIT_NOP;
+#endif
+	  continue;
+	}
+      /* The writer holds __sl_lock until it made __sl_seq even again.  */
+      __pthread_lock (&seqlock->__sl_lock, NULL);
+      seq = seqlock->__sl_seq;
+      __pthread_unlock (&seqlock->__sl_lock);
+      break;
+    }
+  READ_MEMORY_BARRIER ();
+  return seq;
+}
+
+int
+pthread_seqlock_read_retry_np (const pthread_seqlock_t *seqlock,
+			       unsigned long int seq)
+{
+  READ_MEMORY_BARRIER ();
+  return seqlock->__sl_seq != seq;
+}
+
+int
+pthread_seqlock_write_lock_np (pthread_seqlock_t *seqlock)
+{
+  __pthread_lock (&seqlock->__sl_lock, NULL);
+  seqlock->__sl_seq++;
+  WRITE_MEMORY_BARRIER ();
+  return 0;
+}
+
+int
+pthread_seqlock_write_unlock_np (pthread_seqlock_t *seqlock)
+{
+  if (!seqlock_writer (seqlock->__sl_seq))
+    return EPERM;
+  WRITE_MEMORY_BARRIER ();
+  seqlock->__sl_seq++;
+  __pthread_unlock (&seqlock->__sl_lock);
+  return 0;
+}
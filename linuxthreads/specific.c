@@ -15,8 +15,10 @@
 /* Thread-specific data */
 
 #include <errno.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include "pthread.h"
 #include "internals.h"
 #include "spinlock.h"
@@ -27,17 +29,28 @@
 /* Table of keys. */
 
 static struct pthread_key_struct pthread_keys[PTHREAD_KEYS_MAX] =
-  { { 0, NULL } };
+  { { 0, NULL, 0 } };
 
 /* For debugging purposes put the maximum number of keys in a variable.  */
 const int __linuxthreads_pthread_keys_max = PTHREAD_KEYS_MAX;
 const int __linuxthreads_pthread_key_2ndlevel_size = PTHREAD_KEY_2NDLEVEL_SIZE;
 
+/* Bitmap of the keys in use with a destruction routine.  Together with
+   the bitmap of keys set in a thread, it tells which destruction
+   routines may have to be called when the thread exits.  */
+
+static unsigned long pthread_keys_destr[PTHREAD_KEY_BITMAP_SIZE];
+
+#define key_word(key)	((key) / PTHREAD_KEY_BITMAP_BITS)
+#define key_bit(key)	(1UL << ((key) % PTHREAD_KEY_BITMAP_BITS))
+
 /* Mutex to protect access to pthread_keys */
 
 static pthread_mutex_t pthread_keys_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-/* Create a new key */
+/* Create a new key.  A key whose generation would wrap around on its
+   next deletion is never reused, so that no value can become current
+   again. */
 
 int __pthread_key_create(pthread_key_t * key, destr_function destr)
 {
@@ -45,10 +58,12 @@ int __pthread_key_create(pthread_key_t * key, destr_function destr)
 
   pthread_mutex_lock(&pthread_keys_mutex);
   for (i = 0; i < PTHREAD_KEYS_MAX; i++) {
-    if (! pthread_keys[i].in_use) {
+    if (! pthread_keys[i].in_use && pthread_keys[i].seq != ULONG_MAX) {
       /* Mark key in use */
       pthread_keys[i].in_use = 1;
       pthread_keys[i].destr = destr;
+      if (destr != NULL)
+	pthread_keys_destr[key_word(i)] |= key_bit(i);
       pthread_mutex_unlock(&pthread_keys_mutex);
       *key = i;
       return 0;
@@ -59,39 +74,9 @@ int __pthread_key_create(pthread_key_t * key, destr_function destr)
 }
 strong_alias (__pthread_key_create, pthread_key_create)
 
-/* Reset deleted key's value to NULL in each live thread.
- * NOTE: this executes in the context of the thread manager! */
-
-struct pthread_key_delete_helper_args {
-  /* Damn, we need lexical closures in C! ;) */
-  unsigned int idx1st, idx2nd;
-  pthread_descr self;
-};
-
-static void pthread_key_delete_helper(void *arg, pthread_descr th)
-{
-  struct pthread_key_delete_helper_args *args = arg;
-  unsigned int idx1st = args->idx1st;
-  unsigned int idx2nd = args->idx2nd;
-  pthread_descr self = args->self;
-
-  if (self == 0)
-    self = args->self = thread_self();
-
-  if (!th->p_terminated) {
-    /* pthread_exit() may try to free th->p_specific[idx1st] concurrently. */
-    __pthread_lock(THREAD_GETMEM(th, p_lock), self);
-    if (th->p_specific[idx1st] != NULL)
-      th->p_specific[idx1st][idx2nd] = NULL;
-    __pthread_unlock(THREAD_GETMEM(th, p_lock));
-  }
-}
-
 /* Delete a key */
 int pthread_key_delete(pthread_key_t key)
 {
-  pthread_descr self = thread_self();
-
   pthread_mutex_lock(&pthread_keys_mutex);
   if (key >= PTHREAD_KEYS_MAX || !pthread_keys[key].in_use) {
     pthread_mutex_unlock(&pthread_keys_mutex);
@@ -99,31 +84,13 @@ int pthread_key_delete(pthread_key_t key)
   }
   pthread_keys[key].in_use = 0;
   pthread_keys[key].destr = NULL;
+  pthread_keys_destr[key_word(key)] &= ~key_bit(key);
 
-  /* Set the value of the key to NULL in all running threads, so
-     that if the key is reallocated later by pthread_key_create, its
-     associated values will be NULL in all threads.
-
-     Do nothing if no threads have been created yet.  */
-
-  if (__pthread_manager_request != -1)
-    {
-      struct pthread_key_delete_helper_args args;
-      struct pthread_request request;
-
-      args.idx1st = key / PTHREAD_KEY_2NDLEVEL_SIZE;
-      args.idx2nd = key % PTHREAD_KEY_2NDLEVEL_SIZE;
-      args.self = 0;
-
-      request.req_thread = self;
-      request.req_kind = REQ_FOR_EACH_THREAD;
-      request.req_args.for_each.arg = &args;
-      request.req_args.for_each.fn = pthread_key_delete_helper;
-
-      TEMP_FAILURE_RETRY(__libc_write(__pthread_manager_request,
-				      (char *) &request, sizeof(request)));
-      suspend(self);
-    }
+  /* The values of the key in all threads now have a stale generation,
+     so that if the key is reallocated later by pthread_key_create, its
+     associated values read as NULL in all threads.  They are left
+     where they are until the threads overwrite or free them. */
+  pthread_keys[key].seq++;
 
   pthread_mutex_unlock(&pthread_keys_mutex);
   return 0;
@@ -135,18 +102,26 @@ int __pthread_setspecific(pthread_key_t key, const void * pointer)
 {
   pthread_descr self = thread_self();
   unsigned int idx1st, idx2nd;
+  struct pthread_key_data * data;
 
   if (key >= PTHREAD_KEYS_MAX || !pthread_keys[key].in_use)
     return EINVAL;
   idx1st = key / PTHREAD_KEY_2NDLEVEL_SIZE;
   idx2nd = key % PTHREAD_KEY_2NDLEVEL_SIZE;
   if (THREAD_GETMEM_NC(self, p_specific[idx1st]) == NULL) {
-    void *newp = calloc(PTHREAD_KEY_2NDLEVEL_SIZE, sizeof (void *));
+    void *newp = calloc(PTHREAD_KEY_2NDLEVEL_SIZE,
+			sizeof (struct pthread_key_data));
     if (newp == NULL)
       return ENOMEM;
     THREAD_SETMEM_NC(self, p_specific[idx1st], newp);
   }
-  THREAD_GETMEM_NC(self, p_specific[idx1st])[idx2nd] = (void *) pointer;
+  data = &THREAD_GETMEM_NC(self, p_specific[idx1st])[idx2nd];
+  data->seq = pthread_keys[key].seq;
+  data->data = (void *) pointer;
+  if (pointer != NULL)
+    THREAD_SETMEM_NC(self, p_specific_used[key_word(key)],
+		     THREAD_GETMEM_NC(self, p_specific_used[key_word(key)])
+		     | key_bit(key));
   return 0;
 }
 strong_alias (__pthread_setspecific, pthread_setspecific)
@@ -157,6 +132,7 @@ void * __pthread_getspecific(pthread_key_t key)
 {
   pthread_descr self = thread_self();
   unsigned int idx1st, idx2nd;
+  struct pthread_key_data * data;
 
   if (key >= PTHREAD_KEYS_MAX)
     return NULL;
@@ -165,43 +141,64 @@ void * __pthread_getspecific(pthread_key_t key)
   if (THREAD_GETMEM_NC(self, p_specific[idx1st]) == NULL
       || !pthread_keys[key].in_use)
     return NULL;
-  return THREAD_GETMEM_NC(self, p_specific[idx1st])[idx2nd];
+  data = &THREAD_GETMEM_NC(self, p_specific[idx1st])[idx2nd];
+  if (data->seq != pthread_keys[key].seq)
+    return NULL;
+  return data->data;
 }
 strong_alias (__pthread_getspecific, pthread_getspecific)
 
-/* Call the destruction routines on all keys */
+/* Call the destruction routines on all keys.  Only the keys which were
+   set in this thread and have a destruction routine are looked at: each
+   round takes the bits of those keys out of the thread's bitmap, and the
+   destruction routines set them again if they set values. */
 
 void __pthread_destroy_specifics()
 {
   pthread_descr self = thread_self();
-  int i, j, round, found_nonzero;
+  int i, k, round, found_nonzero;
+  unsigned int idx1st, idx2nd;
+  unsigned long bits;
+  struct pthread_key_struct * key;
+  struct pthread_key_data * data;
   destr_function destr;
-  void * data;
+  void * value;
 
   for (round = 0, found_nonzero = 1;
        found_nonzero && round < PTHREAD_DESTRUCTOR_ITERATIONS;
        round++) {
     found_nonzero = 0;
-    for (i = 0; i < PTHREAD_KEY_1STLEVEL_SIZE; i++)
-      if (THREAD_GETMEM_NC(self, p_specific[i]) != NULL)
-        for (j = 0; j < PTHREAD_KEY_2NDLEVEL_SIZE; j++) {
-          destr = pthread_keys[i * PTHREAD_KEY_2NDLEVEL_SIZE + j].destr;
-          data = THREAD_GETMEM_NC(self, p_specific[i])[j];
-          if (destr != NULL && data != NULL) {
-            THREAD_GETMEM_NC(self, p_specific[i])[j] = NULL;
-            destr(data);
-            found_nonzero = 1;
-          }
+    for (i = 0; i < PTHREAD_KEY_BITMAP_SIZE; i++) {
+      bits = THREAD_GETMEM_NC(self, p_specific_used[i]);
+      if (bits == 0)
+        continue;
+      THREAD_SETMEM_NC(self, p_specific_used[i], 0);
+      bits &= pthread_keys_destr[i];
+      while (bits != 0) {
+        k = i * PTHREAD_KEY_BITMAP_BITS + ffsl(bits) - 1;
+        bits &= bits - 1;
+        key = &pthread_keys[k];
+        idx1st = k / PTHREAD_KEY_2NDLEVEL_SIZE;
+        idx2nd = k % PTHREAD_KEY_2NDLEVEL_SIZE;
+        data = &THREAD_GETMEM_NC(self, p_specific[idx1st])[idx2nd];
+        destr = key->destr;
+        value = data->data;
+        if (destr != NULL && value != NULL && data->seq == key->seq) {
+          data->data = NULL;
+          destr(value);
+          found_nonzero = 1;
         }
+      }
+    }
   }
-  __pthread_lock(THREAD_GETMEM(self, p_lock), self);
   for (i = 0; i < PTHREAD_KEY_1STLEVEL_SIZE; i++) {
     if (THREAD_GETMEM_NC(self, p_specific[i]) != NULL) {
       free(THREAD_GETMEM_NC(self, p_specific[i]));
       THREAD_SETMEM_NC(self, p_specific[i], NULL);
     }
   }
-  __pthread_unlock(THREAD_GETMEM(self, p_lock));
+  for (i = 0; i < PTHREAD_KEY_BITMAP_SIZE; i++)
+    THREAD_SETMEM_NC(self, p_specific_used[i], 0);
 }
 
 #if !(USE_TLS && HAVE___THREAD)
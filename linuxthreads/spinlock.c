@@ -23,16 +23,10 @@
 #include "internals.h"
 #include "spinlock.h"
 #include "restart.h"
+#include "queue.h"
 
 static void __pthread_acquire(int * spinlock);
 
-static inline void __pthread_release(int * spinlock)
-{
-  WRITE_MEMORY_BARRIER();
-  *spinlock = __LT_SPINLOCK_INIT;
-  __asm __volatile ("" : "=m" (*spinlock) : "0" (*spinlock));
-}
-
 
 /* The status field of a spinlock is a pointer whose least significant
    bit is a locked flag.
@@ -48,22 +42,61 @@ static inline void __pthread_release(int * spinlock)
 		      field.
    (status & 1) == 0: same as above, but spinlock is not taken.
 
-   The waiting list is not sorted by priority order.
-   Actually, we always insert at top of list (sole insertion mode
-   that can be performed without locking).
-   For __pthread_unlock, we perform a linear search in the list
-   to find the highest-priority, oldest waiting thread.
+   Waiting threads always insert themselves at top of list (sole
+   insertion mode that can be performed without locking).  Below the
+   threads that arrived since the last __pthread_unlock, the list
+   continues with the threads that earlier unlocks have already sorted;
+   the first of these has p_lockq_first set, and they are kept in
+   priority order in a wait queue of their p_locklink fields (see
+   queue.h).  __pthread_unlock takes the whole list out of the lock,
+   inserts the new arrivals into the sorted queue, wakes up the first
+   thread of that queue and puts the remaining ones back.  Each waiting
+   thread is thus looked at only once, instead of once per unlock.
    This is safe because there are no concurrent __pthread_unlock
    operations -- only the thread that locked the mutex can unlock it. */
 
+#define lock_thread(wl) \
+  ((pthread_descr) ((char *) (wl) \
+		    - offsetof(struct _pthread_descr_struct, p_locklink)))
 
-void internal_function __pthread_lock(struct _pthread_fastlock * lock,
-				      pthread_descr self)
+
+/* Tunables of the adaptive spinning, set from the environment at
+   initialization time (see pthread.c).  The spin count of a lock is a
+   moving average of the spins recently needed to get it, which moves
+   by 1/__pthread_spin_decay of the difference at each contended lock;
+   threads spin up to twice that average, but never more than
+   __pthread_spin_max times.  If __pthread_spin_owner is set, threads
+   waiting on an adaptive mutex stop spinning as soon as the owner of
+   the mutex is suspended itself.  */
+
+int __pthread_spin_max = MAX_ADAPTIVE_SPIN_COUNT;
+int __pthread_spin_decay = ADAPTIVE_SPIN_DECAY;
+int __pthread_spin_owner;
+
+/* Default max spin count of the waiters of barriers and semaphores (see
+   spinlock.h).  */
+
+int __pthread_wait_spin_max = MAX_WAIT_SPIN_COUNT;
+
+/* Number of contended adaptive mutexes obtained by spinning, and of
+   those that had to suspend the thread after spinning.  Internal locks
+   do not count.  They are not updated atomically and are only meant as
+   a hint for tuning the above.  */
+
+unsigned long __pthread_spin_acquired;
+unsigned long __pthread_spin_suspended;
+
+/* Take LOCK, spinning at most MAX_SPIN times on SMP first.  Update the
+   counts above if STATS is set.  */
+
+static inline void
+__pthread_lock_internal(struct _pthread_fastlock * lock, pthread_descr self,
+			int max_spin, int * ownerp, int stats)
 {
 #if defined HAS_COMPARE_AND_SWAP
   long oldstatus, newstatus;
   int successful_seizure, spurious_wakeup_count;
-  int spin_count;
+  int spin_count, owner;
 #endif
 
 #if defined TEST_FOR_COMPARE_AND_SWAP
@@ -87,29 +120,38 @@ void internal_function __pthread_lock(struct _pthread_fastlock * lock,
 
   /* On SMP, try spinning to get the lock. */
 
-  if (__pthread_smp_kernel) {
+  if (__pthread_smp_kernel && max_spin > 0) {
     int max_count = lock->__spinlock * 2 + 10;
 
-    if (max_count > MAX_ADAPTIVE_SPIN_COUNT)
-      max_count = MAX_ADAPTIVE_SPIN_COUNT;
+    if (max_count > max_spin)
+      max_count = max_spin;
 
     for (spin_count = 0; spin_count < max_count; spin_count++) {
       if (((oldstatus = lock->__status) & 1) == 0) {
 	if(__compare_and_swap(&lock->__status, oldstatus, oldstatus | 1))
 	{
-	  if (spin_count)
-	    lock->__spinlock += (spin_count - lock->__spinlock) / 8;
+	  if (spin_count) {
+	    lock->__spinlock += (spin_count - lock->__spinlock)
+				/ __pthread_spin_decay;
+	    if (stats)
+	      __pthread_spin_acquired++;
+	  }
 	  READ_MEMORY_BARRIER();
 	  return;
 	}
       }
+      /* No point in spinning while the owner is not running: it cannot
+	 release the lock before it has been woken up.  */
+      if (ownerp != NULL && (owner = *ownerp) != 0
+	  && __pthread_handles[owner - 1].h_suspended)
+	break;
 #ifdef BUSY_WAIT_NOP
       BUSY_WAIT_NOP;
 #endif
       __asm __volatile ("" : "=m" (lock->__status) : "0" (lock->__status));
     }
 
-    lock->__spinlock += (spin_count - lock->__spinlock) / 8;
+    lock->__spinlock += (spin_count - lock->__spinlock) / __pthread_spin_decay;
   }
 
 again:
@@ -144,6 +186,8 @@ again:
      queue, and may be resumed by a condition signal. */
 
   if (!successful_seizure) {
+    if (stats && __pthread_smp_kernel && max_spin > 0)
+      __pthread_spin_suspended++;
     for (;;) {
       suspend(self);
       if (self->p_nextlock != NULL) {
@@ -164,12 +208,32 @@ again:
 #endif
 }
 
+void internal_function __pthread_lock(struct _pthread_fastlock * lock,
+				      pthread_descr self)
+{
+  __pthread_lock_internal(lock, self, __pthread_spin_max, NULL, 0);
+}
+
+/* Lock an adaptive mutex.  MAX_SPIN overrides __pthread_spin_max if it
+   is non-negative.  OWNERP points to the handle number plus one of the
+   thread holding the lock, or to zero if it is unknown.  */
+
+void internal_function __pthread_adaptive_lock(struct _pthread_fastlock * lock,
+					       pthread_descr self,
+					       int max_spin, int * ownerp)
+{
+  if (max_spin < 0)
+    max_spin = __pthread_spin_max;
+  __pthread_lock_internal(lock, self, max_spin,
+			  __pthread_spin_owner ? ownerp : NULL, 1);
+}
+
 int __pthread_unlock(struct _pthread_fastlock * lock)
 {
 #if defined HAS_COMPARE_AND_SWAP
   long oldstatus;
-  pthread_descr thr, * ptr, * maxptr;
-  int maxprio;
+  pthread_descr thr, first;
+  struct _pthread_wait_link *sorted, *arrived, *wl;
 #endif
 
 #if defined TEST_FOR_COMPARE_AND_SWAP
@@ -192,52 +256,67 @@ again:
       return 0;
   }
 
-  /* Find thread in waiting queue with maximal priority */
-  ptr = (pthread_descr *) &lock->__status;
-  thr = (pthread_descr) (oldstatus & ~1L);
-  maxprio = 0;
-  maxptr = ptr;
+  /* Take the waiting list out of the lock, leaving the lock taken.  New
+     threads can still add themselves to the (now empty) list, but
+     nobody else can look at the threads we took. */
+  if (! __compare_and_swap(&lock->__status, oldstatus, 1))
+    goto again;
 
-  /* Before we iterate over the wait queue, we need to execute
-     a read barrier, otherwise we may read stale contents of nodes that may
-     just have been inserted by other processors. One read barrier is enough to
-     ensure we have a stable list; we don't need one for each pointer chase
-     through the list, because we are the owner of the lock; other threads
-     can only add nodes at the front; if a front node is consistent,
-     the ones behind it must also be. */
+  /* One read barrier is enough to ensure we have a stable list; other
+     threads can only add nodes at the front, and if a front node is
+     consistent, the ones behind it must also be. */
 
   READ_MEMORY_BARRIER();
 
-  while (thr != 0) {
-    if (thr->p_priority >= maxprio) {
-      maxptr = ptr;
-      maxprio = thr->p_priority;
-    }
-    ptr = &(thr->p_nextlock);
+  /* The new arrivals are in front of the sorted threads, newest first.
+     Reverse them through their wl_next fields, then insert them into the
+     sorted queue oldest first, so that equal priority threads are woken
+     in arrival order. */
+  arrived = NULL;
+  thr = (pthread_descr) (oldstatus & ~1L);
+  while (thr != NULL && !thr->p_lockq_first) {
+    thr->p_locklink.wl_next = arrived;
+    arrived = &thr->p_locklink;
     thr = (pthread_descr)((long)(thr->p_nextlock) & ~1L);
   }
+  sorted = NULL;
+  if (thr != NULL) {
+    thr->p_lockq_first = 0;
+    sorted = &thr->p_locklink;
+  }
+  while (arrived != NULL) {
+    wl = arrived;
+    arrived = wl->wl_next;
+    wait_link_insert(&sorted, wl, lock_thread(wl)->p_priority);
+  }
 
-  /* Remove max prio thread from waiting list. */
-  if (maxptr == (pthread_descr *) &lock->__status) {
-    /* If max prio thread is at head, remove it with compare-and-swap
-       to guard against concurrent lock operation. This removal
-       also has the side effect of marking the lock as released
-       because the new status comes from thr->p_nextlock whose
-       least significant bit is clear. */
-    thr = (pthread_descr) (oldstatus & ~1L);
-    if (! __compare_and_swap_with_release_semantics
-	    (&lock->__status, oldstatus, (long)(thr->p_nextlock) & ~1L))
-      goto again;
-  } else {
-    /* No risk of concurrent access, remove max prio thread normally.
-       But in this case we must also flip the least significant bit
-       of the status to mark the lock as released. */
-    thr = (pthread_descr)((long)*maxptr & ~1L);
-    *maxptr = thr->p_nextlock;
-
-    /* Ensure deletion from linked list completes before we
-       release the lock. */
-    WRITE_MEMORY_BARRIER();
+  /* Remove the highest priority, oldest waiting thread. */
+  thr = lock_thread(wait_link_first(&sorted));
+
+  /* Put the other threads back behind those which arrived in the
+     meantime, and mark the lock as released.  The oldest of the
+     meantime arrivals is the one whose p_nextlock points to no thread. */
+  first = NULL;
+  if (sorted != NULL) {
+    first = lock_thread(sorted);
+    first->p_lockq_first = 1;
+  }
+  WRITE_MEMORY_BARRIER();
+
+  if (! __compare_and_swap_with_release_semantics(&lock->__status,
+						  1, (long) first)) {
+    if (first != NULL) {
+      pthread_descr last = (pthread_descr) (lock->__status & ~1L);
+
+      READ_MEMORY_BARRIER();
+
+      while (((long)(last->p_nextlock) & ~1L) != 0)
+	last = (pthread_descr)((long)(last->p_nextlock) & ~1L);
+      last->p_nextlock = (pthread_descr) ((long) first | 1);
+
+      /* Ensure the insertion completes before we release the lock. */
+      WRITE_MEMORY_BARRIER();
+    }
 
     do {
       oldstatus = lock->__status;
@@ -257,6 +336,184 @@ again:
 #endif
 }
 
+/* Queued fastlocks are a variant of the MCS queue lock in which the lock
+   itself stores the successor of the lock holder, so that a thread needs
+   its queue node only while it waits.  The queue node is therefore
+   simply part of the thread descriptor.
+
+   The status field has the following meanings:
+
+   status == 0:       lock is free
+   status == 1:       lock is taken; no thread is waiting on it
+   otherwise:         lock is taken and status points to the last
+                      waiting thread; waiting threads are linked in
+		      FIFO order via the p_qlock_next field.
+
+   The spinlock field holds p_nr + 1 of the first waiting thread, or 0 if
+   it is not known yet.  Each waiter spins on its own p_qlock_wait field,
+   and then goes to sleep after changing it from QLOCK_SPINNING to
+   QLOCK_SLEEPING.  The lock is handed over to the first waiting thread
+   by clearing that field.  Waiters are served strictly in arrival
+   order, regardless of priority. */
+
+#define QLOCK_SPINNING 1
+#define QLOCK_SLEEPING 2
+
+void __pthread_queue_lock(struct _pthread_fastlock * lock,
+			  pthread_descr self)
+{
+#if defined HAS_COMPARE_AND_SWAP
+  long oldstatus;
+  pthread_descr next;
+  int spurious_wakeup_count, spin_count;
+#endif
+
+#if defined TEST_FOR_COMPARE_AND_SWAP
+  if (!__pthread_has_cas)
+#endif
+#if !defined HAS_COMPARE_AND_SWAP || defined TEST_FOR_COMPARE_AND_SWAP
+  {
+    __pthread_acquire(&lock->__spinlock);
+    return;
+  }
+#endif
+
+#if defined HAS_COMPARE_AND_SWAP
+  /* First try it without preparation.  Maybe it's a completely
+     uncontested lock.  */
+  if (lock->__status == 0 && __compare_and_swap (&lock->__status, 0, 1))
+    return;
+
+  if (self == NULL)
+    self = thread_self();
+
+  /* Append ourselves to the queue, or take the lock if it became free. */
+  for (;;) {
+    oldstatus = lock->__status;
+    if (oldstatus == 0) {
+      if (__compare_and_swap (&lock->__status, 0, 1)) {
+	READ_MEMORY_BARRIER();
+	return;
+      }
+      continue;
+    }
+    self->p_qlock_next = NULL;
+    self->p_qlock_wait = QLOCK_SPINNING;
+    /* Make sure these stores complete before performing the
+       compare-and-swap */
+    MEMORY_BARRIER();
+    if (__compare_and_swap (&lock->__status, oldstatus, (long) self))
+      break;
+  }
+
+  /* Tell our predecessor, or the lock holder if there is none, about us. */
+  if (oldstatus == 1)
+    lock->__spinlock = self->p_nr + 1;
+  else
+    ((pthread_descr) oldstatus)->p_qlock_next = self;
+  WRITE_MEMORY_BARRIER();
+
+  /* Wait for the lock to be handed over. */
+  if (__pthread_smp_kernel) {
+    for (spin_count = 0; spin_count < MAX_QUEUED_SPIN_COUNT; spin_count++) {
+      if (self->p_qlock_wait != QLOCK_SPINNING)
+	break;
+#ifdef BUSY_WAIT_NOP
+      BUSY_WAIT_NOP;
+#endif
+      __asm __volatile ("" : "=m" (self->p_qlock_wait)
+			: "0" (self->p_qlock_wait));
+    }
+  }
+
+  if (__compare_and_swap (&self->p_qlock_wait, QLOCK_SPINNING,
+			  QLOCK_SLEEPING)) {
+    spurious_wakeup_count = 0;
+    for (;;) {
+      suspend(self);
+      if (self->p_qlock_wait != 0) {
+	/* Count resumes that don't belong to us. */
+	spurious_wakeup_count++;
+	continue;
+      }
+      break;
+    }
+    /* Put back any resumes we caught that don't belong to us. */
+    while (spurious_wakeup_count--)
+      restart(self);
+  }
+
+  READ_MEMORY_BARRIER();
+
+  /* We own the lock.  Move our successor into the lock, so that our
+     descriptor can be used to wait on another lock.  If there is no
+     successor, try to mark the queue as empty; if that fails a new waiter
+     is about to link itself behind us. */
+  next = self->p_qlock_next;
+  if (next == NULL) {
+    lock->__spinlock = 0;
+    if (__compare_and_swap (&lock->__status, (long) self, 1))
+      return;
+    while ((next = self->p_qlock_next) == NULL) {
+#ifdef BUSY_WAIT_NOP
+      BUSY_WAIT_NOP;
+#endif
+      __asm __volatile ("" : "=m" (self->p_qlock_next)
+			: "0" (self->p_qlock_next));
+    }
+  }
+  lock->__spinlock = next->p_nr + 1;
+#endif
+}
+
+int __pthread_queue_unlock(struct _pthread_fastlock * lock)
+{
+#if defined HAS_COMPARE_AND_SWAP
+  pthread_descr thr;
+  int nr;
+#endif
+
+#if defined TEST_FOR_COMPARE_AND_SWAP
+  if (!__pthread_has_cas)
+#endif
+#if !defined HAS_COMPARE_AND_SWAP || defined TEST_FOR_COMPARE_AND_SWAP
+  {
+    __pthread_release(&lock->__spinlock);
+    return 0;
+  }
+#endif
+
+#if defined HAS_COMPARE_AND_SWAP
+  WRITE_MEMORY_BARRIER();
+
+  nr = lock->__spinlock;
+  if (nr == 0) {
+    if (__compare_and_swap_with_release_semantics (&lock->__status, 1, 0))
+      return 0;
+    /* A thread is queueing up behind us; wait until it is linked in. */
+    while ((nr = lock->__spinlock) == 0) {
+#ifdef BUSY_WAIT_NOP
+      BUSY_WAIT_NOP;
+#endif
+      __asm __volatile ("" : "=m" (lock->__spinlock)
+			: "0" (lock->__spinlock));
+    }
+    READ_MEMORY_BARRIER();
+  }
+
+  /* Hand the lock over to the first waiting thread.  It takes care of
+     updating the spinlock field.  If it has gone to sleep, wake it up. */
+  thr = __pthread_handles[nr - 1].h_descr;
+  if (! __compare_and_swap_with_release_semantics (&thr->p_qlock_wait,
+						   QLOCK_SPINNING, 0)) {
+    thr->p_qlock_wait = 0;
+    restart(thr);
+  }
+
+  return 0;
+#endif
+}
+
 /*
  * Alternate fastlocks do not queue threads directly. Instead, they queue
  * these wait queue node structures. When a timed wait wakes up due to
@@ -270,89 +527,142 @@ struct wait_node {
   struct wait_node *next;	/* Next node in null terminated linked list */
   pthread_descr thr;		/* The thread waiting with this node */
   int abandoned;		/* Atomic flag */
+  int first;			/* First of the sorted nodes */
+  struct _pthread_wait_link link; /* Link among the sorted nodes */
+  struct wait_node *next_magazine; /* Next magazine in the depot */
 };
 
-static long wait_node_free_list;
-static int wait_node_free_list_spinlock;
+#define link_node(wl) \
+  ((struct wait_node *) ((char *) (wl) - offsetof(struct wait_node, link)))
+
+/* Free wait nodes are cached per thread, in the p_wait_nodes list of
+   the descriptor, so that allocating and freeing a node normally touches
+   no shared data.  When a thread's cache holds WAIT_NODE_CACHE_SIZE
+   nodes, the whole cache moves as one magazine to a global depot,
+   a stack of full magazines linked through their first node.  A thread
+   with an empty cache takes a magazine from the depot, and only calls
+   malloc if the depot is empty too.
+
+   The depot is lock-free.  Magazines are pushed one at a time, but
+   taken by emptying the whole depot and pushing back all magazines but
+   one.  Neither operation follows a pointer read before its
+   compare-and-swap, so there is no ABA problem, and nodes can be given
+   back to the system: a magazine which would make the depot hold more
+   than WAIT_NODE_DEPOT_SIZE magazines is freed instead, and so are the
+   nodes cached by a thread when it is freed.  */
+
+static long wait_node_depot;
+static int wait_node_depot_spinlock;
+static struct pthread_atomic wait_node_depot_count;
+
+static void wait_node_free_all(struct wait_node *wn)
+{
+  struct wait_node *next;
 
-/* Allocate a new node from the head of the free list using an atomic
-   operation, or else using malloc if that list is empty.  A fundamental
-   assumption here is that we can safely access wait_node_free_list->next.
-   That's because we never free nodes once we allocate them, so a pointer to a
-   node remains valid indefinitely. */
+  for (; wn != NULL; wn = next) {
+    next = wn->next;
+    free(wn);
+  }
+}
 
-static struct wait_node *wait_node_alloc(void)
+static void wait_node_depot_put(struct wait_node *mag)
 {
-    struct wait_node *new_node = 0;
-
-    __pthread_acquire(&wait_node_free_list_spinlock);
-    if (wait_node_free_list != 0) {
-      new_node = (struct wait_node *) wait_node_free_list;
-      wait_node_free_list = (long) new_node->next;
-    }
-    WRITE_MEMORY_BARRIER();
-    __pthread_release(&wait_node_free_list_spinlock);
+  long oldvalue;
 
-    if (new_node == 0)
-      return malloc(sizeof *wait_node_alloc());
+  if (atomic_increment(&wait_node_depot_count) >= WAIT_NODE_DEPOT_SIZE) {
+    atomic_decrement(&wait_node_depot_count);
+    wait_node_free_all(mag);
+    return;
+  }
 
-    return new_node;
+  do {
+    oldvalue = wait_node_depot;
+    mag->next_magazine = (struct wait_node *) oldvalue;
+    /* Make sure the store completes before performing the
+       compare-and-swap */
+    WRITE_MEMORY_BARRIER();
+  } while (! compare_and_swap(&wait_node_depot, oldvalue, (long) mag,
+			      &wait_node_depot_spinlock));
 }
 
-/* Return a node to the head of the free list using an atomic
-   operation. */
-
-static void wait_node_free(struct wait_node *wn)
+static struct wait_node *wait_node_depot_get(void)
 {
-    __pthread_acquire(&wait_node_free_list_spinlock);
-    wn->next = (struct wait_node *) wait_node_free_list;
-    wait_node_free_list = (long) wn;
-    WRITE_MEMORY_BARRIER();
-    __pthread_release(&wait_node_free_list_spinlock);
-    return;
-}
+  long oldvalue;
+  struct wait_node *mag, *rest, *last;
 
-#if defined HAS_COMPARE_AND_SWAP
+  do {
+    oldvalue = wait_node_depot;
+    if (oldvalue == 0)
+      return NULL;
+  } while (! compare_and_swap(&wait_node_depot, oldvalue, 0,
+			      &wait_node_depot_spinlock));
 
-/* Remove a wait node from the specified queue.  It is assumed
-   that the removal takes place concurrently with only atomic insertions at the
-   head of the queue. */
+  READ_MEMORY_BARRIER();
 
-static void wait_node_dequeue(struct wait_node **pp_head,
-			      struct wait_node **pp_node,
-			      struct wait_node *p_node)
-{
-  /* If the node is being deleted from the head of the
-     list, it must be deleted using atomic compare-and-swap.
-     Otherwise it can be deleted in the straightforward way. */
+  mag = (struct wait_node *) oldvalue;
+  rest = mag->next_magazine;
+  if (rest != NULL) {
+    for (last = rest; last->next_magazine != NULL; last = last->next_magazine)
+      continue;
+    do {
+      oldvalue = wait_node_depot;
+      last->next_magazine = (struct wait_node *) oldvalue;
+      WRITE_MEMORY_BARRIER();
+    } while (! compare_and_swap(&wait_node_depot, oldvalue, (long) rest,
+				&wait_node_depot_spinlock));
+  }
+  atomic_decrement(&wait_node_depot_count);
 
-  if (pp_node == pp_head) {
-    /* We don't need a read barrier between these next two loads,
-       because it is assumed that the caller has already ensured
-       the stability of *p_node with respect to p_node. */
+  return mag;
+}
 
-    long oldvalue = (long) p_node;
-    long newvalue = (long) p_node->next;
+/* Allocate a new node from the cache of the calling thread, refilling
+   the cache from the depot if it is empty, or else using malloc. */
 
-    if (__compare_and_swap((long *) pp_node, oldvalue, newvalue))
-      return;
+static struct wait_node *wait_node_alloc(void)
+{
+  pthread_descr self = thread_self();
+  struct wait_node *new_node = THREAD_GETMEM(self, p_wait_nodes);
+  int count = THREAD_GETMEM(self, p_wait_nodes_count);
+
+  if (new_node == NULL) {
+    new_node = wait_node_depot_get();
+    if (new_node == NULL)
+      return malloc(sizeof *new_node);
+    count = WAIT_NODE_CACHE_SIZE;
+  }
+  THREAD_SETMEM(self, p_wait_nodes, new_node->next);
+  THREAD_SETMEM(self, p_wait_nodes_count, count - 1);
 
-    /* Oops! Compare and swap failed, which means the node is
-       no longer first. We delete it using the ordinary method.  But we don't
-       know the identity of the node which now holds the pointer to the node
-       being deleted, so we must search from the beginning. */
+  return new_node;
+}
 
-    for (pp_node = pp_head; p_node != *pp_node; ) {
-      pp_node = &(*pp_node)->next;
-      READ_MEMORY_BARRIER(); /* Stabilize *pp_node for next iteration. */
-    }
-  }
+/* Return a node to the cache of the calling thread, first moving the
+   cache to the depot if it is full. */
 
-  *pp_node = p_node->next;
-  return;
+static void wait_node_free(struct wait_node *wn)
+{
+  pthread_descr self = thread_self();
+  int count = THREAD_GETMEM(self, p_wait_nodes_count);
+
+  if (count == WAIT_NODE_CACHE_SIZE) {
+    wait_node_depot_put(THREAD_GETMEM(self, p_wait_nodes));
+    count = 0;
+    wn->next = NULL;
+  } else
+    wn->next = THREAD_GETMEM(self, p_wait_nodes);
+  THREAD_SETMEM(self, p_wait_nodes, wn);
+  THREAD_SETMEM(self, p_wait_nodes_count, count + 1);
 }
 
-#endif
+/* Free the wait nodes cached by thread TH, which has terminated. */
+
+void __pthread_free_wait_nodes(pthread_descr th)
+{
+  wait_node_free_all(th->p_wait_nodes);
+  th->p_wait_nodes = NULL;
+  th->p_wait_nodes_count = 0;
+}
 
 void __pthread_alt_lock(struct _pthread_fastlock * lock,
 		        pthread_descr self)
@@ -377,6 +687,7 @@ void __pthread_alt_lock(struct _pthread_fastlock * lock,
 	self = thread_self();
 
       wait_node.abandoned = 0;
+      wait_node.first = 0;
       wait_node.next = (struct wait_node *) lock->__status;
       wait_node.thr = self;
       lock->__status = (long) &wait_node;
@@ -403,6 +714,7 @@ void __pthread_alt_lock(struct _pthread_fastlock * lock,
       newstatus = (long) &wait_node;
     }
     wait_node.abandoned = 0;
+    wait_node.first = 0;
     wait_node.next = (struct wait_node *) oldstatus;
     /* Make sure the store in wait_node.next completes before performing
        the compare-and-swap */
@@ -452,6 +764,7 @@ int __pthread_alt_timedlock(struct _pthread_fastlock * lock,
 	self = thread_self();
 
       p_wait_node->abandoned = 0;
+      p_wait_node->first = 0;
       p_wait_node->next = (struct wait_node *) lock->__status;
       p_wait_node->thr = self;
       lock->__status = (long) p_wait_node;
@@ -475,6 +788,7 @@ int __pthread_alt_timedlock(struct _pthread_fastlock * lock,
       newstatus = (long) p_wait_node;
     }
     p_wait_node->abandoned = 0;
+    p_wait_node->first = 0;
     p_wait_node->next = (struct wait_node *) oldstatus;
     /* Make sure the store in wait_node.next completes before performing
        the compare-and-swap */
@@ -513,9 +827,17 @@ int __pthread_alt_timedlock(struct _pthread_fastlock * lock,
 
 void __pthread_alt_unlock(struct _pthread_fastlock *lock)
 {
-  struct wait_node *p_node, **pp_node, *p_max_prio, **pp_max_prio;
+  struct wait_node *p_node;
+#if defined HAS_COMPARE_AND_SWAP
+  struct wait_node *p_next, *p_first;
+  struct _pthread_wait_link *sorted, *arrived, *wl;
+  long oldstatus;
+#endif
+#if !defined HAS_COMPARE_AND_SWAP || defined TEST_FOR_COMPARE_AND_SWAP
+  struct wait_node **pp_node, *p_max_prio, **pp_max_prio;
   struct wait_node ** const pp_head = (struct wait_node **) &lock->__status;
   int maxprio;
+#endif
 
   WRITE_MEMORY_BARRIER();
 
@@ -525,133 +847,240 @@ void __pthread_alt_unlock(struct _pthread_fastlock *lock)
 #if !defined HAS_COMPARE_AND_SWAP || defined TEST_FOR_COMPARE_AND_SWAP
   {
     __pthread_acquire(&lock->__spinlock);
-  }
-#endif
 
-  while (1) {
+    while (1) {
 
-  /* If no threads are waiting for this lock, try to just
-     atomically release it. */
-#if defined TEST_FOR_COMPARE_AND_SWAP
-    if (!__pthread_has_cas)
-#endif
-#if !defined HAS_COMPARE_AND_SWAP || defined TEST_FOR_COMPARE_AND_SWAP
-    {
+      /* If no threads are waiting for this lock, just release it. */
       if (lock->__status == 0 || lock->__status == 1) {
 	lock->__status = 0;
 	break;
       }
-    }
-#endif
 
-#if defined TEST_FOR_COMPARE_AND_SWAP
-    else
-#endif
+      /* Process the entire queue of wait nodes. Remove all abandoned
+	 wait nodes and put them into the global free queue, and
+	 remember the one unabandoned node which refers to the thread
+	 having the highest priority. */
 
-#if defined HAS_COMPARE_AND_SWAP
-    {
-      long oldstatus = lock->__status;
-      if (oldstatus == 0 || oldstatus == 1) {
-	if (__compare_and_swap_with_release_semantics (&lock->__status, oldstatus, 0))
-	  break;
-	else
+      pp_max_prio = pp_node = pp_head;
+      p_max_prio = p_node = *pp_head;
+      maxprio = INT_MIN;
+
+      while (p_node != (struct wait_node *) 1) {
+	int prio;
+
+	if (p_node->abandoned) {
+	  /* Remove abandoned node. */
+	  *pp_node = p_node->next;
+	  wait_node_free(p_node);
+	  p_node = *pp_node;
 	  continue;
+	} else if ((prio = p_node->thr->p_priority) >= maxprio) {
+	  /* Otherwise remember it if its thread has a higher or equal
+	     priority compared to that of any node seen thus far. */
+	  maxprio = prio;
+	  pp_max_prio = pp_node;
+	  p_max_prio = p_node;
+	}
+
+	pp_node = &p_node->next;
+	p_node = *pp_node;
+      }
+
+      /* If all threads abandoned, go back to top */
+      if (maxprio == INT_MIN)
+	continue;
+
+      ASSERT (p_max_prio != (struct wait_node *) 1);
+
+      /* Now we want to to remove the max priority thread's wait node from
+	 the list. Before we can do this, we must atomically try to change
+	 the node's abandon state from zero to nonzero. If we succeed, that
+	 means we have the node that we will wake up. If we failed, then it
+	 means the thread timed out and abandoned the node in which case we
+	 repeat the whole unlock operation. */
+
+      if (!testandset(&p_max_prio->abandoned)) {
+	*pp_max_prio = p_max_prio->next;
+	restart(p_max_prio->thr);
+	break;
       }
     }
+
+    __pthread_release(&lock->__spinlock);
+    return;
+  }
 #endif
 
-    /* Process the entire queue of wait nodes. Remove all abandoned
-       wait nodes and put them into the global free queue, and
-       remember the one unabandoned node which refers to the thread
-       having the highest priority. */
+#if defined HAS_COMPARE_AND_SWAP
+  /* The nodes are kept like the threads waiting on a __pthread_lock
+     lock: new arrivals are stacked in front of the nodes sorted by
+     earlier unlocks, the first of which has its first flag set.  The
+     lock stays taken while we reorder the nodes, since it is handed
+     over directly to the thread we wake up. */
+
+  while (1) {
+    oldstatus = lock->__status;
+
+    /* If no threads are waiting for this lock, try to just
+       atomically release it. */
+    if (oldstatus == 0 || oldstatus == 1) {
+      if (__compare_and_swap_with_release_semantics (&lock->__status,
+						     oldstatus, 0))
+	break;
+      else
+	continue;
+    }
 
-    pp_max_prio = pp_node = pp_head;
-    p_max_prio = p_node = *pp_head;
-    maxprio = INT_MIN;
+    /* Take the wait nodes out of the lock. */
+    if (! __compare_and_swap (&lock->__status, oldstatus, 1))
+      continue;
 
     READ_MEMORY_BARRIER(); /* Prevent access to stale data through p_node */
 
-    while (p_node != (struct wait_node *) 1) {
-      int prio;
-
+    /* Put the new arrivals into the sorted queue oldest first, freeing
+       those which have already been abandoned. */
+    arrived = NULL;
+    for (p_node = (struct wait_node *) oldstatus;
+	 p_node != (struct wait_node *) 1 && !p_node->first;
+	 p_node = p_next) {
+      p_next = p_node->next;
       if (p_node->abandoned) {
-	/* Remove abandoned node. */
-#if defined TEST_FOR_COMPARE_AND_SWAP
-	if (!__pthread_has_cas)
-#endif
-#if !defined HAS_COMPARE_AND_SWAP || defined TEST_FOR_COMPARE_AND_SWAP
-	  *pp_node = p_node->next;
-#endif
-#if defined TEST_FOR_COMPARE_AND_SWAP
-	else
-#endif
-#if defined HAS_COMPARE_AND_SWAP
-	  wait_node_dequeue(pp_head, pp_node, p_node);
-#endif
 	wait_node_free(p_node);
-	/* Note that the next assignment may take us to the beginning
-	   of the queue, to newly inserted nodes, if pp_node == pp_head.
-	   In that case we need a memory barrier to stabilize the first of
-	   these new nodes. */
-	p_node = *pp_node;
-	if (pp_node == pp_head)
-	  READ_MEMORY_BARRIER(); /* No stale reads through p_node */
 	continue;
-      } else if ((prio = p_node->thr->p_priority) >= maxprio) {
-	/* Otherwise remember it if its thread has a higher or equal priority
-	   compared to that of any node seen thus far. */
-	maxprio = prio;
-	pp_max_prio = pp_node;
-	p_max_prio = p_node;
       }
+      p_node->link.wl_next = arrived;
+      arrived = &p_node->link;
+    }
+    sorted = NULL;
+    if (p_node != (struct wait_node *) 1) {
+      p_node->first = 0;
+      sorted = &p_node->link;
+    }
+    while (arrived != NULL) {
+      wl = arrived;
+      arrived = wl->wl_next;
+      wait_link_insert(&sorted, wl, link_node(wl)->thr->p_priority);
+    }
+
+    /* Take the first node whose thread has not timed out.  We must
+       atomically change the node's abandon state from zero to nonzero;
+       if this fails, the thread abandoned the node. */
+    while ((wl = wait_link_first(&sorted)) != NULL) {
+      p_node = link_node(wl);
+      if (!testandset(&p_node->abandoned))
+	break;
+      wait_node_free(p_node);
+    }
 
-      /* This canno6 jump backward in the list, so no further read
-         barrier is needed. */
-      pp_node = &p_node->next;
-      p_node = *pp_node;
+    /* Put the remaining nodes back behind those which arrived in the
+       meantime.  If we found a thread to wake up the lock stays taken,
+       otherwise we release it unless new threads have arrived. */
+    p_first = (struct wait_node *) 1;
+    if (sorted != NULL) {
+      p_first = link_node(sorted);
+      p_first->first = 1;
     }
+    WRITE_MEMORY_BARRIER();
 
-    /* If all threads abandoned, go back to top */
-    if (maxprio == INT_MIN)
+    if (wl == NULL) {
+      ASSERT (sorted == NULL);
+      if (__compare_and_swap_with_release_semantics (&lock->__status, 1, 0))
+	break;
       continue;
+    }
 
-    ASSERT (p_max_prio != (struct wait_node *) 1);
+    if (! __compare_and_swap (&lock->__status, 1, (long) p_first)
+	&& p_first != (struct wait_node *) 1) {
+      struct wait_node *p_last = (struct wait_node *) lock->__status;
 
-    /* Now we want to to remove the max priority thread's wait node from
-       the list. Before we can do this, we must atomically try to change the
-       node's abandon state from zero to nonzero. If we succeed, that means we
-       have the node that we will wake up. If we failed, then it means the
-       thread timed out and abandoned the node in which case we repeat the
-       whole unlock operation. */
+      READ_MEMORY_BARRIER();
 
-    if (!testandset(&p_max_prio->abandoned)) {
-#if defined TEST_FOR_COMPARE_AND_SWAP
-      if (!__pthread_has_cas)
-#endif
-#if !defined HAS_COMPARE_AND_SWAP || defined TEST_FOR_COMPARE_AND_SWAP
-	*pp_max_prio = p_max_prio->next;
-#endif
-#if defined TEST_FOR_COMPARE_AND_SWAP
-      else
-#endif
-#if defined HAS_COMPARE_AND_SWAP
-	wait_node_dequeue(pp_head, pp_max_prio, p_max_prio);
-#endif
-      restart(p_max_prio->thr);
-      break;
+      while (p_last->next != (struct wait_node *) 1)
+	p_last = p_last->next;
+      p_last->next = p_first;
     }
+
+    restart(p_node->thr);
+    break;
   }
+#endif
+}
 
-#if defined TEST_FOR_COMPARE_AND_SWAP
-  if (!__pthread_has_cas)
+
+/* Futex locks (see spinlock.h) */
+
+/* Sleep as long as *WORD contains VAL, until the time ABSTIME on CLOCK
+   (CLOCK_REALTIME or CLOCK_MONOTONIC) if ABSTIME is not NULL.  The futex
+   compares the half of *WORD holding the least significant bits, so
+   values must fit in an int.  Return 0 or an error code; anything but
+   ETIMEDOUT is a spurious wakeup.  */
+
+int __pthread_futex_sleep(long * word, long val, clockid_t clock,
+			  const struct timespec * abstime)
+{
+#ifdef __NR_futex
+  return __pthread_futex_wait_until(__futex_word(word), (int) val, clock,
+				    abstime);
+#else
+  return ENOSYS;
 #endif
-#if !defined HAS_COMPARE_AND_SWAP || defined TEST_FOR_COMPARE_AND_SWAP
-  {
-    __pthread_release(&lock->__spinlock);
-  }
+}
+
+/* Wake up at most NR threads sleeping on *WORD, in any process. */
+
+void __pthread_futex_wakeup(long * word, int nr)
+{
+#ifdef __NR_futex
+  __futex_wake(__futex_word(word), nr);
 #endif
 }
 
+static inline long futex_lock_exchange(struct _pthread_fastlock * lock,
+				       long newval)
+{
+  long oldval;
+
+  do
+    oldval = lock->__status;
+  while (! compare_and_swap(&lock->__status, oldval, newval,
+			    &lock->__spinlock));
+  return oldval;
+}
+
+/* Slow path of __pthread_futex_lock: mark the lock contended and sleep
+   until it is free.  If SELF is not NULL, it is flagged as suspended
+   while it sleeps.  Return 0 or ETIMEDOUT.  */
+
+int __pthread_futex_lock_wait(struct _pthread_fastlock * lock,
+			      pthread_descr self,
+			      const struct timespec * abstime)
+{
+  while (futex_lock_exchange(lock, FUTEX_LOCK_CONTENDED) != FUTEX_LOCK_FREE) {
+    int err;
+
+    if (self != NULL)
+      set_suspended(self, 1);
+    err = __pthread_futex_sleep(&lock->__status, FUTEX_LOCK_CONTENDED,
+				CLOCK_REALTIME, abstime);
+    if (self != NULL)
+      set_suspended(self, 0);
+    if (err == ETIMEDOUT)
+      return ETIMEDOUT;
+  }
+  READ_MEMORY_BARRIER();
+  return 0;
+}
+
+/* Slow path of __pthread_futex_unlock, for a contended lock.  Nobody
+   else can change its status now, except to mark it contended again. */
+
+void __pthread_futex_unlock_wake(struct _pthread_fastlock * lock)
+{
+  WRITE_MEMORY_BARRIER();
+  lock->__status = FUTEX_LOCK_FREE;
+  __pthread_futex_wakeup(&lock->__status, 1);
+}
+
 
 /* Compare-and-swap emulation with a spinlock */
 
@@ -682,39 +1111,114 @@ int __pthread_compare_and_swap(long * ptr, long oldval, long newval,
 #endif
 
 /* The retry strategy is as follows:
-   - We test and set the spinlock MAX_SPIN_COUNT times, calling
-     sched_yield() each time.  This gives ample opportunity for other
-     threads with priority >= our priority to make progress and
-     release the spinlock.
-   - If a thread with priority < our priority owns the spinlock,
-     calling sched_yield() repeatedly is useless, since we're preventing
-     the owning thread from making progress and releasing the spinlock.
-     So, after MAX_SPIN_LOCK attemps, we suspend the calling thread
-     using nanosleep().  This again should give time to the owning thread
-     for releasing the spinlock.
+   - On SMP, we spin SPIN_PAUSE_COUNT times waiting for the spinlock to
+     look free, and try to take it when it does.  Spinning only reads the
+     spinlock, so it does not slow down the owning thread.
+   - We then test and set the spinlock MAX_SPIN_COUNT times, backing off
+     in between.  On SMP we spin for a random number of rounds below a
+     bound which doubles each time, up to MAX_SPIN_BACKOFF, so that
+     threads which failed together do not retry together.  Otherwise we
+     call sched_yield(), since the owner cannot run while we spin.  This
+     gives ample opportunity for other threads with priority >= our
+     priority to make progress and release the spinlock.
+   - If a thread with priority < our priority owns the spinlock, all of
+     this is useless, since we're preventing the owning thread from
+     making progress and releasing the spinlock.  So we finally go to
+     sleep on the spinlock with the futex system call, after marking it
+     SPINLOCK_CONTENDED, and __pthread_release wakes us up.  Marking the
+     spinlock and taking it is a single exchange, so a release cannot
+     slip in between and the wakeup cannot be missed.  Where spinlocks
+     cannot be exchanged, or without futexes, we nanosleep()
+     SPIN_SLEEP_DURATION instead and try again.
      Notice that the nanosleep() interval must not be too small,
      since the kernel does busy-waiting for short intervals in a realtime
      process (!).  The smallest duration that guarantees thread
-     suspension is currently 2ms.
-   - When nanosleep() returns, we try again, doing MAX_SPIN_COUNT
-     sched_yield(), then sleeping again if needed. */
+     suspension is currently 2ms. */
+
+#if defined HAS_SPINLOCK_EXCHANGE && defined __NR_futex
+# define ACQUIRE_FUTEX	1
+#endif
+
+#ifdef ACQUIRE_FUTEX
+static int acquire_futex_unsupported;
+
+/* Take SPINLOCK, sleeping on it while it is held.  Return 0, or ENOSYS
+   if the kernel has no futexes. */
+
+static int __pthread_acquire_sleep(int * spinlock)
+{
+  while (__spinlock_exchange(spinlock, SPINLOCK_CONTENDED)
+	 != __LT_SPINLOCK_INIT)
+    if (__futex_wait(spinlock, SPINLOCK_CONTENDED, NULL) == ENOSYS) {
+      acquire_futex_unsupported = 1;
+      return ENOSYS;
+    }
+  return 0;
+}
+
+void __pthread_acquire_wake(int * spinlock)
+{
+  __futex_wake(spinlock, 1);
+}
+#elif defined HAS_SPINLOCK_EXCHANGE
+void __pthread_acquire_wake(int * spinlock)
+{
+}
+#endif
 
 static void __pthread_acquire(int * spinlock)
 {
-  int cnt = 0;
-  struct timespec tm;
+  int cnt, bound, rounds;
+  unsigned int seed;
 
   READ_MEMORY_BARRIER();
 
-  while (testandset(spinlock)) {
-    if (cnt < MAX_SPIN_COUNT) {
-      sched_yield();
-      cnt++;
-    } else {
-      tm.tv_sec = 0;
-      tm.tv_nsec = SPIN_SLEEP_DURATION;
-      nanosleep(&tm, NULL);
-      cnt = 0;
+  if (! __pthread_tryacquire(spinlock))
+    return;
+
+  if (__pthread_smp_kernel) {
+    for (cnt = 0; cnt < SPIN_PAUSE_COUNT; cnt++) {
+      if (*spinlock == __LT_SPINLOCK_INIT && ! __pthread_tryacquire(spinlock))
+	return;
+#ifdef BUSY_WAIT_NOP
+      BUSY_WAIT_NOP;
+#endif
+      __asm __volatile ("" : "=m" (*spinlock) : "0" (*spinlock));
     }
   }
+
+  /* Our stack address is as good a seed as any, and differs between
+     the threads contending for the spinlock. */
+  seed = (unsigned int) (unsigned long) &seed;
+  bound = 1;
+
+  for (cnt = 0; cnt < MAX_SPIN_COUNT; cnt++) {
+    if (__pthread_smp_kernel) {
+      seed = seed * 1103515245 + 12345;
+      for (rounds = (seed >> 16) % bound; rounds > 0; rounds--) {
+#ifdef BUSY_WAIT_NOP
+	BUSY_WAIT_NOP;
+#endif
+	__asm __volatile ("" : "=m" (*spinlock) : "0" (*spinlock));
+      }
+      if (bound < MAX_SPIN_BACKOFF)
+	bound *= 2;
+    } else
+      sched_yield();
+
+    if (*spinlock == __LT_SPINLOCK_INIT && ! __pthread_tryacquire(spinlock))
+      return;
+  }
+
+#ifdef ACQUIRE_FUTEX
+  if (!acquire_futex_unsupported && __pthread_acquire_sleep(spinlock) == 0)
+    return;
+#endif
+  while (__pthread_tryacquire(spinlock)) {
+    struct timespec tm;
+
+    tm.tv_sec = 0;
+    tm.tv_nsec = SPIN_SLEEP_DURATION;
+    nanosleep(&tm, NULL);
+  }
 }
@@ -90,12 +90,101 @@ static inline int compare_and_swap(long * ptr, long oldval, long newval,
 #define __compare_and_swap_with_release_semantics __compare_and_swap
 #endif
 
+/* Spinlocks taken with __pthread_acquire.  Where pt-machine.h can
+   exchange any value into a spinlock, a thread which goes to sleep on it
+   sets it to SPINLOCK_CONTENDED, and releasing it wakes up a sleeper
+   only if it was so set.  testandset stores 1 even when it fails, which
+   may wipe out that mark, so __pthread_tryacquire puts it back. */
+
+#ifdef HAS_SPINLOCK_EXCHANGE
+#define SPINLOCK_CONTENDED	2
+
+extern void __pthread_acquire_wake(int * spinlock);
+#endif
+
+/* Try to take a spinlock.  Return 0 if we got it, like testandset. */
+
+static inline long __pthread_tryacquire(int * spinlock)
+{
+  long oldval = testandset(spinlock);
+
+#ifdef HAS_SPINLOCK_EXCHANGE
+  if (__builtin_expect (oldval == SPINLOCK_CONTENDED, 0))
+    oldval = __spinlock_exchange(spinlock, SPINLOCK_CONTENDED);
+#endif
+  return oldval;
+}
+
+/* Release of a spinlock taken with __pthread_acquire. */
+
+static inline void __pthread_release(int * spinlock)
+{
+  WRITE_MEMORY_BARRIER();
+#ifdef HAS_SPINLOCK_EXCHANGE
+  if (__builtin_expect (__spinlock_exchange(spinlock, __LT_SPINLOCK_INIT)
+			== SPINLOCK_CONTENDED, 0))
+    __pthread_acquire_wake(spinlock);
+#else
+  *spinlock = __LT_SPINLOCK_INIT;
+  __asm __volatile ("" : "=m" (*spinlock) : "0" (*spinlock));
+#endif
+}
+
 /* Internal locks */
 
 extern void internal_function __pthread_lock(struct _pthread_fastlock * lock,
 					     pthread_descr self);
 extern int __pthread_unlock(struct _pthread_fastlock *lock);
 
+/* Same as __pthread_lock, with per-lock control of the adaptive spinning,
+   used for PTHREAD_MUTEX_ADAPTIVE_NP mutexes. */
+
+extern void internal_function
+__pthread_adaptive_lock(struct _pthread_fastlock * lock, pthread_descr self,
+			int max_spin, int * ownerp);
+
+extern int __pthread_spin_max;
+extern int __pthread_spin_decay;
+extern int __pthread_spin_owner;
+extern unsigned long __pthread_spin_acquired;
+extern unsigned long __pthread_spin_suspended;
+
+/* Spinning of the waiters of barriers and semaphores, which wait for
+   another thread rather than for a lock.  They keep a moving average of
+   the spins they needed in *AVG, as above, and spin up to twice that
+   average, but never more than MAX_SPIN times, or __pthread_wait_spin_max
+   if MAX_SPIN is -1.  */
+
+extern int __pthread_wait_spin_max;
+
+static inline int __pthread_wait_spin_count(int avg, int max_spin)
+{
+  int max_count;
+
+  if (max_spin < 0)
+    max_spin = __pthread_wait_spin_max;
+  if (! __pthread_smp_kernel || max_spin == 0)
+    return 0;
+  max_count = avg * 2 + 10;
+  if (max_count > max_spin)
+    max_count = max_spin;
+  return max_count;
+}
+
+static inline void __pthread_wait_spin_update(int * avg, int spin_count)
+{
+  *avg += (spin_count - *avg) / __pthread_spin_decay;
+}
+
+/* Variation of internal lock with FIFO handoff, used for
+   PTHREAD_MUTEX_QUEUED_NP mutexes.  Initialization and trylock are the
+   same as for the above ones.  Warning: do not mix these operations with
+   the above ones over the same lock object! */
+
+extern void __pthread_queue_lock(struct _pthread_fastlock * lock,
+				 pthread_descr self);
+extern int __pthread_queue_unlock(struct _pthread_fastlock *lock);
+
 static inline void __pthread_init_lock(struct _pthread_fastlock * lock)
 {
   lock->__status = 0;
@@ -109,7 +198,7 @@ static inline int __pthread_trylock (struct _pthread_fastlock * lock)
 #endif
 #if !defined HAS_COMPARE_AND_SWAP || defined TEST_FOR_COMPARE_AND_SWAP
   {
-    return (testandset(&lock->__spinlock) ? EBUSY : 0);
+    return (__pthread_tryacquire(&lock->__spinlock) ? EBUSY : 0);
   }
 #endif
 
@@ -133,6 +222,8 @@ extern int __pthread_alt_timedlock(struct _pthread_fastlock * lock,
 
 extern void __pthread_alt_unlock(struct _pthread_fastlock *lock);
 
+extern void __pthread_free_wait_nodes(pthread_descr th);
+
 static inline void __pthread_alt_init_lock(struct _pthread_fastlock * lock)
 {
   lock->__status = 0;
@@ -148,7 +239,7 @@ static inline int __pthread_alt_trylock (struct _pthread_fastlock * lock)
   {
     int res = EBUSY;
 
-    if (testandset(&lock->__spinlock) == 0)
+    if (__pthread_tryacquire(&lock->__spinlock) == 0)
       {
 	if (lock->__status == 0)
 	  {
@@ -156,7 +247,7 @@ static inline int __pthread_alt_trylock (struct _pthread_fastlock * lock)
 	    WRITE_MEMORY_BARRIER();
 	    res = 0;
 	  }
-	lock->__spinlock = __LT_SPINLOCK_INIT;
+	__pthread_release(&lock->__spinlock);
       }
     return res;
   }
@@ -170,6 +261,60 @@ static inline int __pthread_alt_trylock (struct _pthread_fastlock * lock)
 #endif
 }
 
+/* Futex locks, used for mutexes when __pthread_futex_mutexes is set and
+   for the internal lock of process-shared objects.  The __status of the
+   fastlock is a futex word which is 0 when the lock is free, 1 when it
+   is locked and 2 when threads may be sleeping on it.  Locking a free
+   lock and unlocking a lock nobody waits for take a single
+   compare-and-swap.  No thread descriptor is involved, so the lock
+   works in memory shared between processes.  Warning: do not mix these
+   operations with the above ones over the same lock object! */
+
+#define FUTEX_LOCK_FREE		0
+#define FUTEX_LOCK_LOCKED	1
+#define FUTEX_LOCK_CONTENDED	2
+
+extern int __pthread_futex_lock_wait(struct _pthread_fastlock * lock,
+				     pthread_descr self,
+				     const struct timespec * abstime);
+extern void __pthread_futex_unlock_wake(struct _pthread_fastlock * lock);
+
+/* Futex wait and wakeup on a long, which also work between processes. */
+
+extern int __pthread_futex_sleep(long * word, long val, clockid_t clock,
+				 const struct timespec * abstime);
+extern void __pthread_futex_wakeup(long * word, int nr);
+
+static inline int __pthread_futex_trylock(struct _pthread_fastlock * lock)
+{
+  if (lock->__status == FUTEX_LOCK_FREE
+      && compare_and_swap(&lock->__status, FUTEX_LOCK_FREE, FUTEX_LOCK_LOCKED,
+			  &lock->__spinlock))
+    return 0;
+  return EBUSY;
+}
+
+/* Return 0, or ETIMEDOUT if ABSTIME is not NULL and has passed. */
+
+static inline int __pthread_futex_lock(struct _pthread_fastlock * lock,
+				       const struct timespec * abstime)
+{
+  if (compare_and_swap(&lock->__status, FUTEX_LOCK_FREE, FUTEX_LOCK_LOCKED,
+		       &lock->__spinlock))
+    return 0;
+  return __pthread_futex_lock_wait(lock, NULL, abstime);
+}
+
+static inline void __pthread_futex_unlock(struct _pthread_fastlock * lock)
+{
+  if (compare_and_swap_with_release_semantics(&lock->__status,
+					      FUTEX_LOCK_LOCKED,
+					      FUTEX_LOCK_FREE,
+					      &lock->__spinlock))
+    return;
+  __pthread_futex_unlock_wake(lock);
+}
+
 /* Operations on pthread_atomic, which is defined in internals.h */
 
 static inline long atomic_increment(struct pthread_atomic *pa)
@@ -0,0 +1,246 @@
+/* Fair POSIX spinlocks.  x86 and x86-64 version.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of the
+   License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; see the file COPYING.LIB.  If not,
+   write to the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+   Boston, MA 02111-1307, USA.  */
+
+/* Besides the plain spinlock, whose values are 1 when free and small
+   non-positive numbers when taken, pthread_spin_init can set up two fair
+   kinds of spinlocks in the same int.  The two high bits tell them apart:
+   they are 00 or 11 for a plain spinlock, 01 for a ticket spinlock and 10
+   for a queued spinlock.
+
+   A ticket spinlock keeps the next ticket to hand out in the low 16 bits
+   and the ticket being served in the next 14 bits.  A thread takes a
+   ticket with a 16-bit exchange-and-add, which wraps around without
+   touching the high half, and spins until its ticket is served.  Since
+   the spinning threads know how many others are ahead of them, they wait
+   proportionally to that between two looks at the lock.  The owner
+   serves the next ticket with a 16-bit store to the high half.
+
+   A queued spinlock is a MCS lock: its low 30 bits are the queue index
+   of the last waiting thread, or 0 if the lock is free.  Each thread
+   spins on a node of its own descriptor, and the releasing thread hands
+   the lock over to the next one in the queue, so that the spinning
+   threads do not share any cache line.  Queue indices cannot be used by
+   other processes, so process-shared spinlocks are never queued.  A
+   thread which has no free node left, and pthread_spin_trylock, take the
+   lock only if it is free, marking it with SPIN_QUEUE_NONODE; nobody
+   enqueues behind that mark.  */
+
+#include <sched.h>
+
+#define SPIN_KIND(val)		((unsigned int) (val) >> 30)
+#define SPIN_KIND_TICKET	1
+#define SPIN_KIND_QUEUE		2
+
+#define SPIN_TICKET_INIT	0x40000000
+#define SPIN_TICKET_NEXT(val)	((val) & 0x3fff)
+#define SPIN_TICKET_SERVED(val)	(((val) >> 16) & 0x3fff)
+
+#define SPIN_QUEUE_INIT		((int) 0x80000000)
+#define SPIN_QUEUE_TAIL(val)	((val) & 0x3fffffff)
+#define SPIN_QUEUE_NONODE	0x3fffffff
+
+/* Number of pause instructions a thread waiting on a ticket spinlock
+   executes for each thread ahead of it before looking again.  */
+#ifndef SPIN_TICKET_BACKOFF
+#define SPIN_TICKET_BACKOFF 50
+#endif
+
+static inline int
+spin_compare_and_swap (volatile int *p, int oldval, int newval)
+{
+  char ret;
+  int readval;
+
+  __asm__ __volatile__ ("lock; cmpxchgl %3, %1; sete %0"
+			: "=q" (ret), "=m" (*p), "=a" (readval)
+			: "r" (newval), "m" (*p), "a" (oldval)
+			: "memory");
+  return ret;
+}
+
+/* Fair spinlocks are handed over to a given thread, so on uniprocessors
+   it is pointless to spin: let that thread run instead.  */
+
+static inline void
+spin_pause (void)
+{
+  if (__pthread_smp_kernel)
+    __asm__ __volatile__ ("rep; nop" : : : "memory");
+  else
+    sched_yield ();
+}
+
+
+static inline void
+ticket_spin_lock (volatile int *lock)
+{
+  int ticket = 1;
+  int val, ahead;
+
+  __asm__ __volatile__ ("lock; xaddw %w0, %1"
+			: "=r" (ticket), "=m" (*lock)
+			: "0" (ticket), "m" (*lock)
+			: "memory");
+  for (;;)
+    {
+      val = *lock;
+      ahead = (ticket - SPIN_TICKET_SERVED (val)) & 0x3fff;
+      if (ahead == 0)
+	break;
+      if (! __pthread_smp_kernel)
+	sched_yield ();
+      else
+	for (ahead *= SPIN_TICKET_BACKOFF; ahead > 0; --ahead)
+	  spin_pause ();
+    }
+}
+
+static inline int
+ticket_spin_trylock (volatile int *lock)
+{
+  int val = *lock;
+
+  if (SPIN_TICKET_NEXT (val) != SPIN_TICKET_SERVED (val))
+    return EBUSY;
+  return spin_compare_and_swap (lock, val,
+				(val & ~0xffff) | ((val + 1) & 0xffff))
+	 ? 0 : EBUSY;
+}
+
+static inline void
+ticket_spin_unlock (volatile int *lock)
+{
+  unsigned short served;
+
+  served = (SPIN_TICKET_INIT >> 16)
+	   | ((SPIN_TICKET_SERVED (*lock) + 1) & 0x3fff);
+  __asm__ __volatile__ ("movw %w1, %0"
+			: "=m" (((volatile unsigned short *) lock)[1])
+			: "r" (served)
+			: "memory");
+}
+
+
+static inline struct _pthread_spin_node *
+spin_queue_node (int index)
+{
+  index--;
+  return &__pthread_handles[index / PTHREAD_SPIN_NODES].h_descr
+	  ->p_spin_nodes[index % PTHREAD_SPIN_NODES];
+}
+
+static inline void
+queue_spin_lock_nonode (volatile int *lock)
+{
+  int val;
+
+  for (;;)
+    {
+      val = *lock;
+      if (SPIN_QUEUE_TAIL (val) == 0
+	  && spin_compare_and_swap (lock, val, val | SPIN_QUEUE_NONODE))
+	return;
+      spin_pause ();
+    }
+}
+
+static inline void
+queue_spin_lock (volatile int *lock)
+{
+  pthread_descr self = thread_self ();
+  struct _pthread_spin_node *node;
+  int i, index, val;
+
+  for (i = 0; i < PTHREAD_SPIN_NODES; i++)
+    if (self->p_spin_nodes[i].sn_lock == NULL)
+      break;
+  if (i == PTHREAD_SPIN_NODES)
+    {
+      queue_spin_lock_nonode (lock);
+      return;
+    }
+  node = &self->p_spin_nodes[i];
+  node->sn_lock = lock;
+  node->sn_next = 0;
+  node->sn_wait = 1;
+  index = THREAD_GETMEM (self, p_nr) * PTHREAD_SPIN_NODES + i + 1;
+
+  for (;;)
+    {
+      val = *lock;
+      if (SPIN_QUEUE_TAIL (val) != SPIN_QUEUE_NONODE
+	  && spin_compare_and_swap (lock, val, SPIN_QUEUE_INIT | index))
+	break;
+      spin_pause ();
+    }
+  if (SPIN_QUEUE_TAIL (val) != 0)
+    {
+      spin_queue_node (SPIN_QUEUE_TAIL (val))->sn_next = index;
+      while (node->sn_wait)
+	spin_pause ();
+    }
+}
+
+static inline int
+queue_spin_trylock (volatile int *lock)
+{
+  int val = *lock;
+
+  if (SPIN_QUEUE_TAIL (val) != 0)
+    return EBUSY;
+  return spin_compare_and_swap (lock, val, val | SPIN_QUEUE_NONODE)
+	 ? 0 : EBUSY;
+}
+
+static inline void
+queue_spin_unlock (volatile int *lock)
+{
+  pthread_descr self = thread_self ();
+  struct _pthread_spin_node *node;
+  int i, index, next;
+
+  for (i = 0; i < PTHREAD_SPIN_NODES; i++)
+    if (self->p_spin_nodes[i].sn_lock == lock)
+      break;
+  if (i == PTHREAD_SPIN_NODES)
+    {
+      /* Taken without a node; nobody can be queued behind us.  */
+      spin_compare_and_swap (lock, SPIN_QUEUE_INIT | SPIN_QUEUE_NONODE,
+			     SPIN_QUEUE_INIT);
+      return;
+    }
+  node = &self->p_spin_nodes[i];
+  index = THREAD_GETMEM (self, p_nr) * PTHREAD_SPIN_NODES + i + 1;
+
+  next = node->sn_next;
+  if (next == 0)
+    {
+      if (spin_compare_and_swap (lock, SPIN_QUEUE_INIT | index,
+				 SPIN_QUEUE_INIT))
+	{
+	  node->sn_lock = NULL;
+	  return;
+	}
+      /* A thread is enqueuing itself behind us; wait for the link.  */
+      while ((next = node->sn_next) == 0)
+	spin_pause ();
+    }
+  node->sn_lock = NULL;
+  spin_queue_node (next)->sn_wait = 0;
+}
@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <pthread.h>
 #include "internals.h"
+#include "pspinlock-fair.h"
 #include "kernel-features.h"
 
 
@@ -35,6 +36,16 @@
 int
 __pthread_spin_lock (pthread_spinlock_t *lock)
 {
+  switch (SPIN_KIND (*lock))
+    {
+    case SPIN_KIND_TICKET:
+      ticket_spin_lock (lock);
+      return 0;
+    case SPIN_KIND_QUEUE:
+      queue_spin_lock (lock);
+      return 0;
+    }
+
   asm volatile
     ("\n"
      "1:\n\t"
@@ -58,6 +69,14 @@ __pthread_spin_trylock (pthread_spinlock_t *lock)
 {
   int oldval;
 
+  switch (SPIN_KIND (*lock))
+    {
+    case SPIN_KIND_TICKET:
+      return ticket_spin_trylock (lock);
+    case SPIN_KIND_QUEUE:
+      return queue_spin_trylock (lock);
+    }
+
   asm volatile
     ("xchgl %0,%1"
      : "=r" (oldval), "=m" (*lock)
@@ -70,6 +89,16 @@ weak_alias (__pthread_spin_trylock, pthread_spin_trylock)
 int
 __pthread_spin_unlock (pthread_spinlock_t *lock)
 {
+  switch (SPIN_KIND (*lock))
+    {
+    case SPIN_KIND_TICKET:
+      ticket_spin_unlock (lock);
+      return 0;
+    case SPIN_KIND_QUEUE:
+      queue_spin_unlock (lock);
+      return 0;
+    }
+
   asm volatile
     ("movl $1,%0"
      : "=m" (*lock));
@@ -83,8 +112,17 @@ __pthread_spin_init (pthread_spinlock_t *lock, int pshared)
 {
   /* We can ignore the `pshared' parameter.  Since we are busy-waiting
      all processes which can access the memory location `lock' points
-     to can use the spinlock.  */
-  *lock = 1;
+     to can use the spinlock.  Only queued spinlocks need it, as their
+     queue lives in the thread descriptors; shared ones get tickets.
+     Any other bit set asks for sharing, as any nonzero PSHARED always
+     did.  */
+  if ((pshared & PTHREAD_SPIN_QUEUED_NP)
+      && !(pshared & ~(PTHREAD_SPIN_TICKET_NP | PTHREAD_SPIN_QUEUED_NP)))
+    *lock = SPIN_QUEUE_INIT;
+  else if (pshared & (PTHREAD_SPIN_TICKET_NP | PTHREAD_SPIN_QUEUED_NP))
+    *lock = SPIN_TICKET_INIT;
+  else
+    *lock = 1;
   return 0;
 }
 weak_alias (__pthread_spin_init, pthread_spin_init)
@@ -28,6 +28,7 @@
 #endif
 
 extern long int testandset (int *spinlock);
+extern long int __spinlock_exchange (int *spinlock, int newval);
 extern int __compare_and_swap (long int *p, long int oldval, long int newval);
 
 /* Get some notion of the current stack.  Need not be exactly the top
@@ -51,6 +52,25 @@ testandset (int *spinlock)
 }
 
 
+/* Store NEWVAL in a spinlock and return its old value, for spinlocks
+   which tell whether threads sleep on them.  */
+#define HAS_SPINLOCK_EXCHANGE
+
+PT_EI long int
+__spinlock_exchange (int *spinlock, int newval)
+{
+  long int ret;
+
+  __asm__ __volatile__(
+       "xchgl %0, %1"
+       : "=r"(ret), "=m"(*spinlock)
+       : "0"(newval), "m"(*spinlock)
+       : "memory");
+
+  return ret;
+}
+
+
 /* Compare-and-swap for semaphores.
    Available on the 486 and above, but not on the 386.
    We test dynamically whether it's available or not. */
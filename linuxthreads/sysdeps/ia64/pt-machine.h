@@ -28,6 +28,7 @@
 #endif
 
 extern long int testandset (int *spinlock);
+extern long int __spinlock_exchange (int *spinlock, int newval);
 extern int __compare_and_swap (long int *p, long int oldval, long int newval);
 
 /* Make sure gcc doesn't try to be clever and move things around on
@@ -123,4 +124,23 @@ testandset (int *spinlock)
   return ret;
 }
 
+/* Store NEWVAL in a spinlock and return its old value, for spinlocks
+   which tell whether threads sleep on them.  xchg4 only has acquire
+   semantics, so releasing a spinlock needs a barrier before it.  */
+#define HAS_SPINLOCK_EXCHANGE
+
+PT_EI long int
+__spinlock_exchange (int *spinlock, int newval)
+{
+  long int ret;
+
+  __asm__ __volatile__(
+       "xchg4 %0=%1,%2"
+       : "=r"(ret), "=m"(__atomic_fool_gcc (spinlock))
+       : "r"(newval), "1"(__atomic_fool_gcc (spinlock))
+       : "memory");
+
+  return ret;
+}
+
 #endif /* pt-machine.h */
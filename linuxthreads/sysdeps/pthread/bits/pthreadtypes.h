@@ -99,7 +99,7 @@ typedef int pthread_once_t;
 typedef struct _pthread_rwlock_t
 {
   struct _pthread_fastlock __rw_lock; /* Lock to guarantee mutual exclusion */
-  int __rw_readers;                   /* Number of readers */
+  long int __rw_readers;              /* Number of readers, and flags */
   _pthread_descr __rw_writer;         /* Identity of writer, or NULL if none */
   _pthread_descr __rw_read_waiting;   /* Threads waiting for reading */
   _pthread_descr __rw_write_waiting;  /* Threads waiting for writing */
@@ -135,6 +135,15 @@ typedef struct {
 
 #endif
 
+#ifdef __USE_GNU
+/* Sequence lock.  */
+typedef struct
+{
+  struct _pthread_fastlock __sl_lock; /* Lock serializing the writers */
+  volatile unsigned long int __sl_seq; /* Odd while a writer is at work */
+} pthread_seqlock_t;
+#endif
+
 
 /* Thread identifiers */
 typedef unsigned long int pthread_t;
@@ -85,6 +85,9 @@ extern int __timer_init_failed;
 /* A distinct thread is used for each clock type.  */
 
 extern struct thread_node __timer_signal_thread_rclk;
+#ifdef _POSIX_MONOTONIC_CLOCK
+extern struct thread_node __timer_signal_thread_mclk;
+#endif
 #ifdef _POSIX_CPUTIME
 extern struct thread_node __timer_signal_thread_pclk;
 #endif
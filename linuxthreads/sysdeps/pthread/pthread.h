@@ -39,6 +39,8 @@ __BEGIN_DECLS
   {0, 0, 0, PTHREAD_MUTEX_ERRORCHECK_NP, __LOCK_INITIALIZER}
 # define PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP \
   {0, 0, 0, PTHREAD_MUTEX_ADAPTIVE_NP, __LOCK_INITIALIZER}
+# define PTHREAD_QUEUED_MUTEX_INITIALIZER_NP \
+  {0, 0, 0, PTHREAD_MUTEX_QUEUED_NP, __LOCK_INITIALIZER}
 #endif
 
 #define PTHREAD_COND_INITIALIZER {__LOCK_INITIALIZER, 0}
@@ -52,6 +54,10 @@ __BEGIN_DECLS
 # define PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP \
   { __LOCK_INITIALIZER, 0, NULL, NULL, NULL,				      \
     PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP, PTHREAD_PROCESS_PRIVATE }
+# define PTHREAD_RWLOCK_SCALABLE_INITIALIZER_NP \
+  { __LOCK_INITIALIZER, 0, NULL, NULL, NULL,				      \
+    PTHREAD_RWLOCK_PREFER_READER_SCALABLE_NP, PTHREAD_PROCESS_PRIVATE }
+# define PTHREAD_SEQLOCK_INITIALIZER_NP { __LOCK_INITIALIZER, 0 }
 #endif
 
 /* Values for attributes.  */
@@ -86,6 +92,10 @@ enum
   PTHREAD_MUTEX_RECURSIVE_NP,
   PTHREAD_MUTEX_ERRORCHECK_NP,
   PTHREAD_MUTEX_ADAPTIVE_NP
+#ifdef __USE_GNU
+  ,
+  PTHREAD_MUTEX_QUEUED_NP
+#endif
 #ifdef __USE_UNIX98
   ,
   PTHREAD_MUTEX_NORMAL = PTHREAD_MUTEX_TIMED_NP,
@@ -107,16 +117,39 @@ enum
 #define PTHREAD_PROCESS_SHARED	PTHREAD_PROCESS_SHARED
 };
 
+#ifdef __USE_GNU
+/* Flags which can be or'ed to the PSHARED argument of pthread_spin_init
+   to select a fair spinlock.  */
+enum
+{
+  PTHREAD_SPIN_TICKET_NP = 0x10,
+#define PTHREAD_SPIN_TICKET_NP	PTHREAD_SPIN_TICKET_NP
+  PTHREAD_SPIN_QUEUED_NP = 0x20
+#define PTHREAD_SPIN_QUEUED_NP	PTHREAD_SPIN_QUEUED_NP
+};
+#endif
+
 #ifdef __USE_UNIX98
 enum
 {
   PTHREAD_RWLOCK_PREFER_READER_NP,
   PTHREAD_RWLOCK_PREFER_WRITER_NP,
   PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP,
+  PTHREAD_RWLOCK_PREFER_READER_SCALABLE_NP,
   PTHREAD_RWLOCK_DEFAULT_NP = PTHREAD_RWLOCK_PREFER_WRITER_NP
 };
 #endif	/* Unix98 */
 
+#if defined __USE_XOPEN2K && defined __USE_GNU
+/* Barrier kinds.  */
+enum
+{
+  PTHREAD_BARRIER_CENTRAL_NP,
+  PTHREAD_BARRIER_TREE_NP,
+  PTHREAD_BARRIER_DEFAULT_NP = PTHREAD_BARRIER_CENTRAL_NP
+};
+#endif
+
 #define PTHREAD_ONCE_INIT 0
 
 /* Special constants */
@@ -382,6 +415,27 @@ extern int pthread_mutexattr_gettype (__const pthread_mutexattr_t *__restrict
 				      __attr, int *__restrict __kind) __THROW;
 #endif
 
+#ifdef __USE_GNU
+/* Set the max number of times a thread spins on a PTHREAD_MUTEX_ADAPTIVE_NP
+   mutex initialized with *ATTR before suspending to SPIN, or to the
+   process-wide default if SPIN is -1.  */
+extern int pthread_mutexattr_setspin_np (pthread_mutexattr_t *__attr,
+					 int __spin) __THROW;
+
+/* Return in *SPIN the max spin count attribute in *ATTR.  */
+extern int pthread_mutexattr_getspin_np (__const pthread_mutexattr_t *
+					 __restrict __attr,
+					 int *__restrict __spin) __THROW;
+
+/* Return in *ACQUIRED and *SUSPENDED approximate counts of the contended
+   adaptive mutexes that were obtained by spinning and of those that had
+   to suspend the calling thread after spinning, over the whole
+   process.  */
+extern int pthread_mutex_getspinstats_np (unsigned long int *__acquired,
+					  unsigned long int *__suspended)
+     __THROW;
+#endif
+
 
 /* Functions for handling conditional variables.  */
 
@@ -431,6 +485,18 @@ extern int pthread_condattr_getpshared (__const pthread_condattr_t *
 extern int pthread_condattr_setpshared (pthread_condattr_t *__attr,
 					int __pshared) __THROW;
 
+#ifdef __USE_XOPEN2K
+/* Get the clock selected for the condition variable attribute ATTR.  */
+extern int pthread_condattr_getclock (__const pthread_condattr_t *
+				      __restrict __attr,
+				      clockid_t *__restrict __clock_id)
+     __THROW;
+
+/* Set the clock selected for the condition variable attribute ATTR.  */
+extern int pthread_condattr_setclock (pthread_condattr_t *__attr,
+				      clockid_t __clock_id) __THROW;
+#endif
+
 
 #ifdef __USE_UNIX98
 /* Functions for handling read-write locks.  */
@@ -473,6 +539,19 @@ extern int pthread_rwlock_timedwrlock (pthread_rwlock_t *__restrict __rwlock,
 /* Unlock RWLOCK.  */
 extern int pthread_rwlock_unlock (pthread_rwlock_t *__rwlock) __THROW;
 
+#ifdef __USE_GNU
+/* Turn the read lock the calling thread holds on RWLOCK into a write
+   lock if no other thread holds a read lock, or fail with EBUSY.  The
+   calling thread must hold a read lock on RWLOCK; this is checked, with
+   EPERM, only for rwlocks which prefer writers and are not shared
+   between processes.  */
+extern int pthread_rwlock_tryupgrade_np (pthread_rwlock_t *__rwlock) __THROW;
+
+/* Turn the write lock the calling thread holds on RWLOCK into a read
+   lock.  */
+extern int pthread_rwlock_downgrade_np (pthread_rwlock_t *__rwlock) __THROW;
+#endif
+
 
 /* Functions for handling read-write lock attributes.  */
 
@@ -500,12 +579,50 @@ extern int pthread_rwlockattr_setkind_np (pthread_rwlockattr_t *__attr,
 					  int __pref) __THROW;
 #endif
 
+#ifdef __USE_GNU
+/* Functions for handling sequence locks.  Readers never write to the
+   lock: they take a sequence number with pthread_seqlock_read_begin_np,
+   read the data it protects, and start over if
+   pthread_seqlock_read_retry_np then reports that a writer got in.  */
+
+/* Initialize sequence lock SEQLOCK.  */
+extern int pthread_seqlock_init_np (pthread_seqlock_t *__seqlock) __THROW;
+
+/* Destroy sequence lock SEQLOCK.  */
+extern int pthread_seqlock_destroy_np (pthread_seqlock_t *__seqlock) __THROW;
+
+/* Return the sequence number of SEQLOCK to start a read with, spinning
+   while a writer is at work.  */
+extern unsigned long int
+pthread_seqlock_read_begin_np (__const pthread_seqlock_t *__seqlock) __THROW;
+
+/* Same, but sleep until the writer is done if it does not leave soon.  */
+extern unsigned long int
+pthread_seqlock_read_begin_wait_np (pthread_seqlock_t *__seqlock) __THROW;
+
+/* Return nonzero if a writer took SEQLOCK since the read which got SEQ
+   from pthread_seqlock_read_begin_np started, so that the read has to be
+   done again.  */
+extern int pthread_seqlock_read_retry_np (__const pthread_seqlock_t *__seqlock,
+					  unsigned long int __seq) __THROW;
+
+/* Lock SEQLOCK for writing.  */
+extern int pthread_seqlock_write_lock_np (pthread_seqlock_t *__seqlock)
+     __THROW;
+
+/* Unlock SEQLOCK locked for writing.  */
+extern int pthread_seqlock_write_unlock_np (pthread_seqlock_t *__seqlock)
+     __THROW;
+#endif
+
 #ifdef __USE_XOPEN2K
 /* The IEEE Std. 1003.1j-2000 introduces functions to implement
    spinlocks.  */
 
 /* Initialize the spinlock LOCK.  If PSHARED is nonzero the spinlock can
-   be shared between different processes.  */
+   be shared between different processes.  With the GNU extension flags
+   PTHREAD_SPIN_TICKET_NP or PTHREAD_SPIN_QUEUED_NP or'ed to PSHARED, the
+   lock is granted in FIFO order, where the implementation supports it.  */
 extern int pthread_spin_init (pthread_spinlock_t *__lock, int __pshared)
      __THROW;
 
@@ -541,6 +658,31 @@ extern int pthread_barrierattr_getpshared (__const pthread_barrierattr_t *
 extern int pthread_barrierattr_setpshared (pthread_barrierattr_t *__attr,
 					   int __pshared) __THROW;
 
+# ifdef __USE_GNU
+/* Return in *KIND the kind of barrier set in ATTR.  */
+extern int pthread_barrierattr_getkind_np (__const pthread_barrierattr_t *
+					   __restrict __attr,
+					   int *__restrict __kind) __THROW;
+
+/* Set the kind of barrier in ATTR to KIND: PTHREAD_BARRIER_TREE_NP makes
+   the threads arrive through a combining tree and watch a release flag
+   instead of queueing on one lock, which scales to many threads.  It is
+   ignored for process-shared barriers.  */
+extern int pthread_barrierattr_setkind_np (pthread_barrierattr_t *__attr,
+					   int __kind) __THROW;
+
+/* Return in *SPIN the max spin count attribute in *ATTR.  */
+extern int pthread_barrierattr_getspin_np (__const pthread_barrierattr_t *
+					   __restrict __attr,
+					   int *__restrict __spin) __THROW;
+
+/* Make the waiters of a barrier initialized with *ATTR spin at most SPIN
+   times before they go to sleep, or as set process-wide if SPIN is
+   -1.  SPIN cannot be more than 32766.  */
+extern int pthread_barrierattr_setspin_np (pthread_barrierattr_t *__attr,
+					   int __spin) __THROW;
+# endif
+
 extern int pthread_barrier_wait (pthread_barrier_t *__barrier) __THROW;
 #endif
 
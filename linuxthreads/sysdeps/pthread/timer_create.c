@@ -38,6 +38,9 @@ timer_create (clock_id, evp, timerid)
   struct thread_node *thread = NULL;
 
   if (clock_id != CLOCK_REALTIME
+#ifdef _POSIX_MONOTONIC_CLOCK
+      && clock_id != CLOCK_MONOTONIC
+#endif
 #ifdef _POSIX_CPUTIME
       && clock_id != CLOCK_PROCESS_CPUTIME_ID
 #endif
@@ -95,6 +98,11 @@ timer_create (clock_id, evp, timerid)
 	default:
 	  thread = &__timer_signal_thread_rclk;
 	  break;
+#ifdef _POSIX_MONOTONIC_CLOCK
+	case CLOCK_MONOTONIC:
+	  thread = &__timer_signal_thread_mclk;
+	  break;
+#endif
 #ifdef _POSIX_CPUTIME
 	case CLOCK_PROCESS_CPUTIME_ID:
 	  thread = &__timer_signal_thread_pclk;
@@ -52,6 +52,9 @@ int __timer_init_failed;
 
 /* Node for the thread used to deliver signals.  */
 struct thread_node __timer_signal_thread_rclk;
+#ifdef _POSIX_MONOTONIC_CLOCK
+struct thread_node __timer_signal_thread_mclk;
+#endif
 #ifdef _POSIX_CPUTIME
 struct thread_node __timer_signal_thread_pclk;
 #endif
@@ -151,6 +154,8 @@ timer_links2ptr (struct list_links *list)
 static void
 thread_init (struct thread_node *thread, const pthread_attr_t *attr, clockid_t clock_id)
 {
+  pthread_condattr_t condattr;
+
   if (attr != NULL)
     thread->attr = *attr;
   else
@@ -161,7 +166,12 @@ thread_init (struct thread_node *thread, const pthread_attr_t *attr, clockid_t c
 
   thread->exists = 0;
   list_init (&thread->timer_queue);
-  pthread_cond_init (&thread->cond, 0);
+  /* The thread waits for the expiry times of its timers, so the
+     condition variable must time out on their clock.  Threads for the
+     CPU clocks are left with CLOCK_REALTIME, which it does not support.  */
+  pthread_condattr_init (&condattr);
+  pthread_condattr_setclock (&condattr, clock_id);
+  pthread_cond_init (&thread->cond, &condattr);
   thread->current_timer = 0;
   thread->captured = pthread_self ();
   thread->clock_id = clock_id;
@@ -190,6 +200,9 @@ init_module (void)
     list_append (&thread_free_list, &thread_array[i].links);
 
   thread_init (&__timer_signal_thread_rclk, 0, CLOCK_REALTIME);
+#ifdef _POSIX_MONOTONIC_CLOCK
+  thread_init (&__timer_signal_thread_mclk, 0, CLOCK_MONOTONIC);
+#endif
 #ifdef _POSIX_CPUTIME
   thread_init (&__timer_signal_thread_pclk, 0, CLOCK_PROCESS_CPUTIME_ID);
 #endif
@@ -280,6 +293,9 @@ thread_cleanup (void *val)
 
       /* How did the signal thread get killed?  */
       assert (thread != &__timer_signal_thread_rclk);
+#ifdef _POSIX_MONOTONIC_CLOCK
+      assert (thread != &__timer_signal_thread_mclk);
+#endif
 #ifdef _POSIX_CPUTIME
       assert (thread != &__timer_signal_thread_pclk);
 #endif
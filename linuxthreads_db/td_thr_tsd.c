@@ -32,7 +32,7 @@ td_thr_tsd (const td_thrhandle_t *th, const thread_key_t tk, void **data)
   int pthread_key_2ndlevel_size = th->th_ta_p->pthread_key_2ndlevel_size;
   unsigned int idx1st;
   unsigned int idx2nd;
-  void *p;
+  struct pthread_key_data kd;
 
   LOG ("td_thr_tsd");
 
@@ -71,12 +71,14 @@ td_thr_tsd (const td_thrhandle_t *th, const thread_key_t tk, void **data)
      XXX I don't know whether it's correct but there is currently no
      easy way to determine whether a key was never set or the value
      is NULL.  We return an error whenever the value is NULL.  */
-  if (ps_pdread (th->th_ta_p->ph, &pds.p_specific[idx1st][idx2nd], &p,
-		 sizeof (void *)) != PS_OK)
+  if (ps_pdread (th->th_ta_p->ph, &pds.p_specific[idx1st][idx2nd], &kd,
+		 sizeof (struct pthread_key_data)) != PS_OK)
     return TD_ERR;
 
-  if (p != NULL)
-    *data = p;
+  /* A value set before the key was last deleted is not current.  */
+  if (kd.data == NULL || kd.seq != key.seq)
+    return TD_NOTSD;
 
-  return p != NULL ? TD_OK : TD_NOTSD;
+  *data = kd.data;
+  return TD_OK;
 }